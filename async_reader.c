@@ -0,0 +1,554 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/* Needed for fopencookie */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "async_reader.h"
+
+
+/* Chunk k of the file is always read into slot k % ASYNC_QUEUE_DEPTH */
+typedef struct {
+	int fd;
+	int reader;
+	char *data[ASYNC_QUEUE_DEPTH];
+	size_t length[ASYNC_QUEUE_DEPTH]; /* Bytes read into each slot so far */
+	int64_t chunk[ASYNC_QUEUE_DEPTH]; /* Chunk held (or being read) by each slot, -1 if none */
+	bool ready[ASYNC_QUEUE_DEPTH];
+	int64_t current; /* Chunk being parsed */
+	size_t pos; /* Position in the current chunk */
+	int64_t next_chunk; /* Next chunk to start reading */
+	int64_t eof_chunk; /* First chunk shorter than ASYNC_CHUNK_SIZE (-1 until it is known) */
+	int error; /* errno of a failed read */
+
+	/* Read-ahead thread */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	/* io_uring */
+	int ring_fd;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit;
+	unsigned in_flight;
+} async_file;
+
+
+static bool can_start_read(async_file *af) {
+
+	/* A chunk can be read once the chunk last held by its slot is no longer needed, i.e. is older than the one before
+	 * the current chunk
+	 */
+
+	return af->error == 0 && af->next_chunk < af->current - 1 + ASYNC_QUEUE_DEPTH && (af->eof_chunk == -1 || af->next_chunk <= af->eof_chunk);
+}
+
+
+static void finish_chunk(async_file *af, int slot) {
+
+	if (af->length[slot] < ASYNC_CHUNK_SIZE && (af->eof_chunk == -1 || af->chunk[slot] < af->eof_chunk)) {
+		af->eof_chunk = af->chunk[slot];
+	}
+	af->ready[slot] = true;
+
+	return;
+}
+
+
+static void *read_ahead_thread(void *arg) {
+
+	async_file *af = arg;
+	int64_t k;
+	int slot;
+	ssize_t num_read;
+	size_t length;
+	int error;
+
+	pthread_mutex_lock(&af->lock);
+
+	while (!af->stop) {
+		if (!can_start_read(af)) {
+			pthread_cond_wait(&af->cond, &af->lock);
+			continue;
+		}
+
+		k = af->next_chunk++;
+		slot = k % ASYNC_QUEUE_DEPTH;
+		af->chunk[slot] = k;
+		af->ready[slot] = false;
+		pthread_mutex_unlock(&af->lock);
+
+		/* Reads can come back short (e.g. on network filesystems), so carry on until the chunk is full or the file ends */
+		length = 0;
+		error = 0;
+		while (length < ASYNC_CHUNK_SIZE) {
+			num_read = pread(af->fd, af->data[slot] + length, ASYNC_CHUNK_SIZE - length, k * ASYNC_CHUNK_SIZE + length);
+			if (num_read < 0 && errno == EINTR) {
+				continue;
+			}
+			if (num_read < 0) {
+				error = errno;
+				break;
+			}
+			if (num_read == 0) {
+				break;
+			}
+			length += num_read;
+		}
+
+		pthread_mutex_lock(&af->lock);
+		af->length[slot] = length;
+		if (error) {
+			af->error = error;
+		}
+		finish_chunk(af, slot);
+		pthread_cond_broadcast(&af->cond);
+	}
+
+	pthread_mutex_unlock(&af->lock);
+
+	return NULL;
+}
+
+
+static void uring_submit_read(async_file *af, int slot) {
+
+	/* Queue a read of the rest of the chunk in slot */
+
+	unsigned tail = *af->sq_tail;
+	unsigned index = tail & *af->sq_mask;
+	struct io_uring_sqe *sqe = &af->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = af->fd;
+	sqe->addr = (uint64_t) (uintptr_t) (af->data[slot] + af->length[slot]);
+	sqe->len = ASYNC_CHUNK_SIZE - af->length[slot];
+	sqe->off = af->chunk[slot] * ASYNC_CHUNK_SIZE + af->length[slot];
+	sqe->user_data = slot;
+
+	af->sq_array[index] = index;
+	__atomic_store_n(af->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	af->to_submit++;
+	af->in_flight++;
+
+	return;
+}
+
+
+static void uring_pump(async_file *af, bool wait, bool resubmit) {
+
+	/* Start reads of every chunk which has a free slot, submit them, and collect the reads which have finished. If wait
+	 * is set, block until at least one has.
+	 */
+
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int submitted;
+	int64_t k;
+	int slot;
+
+	while (resubmit && can_start_read(af)) {
+		k = af->next_chunk++;
+		slot = k % ASYNC_QUEUE_DEPTH;
+		af->chunk[slot] = k;
+		af->ready[slot] = false;
+		af->length[slot] = 0;
+		uring_submit_read(af, slot);
+	}
+
+	wait = wait && af->in_flight > 0;
+
+	if (af->to_submit > 0 || wait) {
+		while ((submitted = syscall(__NR_io_uring_enter, af->ring_fd, af->to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0) {
+			if (errno != EINTR) {
+				fprintf(stderr, "ERROR: io_uring_enter failed (%s)\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		af->to_submit -= submitted;
+	}
+
+	head = *af->cq_head;
+	while (head != __atomic_load_n(af->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &af->cqes[head & *af->cq_mask];
+		slot = cqe->user_data;
+		af->in_flight--;
+
+		if (cqe->res < 0) {
+			af->error = -cqe->res;
+			finish_chunk(af, slot);
+		}
+		else {
+			af->length[slot] += cqe->res;
+			if (cqe->res == 0 || af->length[slot] == ASYNC_CHUNK_SIZE || !resubmit) {
+				finish_chunk(af, slot);
+			}
+			else {
+				/* Short read: ask for the rest of the chunk */
+				uring_submit_read(af, slot);
+			}
+		}
+
+		head++;
+	}
+	__atomic_store_n(af->cq_head, head, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+static bool setup_uring(async_file *af) {
+
+	/* Set up the submission and completion rings. Returns false if io_uring is not available. */
+
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(struct io_uring_params));
+
+	if ((af->ring_fd = syscall(__NR_io_uring_setup, ASYNC_QUEUE_DEPTH, &params)) < 0) {
+		return false;
+	}
+
+	af->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	af->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	af->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (af->cq_ring_size > af->sq_ring_size) {
+			af->sq_ring_size = af->cq_ring_size;
+		}
+		af->cq_ring_size = af->sq_ring_size;
+	}
+
+	af->sq_ring = mmap(NULL, af->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, af->ring_fd, IORING_OFF_SQ_RING);
+	if (af->sq_ring == MAP_FAILED) {
+		close(af->ring_fd);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		af->cq_ring = af->sq_ring;
+	}
+	else if ((af->cq_ring = mmap(NULL, af->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, af->ring_fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		munmap(af->sq_ring, af->sq_ring_size);
+		close(af->ring_fd);
+		return false;
+	}
+
+	if ((af->sqes = mmap(NULL, af->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, af->ring_fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		if (af->cq_ring != af->sq_ring) {
+			munmap(af->cq_ring, af->cq_ring_size);
+		}
+		munmap(af->sq_ring, af->sq_ring_size);
+		close(af->ring_fd);
+		return false;
+	}
+
+	af->sq_tail = (unsigned *) ((char *) af->sq_ring + params.sq_off.tail);
+	af->sq_mask = (unsigned *) ((char *) af->sq_ring + params.sq_off.ring_mask);
+	af->sq_array = (unsigned *) ((char *) af->sq_ring + params.sq_off.array);
+	af->cq_head = (unsigned *) ((char *) af->cq_ring + params.cq_off.head);
+	af->cq_tail = (unsigned *) ((char *) af->cq_ring + params.cq_off.tail);
+	af->cq_mask = (unsigned *) ((char *) af->cq_ring + params.cq_off.ring_mask);
+	af->cqes = (struct io_uring_cqe *) ((char *) af->cq_ring + params.cq_off.cqes);
+	af->to_submit = 0;
+	af->in_flight = 0;
+
+	return true;
+}
+
+
+static int wait_for_current(async_file *af) {
+
+	/* Wait until the current chunk has been read. Returns its slot, or -1 if a read failed. */
+
+	int slot = af->current % ASYNC_QUEUE_DEPTH;
+
+	if (af->reader == thread_reader) {
+		pthread_mutex_lock(&af->lock);
+		while (!(af->chunk[slot] == af->current && af->ready[slot]) && af->error == 0) {
+			pthread_cond_wait(&af->cond, &af->lock);
+		}
+		pthread_mutex_unlock(&af->lock);
+	}
+	else {
+		while (!(af->chunk[slot] == af->current && af->ready[slot]) && af->error == 0) {
+			uring_pump(af, true, true);
+		}
+	}
+
+	if (af->error != 0) {
+		errno = af->error;
+		return -1;
+	}
+
+	return slot;
+}
+
+
+static void set_current(async_file *af, int64_t chunk, size_t pos) {
+
+	if (af->reader == thread_reader) {
+		pthread_mutex_lock(&af->lock);
+		af->current = chunk;
+		af->pos = pos;
+		pthread_cond_broadcast(&af->cond);
+		pthread_mutex_unlock(&af->lock);
+	}
+	else {
+		af->current = chunk;
+		af->pos = pos;
+		/* Fill any slots which have just been freed */
+		uring_pump(af, false, true);
+	}
+
+	return;
+}
+
+
+static ssize_t async_read(void *cookie, char *buf, size_t size) {
+
+	async_file *af = cookie;
+	size_t copied = 0;
+	size_t to_copy;
+	int slot;
+
+	while (copied < size) {
+		if ((slot = wait_for_current(af)) == -1) {
+			return -1;
+		}
+
+		if (af->pos == af->length[slot]) {
+			if (af->length[slot] < ASYNC_CHUNK_SIZE) {
+				/* End of file */
+				break;
+			}
+			set_current(af, af->current + 1, 0);
+			continue;
+		}
+
+		to_copy = af->length[slot] - af->pos;
+		to_copy = (size - copied < to_copy) ? size - copied : to_copy;
+		memcpy(buf + copied, af->data[slot] + af->pos, to_copy);
+		af->pos += to_copy;
+		copied += to_copy;
+	}
+
+	return copied;
+}
+
+
+static int async_seek(void *cookie, off64_t *offset, int whence) {
+
+	/* Only positions in the current chunk and the one before it can be reached */
+
+	async_file *af = cookie;
+	int64_t target;
+	int64_t chunk;
+	size_t pos;
+	int slot;
+	bool held;
+
+	if (whence == SEEK_SET) {
+		target = *offset;
+	}
+	else if (whence == SEEK_CUR) {
+		target = af->current * ASYNC_CHUNK_SIZE + af->pos + *offset;
+	}
+	else {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (target < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	chunk = target / ASYNC_CHUNK_SIZE;
+	pos = target % ASYNC_CHUNK_SIZE;
+
+	/* The end of the current chunk is the same place as the start of the next one */
+	if (chunk == af->current + 1 && pos == 0) {
+		chunk = af->current;
+		pos = ASYNC_CHUNK_SIZE;
+	}
+
+	if (chunk == af->current - 1) {
+		slot = chunk % ASYNC_QUEUE_DEPTH;
+		if (af->reader == thread_reader) {
+			pthread_mutex_lock(&af->lock);
+		}
+		held = (af->chunk[slot] == chunk && af->ready[slot]);
+		if (af->reader == thread_reader) {
+			pthread_mutex_unlock(&af->lock);
+		}
+		if (!held) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	else if (chunk != af->current) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	set_current(af, chunk, pos);
+	*offset = target;
+
+	return 0;
+}
+
+
+static int async_close(void *cookie) {
+
+	async_file *af = cookie;
+	int i; /* For loop counter */
+
+	if (af->reader == thread_reader) {
+		pthread_mutex_lock(&af->lock);
+		af->stop = true;
+		pthread_cond_broadcast(&af->cond);
+		pthread_mutex_unlock(&af->lock);
+		pthread_join(af->thread, NULL);
+		pthread_mutex_destroy(&af->lock);
+		pthread_cond_destroy(&af->cond);
+	}
+	else {
+		/* The kernel may still be writing into the buffers */
+		while (af->in_flight > 0) {
+			uring_pump(af, true, false);
+		}
+		munmap(af->sqes, af->sqes_size);
+		if (af->cq_ring != af->sq_ring) {
+			munmap(af->cq_ring, af->cq_ring_size);
+		}
+		munmap(af->sq_ring, af->sq_ring_size);
+		close(af->ring_fd);
+	}
+
+	for (i = 0; i < ASYNC_QUEUE_DEPTH; i++) {
+		free(af->data[i]);
+	}
+	close(af->fd);
+	free(af);
+
+	return 0;
+}
+
+
+FILE *open_input_file(char *file_name, int reader, bool quiet) {
+
+	/* Open file_name for reading with the given reader. Returns NULL if the file cannot be opened. */
+
+	async_file *af;
+	FILE *f;
+	cookie_io_functions_t functions = {async_read, NULL, async_seek, async_close};
+	int i; /* For loop counter */
+
+	if (reader == stdio_reader) {
+		return fopen(file_name, "r");
+	}
+
+	if ((af = malloc(sizeof(async_file))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((af->fd = open(file_name, O_RDONLY)) == -1) {
+		free(af);
+		return NULL;
+	}
+
+	for (i = 0; i < ASYNC_QUEUE_DEPTH; i++) {
+		if ((af->data[i] = malloc(ASYNC_CHUNK_SIZE)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		af->length[i] = 0;
+		af->chunk[i] = -1;
+		af->ready[i] = false;
+	}
+
+	af->current = 0;
+	af->pos = 0;
+	af->next_chunk = 0;
+	af->eof_chunk = -1;
+	af->error = 0;
+	af->stop = false;
+
+	if (reader == uring_reader && !setup_uring(af)) {
+		if (!quiet) {
+			fprintf(stderr, "WARNING: io_uring is not available - reading ahead on a thread instead\n");
+		}
+		reader = thread_reader;
+	}
+	af->reader = reader;
+
+	if (reader == thread_reader) {
+		pthread_mutex_init(&af->lock, NULL);
+		pthread_cond_init(&af->cond, NULL);
+		if (pthread_create(&af->thread, NULL, read_ahead_thread, af) != 0) {
+			fprintf(stderr, "ERROR: Failed to create read-ahead thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		uring_pump(af, false, true);
+	}
+
+	if ((f = fopencookie(af, "r", functions)) == NULL) {
+		fprintf(stderr, "ERROR: Could not open data file %s\n", file_name);
+		exit(EXIT_FAILURE);
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+	return f;
+}
@@ -0,0 +1,20 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Input files can be read through a stream which keeps several large reads in flight ahead of the parser, either on a
+ * read-ahead thread or with io_uring. The stream is an ordinary FILE (closed with fclose), so the parsers don't need to
+ * know which reader is in use. It only supports seeking back into the last two chunks read, which is all the parsers
+ * need.
+ */
+
+enum reader_enum {stdio_reader, thread_reader, uring_reader};
+
+#define ASYNC_CHUNK_SIZE (4 << 20)
+#define ASYNC_QUEUE_DEPTH 6 /* Chunks held at once: the one being parsed, the one before it, and the rest in flight */
+
+FILE *open_input_file(char *file_name, int reader, bool quiet);
+
+#endif
@@ -0,0 +1,203 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "c_tools.h"
+#include "table_memory.h"
+#include "sparse_table.h"
+#include "bloom.h"
+
+
+bloom_counter *create_bloom_counter(uint64_t memory_bytes, int numa, int huge_pages, bool quiet) {
+
+	bloom_counter *counter;
+	int i; /* For loop counter */
+
+	if ((counter = malloc(sizeof(bloom_counter))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Largest power of two number of bits which fits in memory_bytes (and at least one word) */
+	counter->num_bits = 64;
+	while (counter->num_bits * 2 / 8 <= memory_bytes) {
+		counter->num_bits *= 2;
+	}
+
+	/* Allocated like the hash table, so that it gets the same huge pages and NUMA placement */
+	counter->bits = (uint64_t *) alloc_hash_table(counter->num_bits / 32, numa, huge_pages, quiet);
+	counter->table = create_sparse_table(0);
+
+	for (i = 0; i < BLOOM_STRIPES; i++) {
+		counter->new_kmers[i].count = 0;
+	}
+
+	if (!quiet) {
+		fprintf(stderr, "Filtering singleton k-mers with a Bloom filter of %" PRIu64 " MiB\n", counter->num_bits >> 23);
+	}
+
+	return counter;
+}
+
+
+void free_bloom_counter(bloom_counter *counter) {
+
+	free_hash_table((uint32_t *) counter->bits);
+	free_sparse_table(counter->table);
+	free(counter);
+
+	return;
+}
+
+
+static bool test_and_set_bits(bloom_counter *counter, uint64_t mixed, bool concurrent) {
+
+	/* Set the k-mer's bits, returning whether they were all set already. The bits are found by double hashing. */
+
+	uint64_t step = mix_hash(mixed) | 1;
+	uint64_t bit, mask, old;
+	bool all_set = true;
+	int i; /* For loop counter */
+
+	for (i = 0; i < BLOOM_HASHES; i++) {
+		bit = (mixed + i * step) & (counter->num_bits - 1);
+		mask = 1ULL << (bit % 64);
+
+		if (concurrent) {
+			old = __atomic_fetch_or(&counter->bits[bit / 64], mask, __ATOMIC_RELAXED);
+		}
+		else {
+			old = counter->bits[bit / 64];
+			counter->bits[bit / 64] |= mask;
+		}
+
+		all_set = all_set && (old & mask);
+	}
+
+	return all_set;
+}
+
+
+static bool test_bits(bloom_counter *counter, uint64_t mixed) {
+
+	uint64_t step = mix_hash(mixed) | 1;
+	uint64_t bit;
+	int i; /* For loop counter */
+
+	for (i = 0; i < BLOOM_HASHES; i++) {
+		bit = (mixed + i * step) & (counter->num_bits - 1);
+		if (!(counter->bits[bit / 64] & (1ULL << (bit % 64)))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void bloom_count(bloom_counter *counter, uint64_t kmer, bool concurrent) {
+
+	/* Two threads meeting a new k-mer at the same moment may both find it new, in which case it is counted as two
+	 * singletons; this is rare enough not to be worth a lock.
+	 */
+
+	uint64_t mixed = mix_hash(kmer);
+
+	if (!test_and_set_bits(counter, mixed, concurrent)) {
+		if (concurrent) {
+			__atomic_fetch_add(&counter->new_kmers[mixed % BLOOM_STRIPES].count, 1, __ATOMIC_RELAXED);
+		}
+		else {
+			counter->new_kmers[mixed % BLOOM_STRIPES].count++;
+		}
+	}
+	else {
+		sparse_add(counter->table, kmer, 2, concurrent);
+	}
+
+	return;
+}
+
+
+uint32_t bloom_kmer_count(bloom_counter *counter, uint64_t kmer) {
+
+	uint32_t count = sparse_count(counter->table, kmer);
+
+	if (count == 0 && test_bits(counter, mix_hash(kmer))) {
+		count = 1;
+	}
+
+	return count;
+}
+
+
+static uint64_t count_singletons(bloom_counter *counter) {
+
+	uint64_t new_kmers = 0;
+	uint64_t in_table = sparse_num_kmers(counter->table);
+	int i; /* For loop counter */
+
+	for (i = 0; i < BLOOM_STRIPES; i++) {
+		new_kmers += counter->new_kmers[i].count;
+	}
+
+	/* False positives can put k-mers in the table which were never counted as new */
+	return (new_kmers > in_table) ? new_kmers - in_table : 0;
+}
+
+
+void bloom_histogram(bloom_counter *counter, long *hist, unsigned int histogram_size) {
+
+	unsigned int i; /* For loop counter */
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] = 0;
+	}
+
+	sparse_histogram(counter->table, hist, histogram_size);
+	hist[0] += count_singletons(counter);
+
+	return;
+}
+
+
+void print_bloom_summary(bloom_counter *counter, int kmer_size) {
+
+	uint64_t bits_set = 0;
+	uint64_t i; /* For loop counter */
+
+	for (i = 0; i < counter->num_bits / 64; i++) {
+		bits_set += __builtin_popcountll(counter->bits[i]);
+	}
+
+	fprintf(stderr, "Bloom filter: %" PRIu64 " singletons, %.2f%% false positive rate; sparse table: %" PRIu64 " k-mers in %" PRIu64 " MiB (the exact table would be %" PRIu64 " MiB)\n",
+			count_singletons(counter), 100 * pow((double) bits_set / counter->num_bits, BLOOM_HASHES), sparse_num_kmers(counter->table),
+			sparse_memory(counter->table) >> 20, ((1UL << (2 * kmer_size)) * sizeof(uint32_t)) >> 20);
+
+	return;
+}
@@ -0,0 +1,38 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Most of the distinct k-mers in high-coverage reads are errors seen only once. Here the first occurrence of a k-mer
+ * only sets its bits in a Bloom filter, and a k-mer only goes into the sparse table (with a count of two) when the
+ * filter shows that it has been seen before. The number of k-mers which were new to the filter is kept, so the
+ * singletons are those of them which never made it into the table.
+ *
+ * A false positive in the filter puts a k-mer into the table one occurrence early, so its count is one too high; the
+ * histogram is out by about the filter's false positive rate, which is printed after counting.
+ */
+
+#define BLOOM_HASHES 3
+#define BLOOM_STRIPES 64 /* New k-mers are tallied in this many counters, so that threads rarely share one */
+
+struct sparse_table;
+
+typedef struct bloom_counter {
+	uint64_t *bits;
+	uint64_t num_bits; /* Power of two */
+	struct sparse_table *table;
+	struct {
+		uint64_t count;
+		char padding[56]; /* Keeps each stripe on its own cache line */
+	} new_kmers[BLOOM_STRIPES];
+} bloom_counter;
+
+bloom_counter *create_bloom_counter(uint64_t memory_bytes, int numa, int huge_pages, bool quiet);
+void free_bloom_counter(bloom_counter *counter);
+void bloom_count(bloom_counter *counter, uint64_t kmer, bool concurrent);
+uint32_t bloom_kmer_count(bloom_counter *counter, uint64_t kmer);
+void bloom_histogram(bloom_counter *counter, long *hist, unsigned int histogram_size);
+void print_bloom_summary(bloom_counter *counter, int kmer_size);
+
+#endif
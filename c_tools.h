@@ -2,11 +2,24 @@
 
 #define C_TOOLS_H
 
+#include <stdint.h>
+
 typedef struct {
 	char* line;
 	bool bEOF;
 } line_return;
 
+/* Bitmaps are arrays of uint64_t holding 64 bits per word */
+#define BITMAP_WORDS(num_bits) (((num_bits) + 63) / 64)
+#define SET_BIT(bitmap, i) ((bitmap)[(i) / 64] |= (1ULL << ((i) % 64)))
+
+/* Scatter the bits of a k-mer's hash (the finaliser from splitmix64), for structures which can't index by it directly */
+static inline uint64_t mix_hash(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
 line_return get_next_line(FILE* f);
 bool is_str_integer(char* str);
 
@@ -0,0 +1,277 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "queue.h"
+#include "chunks.h"
+
+
+/* Amount of the file read at a time */
+#define CHUNK_READ_SIZE (1 << 20)
+
+
+typedef struct {
+	work_queue *full; /* Chunks waiting to be counted (NULL tells a worker to stop) */
+	work_queue *empty; /* Chunks which can be refilled */
+	kmer_params *params;
+	uint32_t *hash_table;
+} chunk_worker_args;
+
+typedef struct {
+	seq_chunk *current;
+	unsigned long chunk_size;
+	unsigned long capacity; /* chunk_size + window_size - 1 */
+	unsigned int overlap; /* window_size - 1 */
+	int num_threads;
+	work_queue *full;
+	work_queue *empty;
+	kmer_params *params;
+	uint32_t *hash_table;
+} chunk_filler;
+
+
+static void count_chunk(seq_chunk *chunk, kmer_params *params, uint32_t *hash_table) {
+
+	segment seg;
+
+	if (chunk->length < params->window_size) {
+		return;
+	}
+
+	chunk->seq[chunk->length] = '\0';
+
+	seg.name = "chunk";
+	seg.seq = chunk->seq;
+	seg.qual = "\0";
+	seg.length = chunk->length;
+
+	process_read(&seg, hash_phase, params, hash_table, NULL);
+
+	return;
+}
+
+
+static void *chunk_worker(void *arg) {
+
+	chunk_worker_args *worker = arg;
+	seq_chunk *chunk;
+
+	while ((chunk = pop_work(worker->full)) != NULL) {
+		count_chunk(chunk, worker->params, worker->hash_table);
+		push_work(worker->empty, chunk);
+	}
+
+	return NULL;
+}
+
+
+static void dispatch_chunk(chunk_filler *filler, bool keep_overlap) {
+
+	/* Hand the current chunk over to be counted and start a new one, beginning with the end of the old one if the
+	 * record carries on
+	 */
+
+	seq_chunk *next = (filler->num_threads > 1) ? pop_work(filler->empty) : NULL;
+	seq_chunk *current = filler->current;
+
+	if (filler->num_threads == 1) {
+		/* Count in place, then reuse the same buffer */
+		count_chunk(current, filler->params, filler->hash_table);
+		if (keep_overlap) {
+			memmove(current->seq, current->seq + filler->chunk_size, filler->overlap);
+		}
+		current->length = keep_overlap ? filler->overlap : 0;
+		return;
+	}
+
+	next->length = 0;
+	if (keep_overlap) {
+		memcpy(next->seq, current->seq + filler->chunk_size, filler->overlap);
+		next->length = filler->overlap;
+	}
+
+	push_work(filler->full, current);
+	filler->current = next;
+
+	return;
+}
+
+
+static void add_bases(chunk_filler *filler, const char *bases, unsigned long len) {
+
+	unsigned long to_copy;
+	seq_chunk *chunk;
+
+	while (len > 0) {
+		chunk = filler->current;
+		to_copy = filler->capacity - chunk->length;
+		to_copy = (len < to_copy) ? len : to_copy;
+
+		memcpy(chunk->seq + chunk->length, bases, to_copy);
+		chunk->length += to_copy;
+		bases += to_copy;
+		len -= to_copy;
+
+		if (chunk->length == filler->capacity) {
+			dispatch_chunk(filler, true);
+		}
+	}
+
+	return;
+}
+
+
+void count_fasta_in_chunks(FILE *f, kmer_params *params, uint32_t *hash_table, unsigned long chunk_size, int num_threads, long *read_count, bool quiet) {
+
+	/* Count the k-mers of a fasta file without ever holding a whole record in memory, splitting long records into
+	 * chunks which are counted on num_threads threads
+	 */
+
+	kmer_params chunk_params = *params;
+	chunk_filler filler;
+	work_queue full, empty;
+	chunk_worker_args worker;
+	int num_chunks = (num_threads > 1) ? (2 * num_threads) + 1 : 1;
+	seq_chunk chunks[num_chunks];
+	pthread_t threads[num_threads];
+	char *in_buf;
+	char *pos, *end, *newline;
+	size_t num_read;
+	bool at_line_start = true;
+	bool in_header = false;
+	int i; /* For loop counter */
+
+	chunk_params.concurrent = (num_threads > 1);
+
+	filler.chunk_size = chunk_size;
+	filler.overlap = params->window_size - 1;
+	filler.capacity = chunk_size + filler.overlap;
+	filler.num_threads = num_threads;
+	filler.full = &full;
+	filler.empty = &empty;
+	filler.params = &chunk_params;
+	filler.hash_table = hash_table;
+
+	if ((in_buf = malloc(CHUNK_READ_SIZE)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		if ((chunks[i].seq = malloc(filler.capacity + 1)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		chunks[i].length = 0;
+	}
+
+	filler.current = &chunks[0];
+
+	if (num_threads > 1) {
+		init_work_queue(&full, num_chunks + num_threads);
+		init_work_queue(&empty, num_chunks);
+
+		for (i = 1; i < num_chunks; i++) {
+			push_work(&empty, &chunks[i]);
+		}
+
+		worker.full = &full;
+		worker.empty = &empty;
+		worker.params = &chunk_params;
+		worker.hash_table = hash_table;
+
+		for (i = 0; i < num_threads; i++) {
+			if (pthread_create(&threads[i], NULL, chunk_worker, &worker) != 0) {
+				fprintf(stderr, "ERROR: Failed to create counting thread\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	while ((num_read = fread(in_buf, 1, CHUNK_READ_SIZE, f)) > 0) {
+		pos = in_buf;
+		end = in_buf + num_read;
+
+		while (pos < end) {
+			if (at_line_start && *pos == '>') {
+				/* New record: make sure no k-mer word runs into it from the previous one */
+				if (filler.current->length > 0) {
+					add_bases(&filler, "N", 1);
+				}
+				in_header = true;
+
+				(*read_count)++;
+				update_progress(read_count, quiet);
+			}
+
+			newline = memchr(pos, '\n', end - pos);
+
+			if (!in_header) {
+				add_bases(&filler, pos, (newline ? newline : end) - pos);
+			}
+
+			if (newline) {
+				pos = newline + 1;
+				at_line_start = true;
+				in_header = false;
+			}
+			else {
+				pos = end;
+				at_line_start = false;
+			}
+		}
+	}
+
+	dispatch_chunk(&filler, false);
+
+	if (num_threads > 1) {
+		/* The last chunk taken by dispatch_chunk is never used */
+		for (i = 0; i < num_threads; i++) {
+			push_work(&full, NULL);
+		}
+		for (i = 0; i < num_threads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+
+		destroy_work_queue(&full);
+		destroy_work_queue(&empty);
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		free(chunks[i].seq);
+	}
+	free(in_buf);
+
+	return;
+}
@@ -0,0 +1,15 @@
+#ifndef CHUNKS_H
+#define CHUNKS_H
+
+/* A piece of fasta sequence to be counted on its own. Consecutive chunks of a record overlap by window_size - 1 bases,
+ * so that every k-mer word is counted in exactly one chunk. Short records are packed into a chunk together, separated
+ * by an 'N' so that no k-mer word spans two of them.
+ */
+typedef struct {
+	char *seq;
+	unsigned long length;
+} seq_chunk;
+
+void count_fasta_in_chunks(FILE *f, kmer_params *params, uint32_t *hash_table, unsigned long chunk_size, int num_threads, long *read_count, bool quiet);
+
+#endif
@@ -0,0 +1,126 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "table_memory.h"
+#include "sparse_table.h"
+#include "compact_table.h"
+
+
+compact_table *create_compact_table(uint64_t num_cells, int numa, int huge_pages, bool quiet) {
+
+	compact_table *table;
+
+	if ((table = malloc(sizeof(compact_table))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Allocated like the hash table, so that it gets the same huge pages and NUMA placement */
+	table->cells = (uint16_t *) alloc_hash_table((num_cells + 1) / 2, numa, huge_pages, quiet);
+	table->num_cells = num_cells;
+	table->overflow = create_sparse_table(0);
+
+	return table;
+}
+
+
+void free_compact_table(compact_table *table) {
+
+	free_hash_table((uint32_t *) table->cells);
+	free_sparse_table(table->overflow);
+	free(table);
+
+	return;
+}
+
+
+void compact_add(compact_table *table, uint64_t kmer, bool concurrent) {
+
+	uint16_t *cell = &table->cells[kmer];
+	uint16_t old;
+
+	if (!concurrent) {
+		if (*cell < COMPACT_MAX_COUNT) {
+			(*cell)++;
+		}
+		else {
+			sparse_add(table->overflow, kmer, 1, false);
+		}
+		return;
+	}
+
+	old = __atomic_load_n(cell, __ATOMIC_RELAXED);
+	do {
+		if (old == COMPACT_MAX_COUNT) {
+			sparse_add(table->overflow, kmer, 1, true);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(cell, &old, old + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return;
+}
+
+
+uint32_t compact_count(compact_table *table, uint64_t kmer) {
+
+	uint32_t count = table->cells[kmer];
+
+	if (count == COMPACT_MAX_COUNT) {
+		count += sparse_count(table->overflow, kmer);
+	}
+
+	return count;
+}
+
+
+void compact_histogram(compact_table *table, long *hist, unsigned int histogram_size) {
+
+	/* In the same bins as compute_histogram */
+
+	uint32_t count;
+	uint64_t i; /* For loop counter */
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] = 0;
+	}
+
+	for (i = 0; i < table->num_cells; i++) {
+		if (table->cells[i] > 0) {
+			count = compact_count(table, i);
+			hist[(count < histogram_size) ? count - 1 : histogram_size - 1]++;
+		}
+	}
+
+	return;
+}
+
+
+uint64_t compact_memory_for(uint64_t num_cells) {
+
+	return num_cells * sizeof(uint16_t) + sparse_memory_for(0);
+}
@@ -0,0 +1,28 @@
+#ifndef COMPACT_TABLE_H
+#define COMPACT_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The dense table with 16-bit cells, for half the memory. A cell stops at COMPACT_MAX_COUNT, and the k-mer's further
+ * occurrences are counted in a small sparse table; few k-mers get that far, so it stays small.
+ */
+
+#define COMPACT_MAX_COUNT UINT16_MAX
+
+struct sparse_table;
+
+typedef struct compact_table {
+	uint16_t *cells;
+	uint64_t num_cells;
+	struct sparse_table *overflow;
+} compact_table;
+
+compact_table *create_compact_table(uint64_t num_cells, int numa, int huge_pages, bool quiet);
+void free_compact_table(compact_table *table);
+void compact_add(compact_table *table, uint64_t kmer, bool concurrent);
+uint32_t compact_count(compact_table *table, uint64_t kmer);
+void compact_histogram(compact_table *table, long *hist, unsigned int histogram_size);
+uint64_t compact_memory_for(uint64_t num_cells);
+
+#endif
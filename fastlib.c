@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "c_tools.h"
 #include "fastlib.h"
@@ -56,20 +57,19 @@ float calc_gc(char *seq) {
 
 void fastq_to_fasta(FILE *f) {
 
-	seg_return new_segment;
-	segment seg;
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+	int i; /* For loop counter */
 
 	do {
-		new_segment = get_next_seg(f, 1);
-		seg = new_segment.segment;
+		get_next_batch(f, 1, batch);
 
-		printf(">%s\n%s\n", seg.name, seg.seq);
+		for (i = 0; i < batch->num_segs; i++) {
+			printf(">%s\n%s\n", batch->segs[i].name, batch->segs[i].seq);
+		}
 
-		free(seg.name);
-		free(seg.seq);
-		free(seg.qual);
+	} while (!batch->bEOF);
 
-	} while (!new_segment.bEOF);
+	free_seg_batch(batch);
 }
 
 
@@ -77,37 +77,37 @@ void rename_reads(FILE *f, char *name, unsigned long min_length) {
 
 	int format = which_format(f);
 	int iCount = 0;
-	bool bEOF = false;
 	int name_len = strlen(name);
 	char new_name[name_len + 12];
 	char numbers[12];
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+	segment seg;
+	int i; /* For loop counter */
 	
-	while (!bEOF) {
-		seg_return new_segment = get_next_seg(f, format);
-		segment seg = new_segment.segment;
-		bEOF = new_segment.bEOF;
-
-		if (seg.length >= min_length) {
-			strcpy(new_name, name);
-			sprintf(numbers, "%011d", iCount);
-			strcat(new_name, numbers);
-			new_name[name_len + 11] = '\0';
-
-			if (format == 0) {
-				printf(">%s\n%s\n", new_name, seg.seq); 
-			}
-			else if (format == 1) {
-				printf("@%s\n%s\n+\n%s\n", new_name, seg.seq, seg.qual);
+	do {
+		get_next_batch(f, format, batch);
+
+		for (i = 0; i < batch->num_segs; i++) {
+			seg = batch->segs[i];
+
+			if (seg.length >= min_length) {
+				strcpy(new_name, name);
+				sprintf(numbers, "%011d", iCount);
+				strcat(new_name, numbers);
+				new_name[name_len + 11] = '\0';
+
+				if (format == 0) {
+					printf(">%s\n%s\n", new_name, seg.seq); 
+				}
+				else if (format == 1) {
+					printf("@%s\n%s\n+\n%s\n", new_name, seg.seq, seg.qual);
+				}
+				iCount++;
 			}
-			iCount++;
 		}
+	} while (!batch->bEOF);
 
-		free(seg.name); 
-		free(seg.seq);
-		if (format == 1) {
-			free(seg.qual);
-		}
-	}
+	free_seg_batch(batch);
 }
 
 
@@ -137,262 +137,270 @@ int which_format(FILE *f) {
 }
 
  
-seg_return get_next_seg(FILE *f, int format) {
+segment_arena *create_segment_arena(void) {
 
-	seg_return to_return;
-	segment new_segment;
-	char *line, *tmp;
-	bool bEOF = false; /* Set to true if EOF detected */
-	unsigned long seq_len = 0;
-	to_return.bEOF = false;
-	unsigned int buffsize = 10000; /* Reads should rarely be longer than this => shouldn't need to realloc very often */
+	segment_arena *arena;
 
-	if ((new_segment.seq = malloc(buffsize + 1)) == NULL) {
-		fprintf(stderr, "Out of memory (malloc for sequence)\n");
+	if ((arena = malloc(sizeof(segment_arena))) == NULL || (arena->first = malloc(sizeof(arena_block) + SEGMENT_ARENA_BLOCK_SIZE)) == NULL
+			|| (arena->line = malloc(SEGMENT_ARENA_LINE_SIZE)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
 		exit(EXIT_FAILURE);
 	}
 
+	arena->first->next = NULL;
+	arena->first->size = SEGMENT_ARENA_BLOCK_SIZE;
+	arena->first->used = 0;
+	arena->current = arena->first;
+	arena->line_size = SEGMENT_ARENA_LINE_SIZE;
+	arena->bytes = 0;
 
-	/* Fasta file */
-	if (format == 0) {
+	return arena;
+}
 
-		line_return first_line = get_next_line(f);
-		if (first_line.bEOF) {
-			fprintf(stderr, "ERROR: Premature EOF (File ends without sequence)\n");
-		}
 
-		if ((new_segment.name = malloc(strlen(first_line.line))) == NULL) {
-			fprintf(stderr, "ERROR: Out of memory (malloc for name)\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(new_segment.name, first_line.line + 1);
-		free(first_line.line);
+void reset_segment_arena(segment_arena *arena) {
 
-		new_segment.qual = "\0";
+	/* Reclaim every segment handed out since the last reset. The blocks are kept for the next segments. */
 
-		/* Two state automaton:
-		 *		State 0: Header
-		 *		State 1: Bases
-		 */
+	arena_block *block;
 
-		while (true) {
-			line_return new_line;
-			new_line = get_next_line(f);
+	for (block = arena->first; block != arena->current->next; block = block->next) {
+		block->used = 0;
+	}
+	arena->current = arena->first;
+	arena->bytes = 0;
 
-			line = new_line.line;
-			bEOF = new_line.bEOF;
+	return;
+}
 
-			if (bEOF) {
 
-				to_return.bEOF = true;
-				if (strlen(line) > 0) { /* Check we aren't dealing with a blank line at the end of a file */
-					if ((seq_len + strlen(line) > buffsize)) {
-						while ((seq_len + strlen(line) > buffsize)) {
-							buffsize *= 2;
-						}
+void free_segment_arena(segment_arena *arena) {
 
-						if ((tmp = realloc(new_segment.seq, buffsize + 1)) == NULL) {
-							fprintf(stderr, "Out of memory (realloc for sequence)\n");
-							exit(EXIT_FAILURE);
-						}
-						new_segment.seq = tmp;
-					}
+	arena_block *block, *next;
 
-					if (seq_len > 0) {
-						strcat(new_segment.seq, line);
-					}
-					else {
-						strcpy(new_segment.seq, line);
-					}
-					seq_len += strlen(line);
-				}
+	for (block = arena->first; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena->line);
+	free(arena);
 
-				free(line);
-				break;
-			}
+	return;
+}
 
-			if (line[0] == '>') {
-				/* This is the name of the next segment, so seek back to start of line */
-				if (fseek(f, -strlen(line) - 1, SEEK_CUR) != 0) {
-					fprintf(stderr, "ERROR: Failed to seek to correct position on file\n");
-					exit(EXIT_FAILURE);
-				}
-				free(line);
-				break;
+
+static char *arena_append(segment_arena *arena, char *str, size_t len, const char *bytes, size_t num_bytes) {
+
+	/* Append num_bytes bytes to the unfinished string str (of length len), which always starts at the end of the used
+	 * part of the current block. If the block is full the string is moved to the next one, so the string returned may
+	 * not be str. Strings which have been finished with arena_finish never move.
+	 */
+
+	arena_block *block = arena->current;
+	arena_block *new_block;
+	size_t needed = len + num_bytes + 1;
+	size_t size;
+
+	if (block->used + needed > block->size) {
+		if (block->next == NULL || block->next->size < needed) {
+			size = (2 * needed > SEGMENT_ARENA_BLOCK_SIZE) ? 2 * needed : SEGMENT_ARENA_BLOCK_SIZE;
+			if ((new_block = malloc(sizeof(arena_block) + size)) == NULL) {
+				fprintf(stderr, "ERROR: Out of memory\n");
+				exit(EXIT_FAILURE);
 			}
+			new_block->next = block->next;
+			new_block->size = size;
+			new_block->used = 0;
+			block->next = new_block;
+		}
 
-			else {
+		memcpy(block->next->data, str, len);
+		str = block->next->data;
+		arena->current = block->next;
+	}
 
-				if (seq_len == 0) {
-					if ((seq_len + strlen(line) > buffsize)) {
-						while ((seq_len + strlen(line) > buffsize)) {
-							buffsize *= 2;
-						}
-						if ((tmp = realloc(new_segment.seq, buffsize + 1)) == NULL) {
-							fprintf(stderr, "Out of memory (realloc for sequence)\n");
-							exit(EXIT_FAILURE);
-						}
-					}
+	memcpy(str + len, bytes, num_bytes);
+	str[len + num_bytes] = '\0';
 
-					strcpy(new_segment.seq, line);
-				}
+	return str;
+}
 
-				else {
-					if ((seq_len + strlen(line) > buffsize)) {
-						while ((seq_len + strlen(line) > buffsize)) {
-							buffsize *= 2;
-						}
 
-						if ((tmp = realloc(new_segment.seq, buffsize + 1)) == NULL) {
-							fprintf(stderr, "Out of memory (realloc for sequence)\n");
-							exit(EXIT_FAILURE);
-						}
-						new_segment.seq = tmp;
-					}
+static char *arena_start(segment_arena *arena) {
 
-					strcat(new_segment.seq, line);
+	char *str = arena->current->data + arena->current->used;
+
+	return arena_append(arena, str, 0, "", 0);
+}
+
+
+static void arena_finish(segment_arena *arena, size_t len) {
+
+	arena->current->used += len + 1;
+	arena->bytes += len + 1;
+
+	return;
+}
+
+
+static bool arena_read_line(segment_arena *arena, FILE *f, size_t *line_len) {
+
+	/* Read the next line into arena->line without its newline, reusing the same buffer for every line. Returns true if
+	 * it is the last line of the file (as bEOF from get_next_line).
+	 */
+
+	ssize_t num_read;
+	int c;
+
+	if ((num_read = getline(&arena->line, &arena->line_size, f)) == -1) {
+		arena->line[0] = '\0';
+		arena->line_bytes = 0;
+		*line_len = 0;
+		return true;
+	}
+
+	arena->line_bytes = num_read;
+	*line_len = num_read;
+
+	if (arena->line[num_read - 1] != '\n') {
+		return true;
+	}
+
+	arena->line[--(*line_len)] = '\0';
+
+	if ((c = getc(f)) == EOF) {
+		return true;
+	}
+	if (ungetc(c, f) == EOF) {
+		fprintf(stderr, "ERROR: ungetc failed in arena_read_line\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return false;
+}
+
+
+seg_return arena_next_seg(FILE *f, int format, segment_arena *arena) {
+
+	/* Read the next record of f, storing its name, sequence and qualities in arena. The segment stays valid until the
+	 * arena is next reset.
+	 */
+
+	seg_return to_return;
+	segment new_segment;
+	char *str;
+	size_t line_len;
+	bool bEOF = false; /* Set to true if EOF detected */
+	unsigned long seq_len = 0;
+	unsigned long qual_len = 0;
+	int state = 1;
+	int c;
+
+	to_return.bEOF = false;
+
+	if (format != 0 && format != 1) {
+		/* Should never reach here - Format needs to equal 0 or 1 */
+		fprintf(stderr, "ERROR: Format variable needs to equal 0 or 1, currently equals %d\n", format);
+		fprintf(stderr, "This is almost certainly an error in the program, not with the data\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Header */
+	bEOF = arena_read_line(arena, f, &line_len);
+
+	if (format == 0 && bEOF) {
+		fprintf(stderr, "ERROR: Premature EOF (File ends without sequence)\n");
+	}
+	if (format == 1) {
+		to_return.bEOF = bEOF;
+	}
+
+	str = arena_start(arena);
+	if (line_len > 0) {
+		str = arena_append(arena, str, 0, arena->line + 1, line_len - 1);
+		line_len--;
+	}
+	arena_finish(arena, line_len);
+	new_segment.name = str;
+
+	new_segment.seq = arena_start(arena);
+
+	/* Fasta file */
+	if (format == 0) {
+
+		new_segment.qual = "\0";
+
+		while (true) {
+			bEOF = arena_read_line(arena, f, &line_len);
+
+			if (arena->line[0] == '>') {
+				/* This is the name of the next segment, so seek back to start of line */
+				if (fseek(f, -(long) arena->line_bytes, SEEK_CUR) != 0) {
+					fprintf(stderr, "ERROR: Failed to seek to correct position on file\n");
+					exit(EXIT_FAILURE);
 				}
+				break;
+			}
+
+			new_segment.seq = arena_append(arena, new_segment.seq, seq_len, arena->line, line_len);
+			seq_len += line_len;
 
-				seq_len += strlen(line);
-				free(line);
+			if (bEOF) {
+				to_return.bEOF = true;
+				break;
 			}
 		}
+
+		arena_finish(arena, seq_len);
 	}
- 
+
 	/* Fastq file */
-	else if (format == 1)  {
+	else {
 
-		/* Two state automaton: 
+		/* Two state automaton:
 		 *		State 1: Bases
 		 *		State 2: Quality scores
 		 */
 
-		int state = 1;
-		bool bEOF = false; /* Set to true if EOF detected */
-		char c;
-
-		unsigned long qual_len = 0;
-		
-		line_return new_line;
-		new_line = get_next_line(f);
-
-		line = new_line.line;
-		bEOF = new_line.bEOF;
-		to_return.bEOF = bEOF;
-
-		if ((new_segment.name = malloc(strlen(line) + 1)) == NULL) {
-			fprintf(stderr, "ERROR: Out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		strcpy(new_segment.name, line + 1);
-
 		while (true) {
-
-			free(line);
-			new_line = get_next_line(f);
-			line = new_line.line;
-			bEOF = new_line.bEOF;
+			bEOF = arena_read_line(arena, f, &line_len);
 			to_return.bEOF = bEOF;
 
-
 			/* Bases */
 			if (state == 1) {
-				if (line[0] == '+') {
+				if (arena->line[0] == '+') {
 					/* i.e. this is in fact the header for quality scores */
 					if (bEOF) {
 						fprintf(stderr, "ERROR: File ends after + but before quality scores\n");
 						exit(EXIT_FAILURE);
 					}
+					arena_finish(arena, seq_len);
+					new_segment.qual = arena_start(arena);
 					state = 2;
-					qual_len = 0;
 				}
 
 				else {
-
 					if (bEOF) {
 						fprintf(stderr, "ERROR: Fastq file ends before quality values\n");
 						exit(EXIT_FAILURE);
 					}
 
-					if (seq_len == 0) {
-						if ((seq_len + strlen(line) > buffsize)) {
-							while ((seq_len + strlen(line) > buffsize)) {
-								buffsize *= 2;
-							}
-
-							if ((tmp = realloc(new_segment.seq, buffsize + 1)) == NULL) {
-								fprintf(stderr, "Out of memory (realloc for sequence)\n");
-								exit(EXIT_FAILURE);
-							}
-							new_segment.seq = tmp;
-						}
-
-						strcpy(new_segment.seq, line); /* This line is causing a seqfault */
-					}
-					else {
-						if ((seq_len + strlen(line) > buffsize)) {
-							while ((seq_len + strlen(line) > buffsize)) {
-								buffsize *= 2;
-							}
-
-							if ((tmp = realloc(new_segment.seq, buffsize + 1)) == NULL) {
-								fprintf(stderr, "Out of memory (realloc for sequence)\n");
-								exit(EXIT_FAILURE);
-							}
-							new_segment.seq = tmp;
-						}
-
-						strcat(new_segment.seq, line);
-					}
-
-					seq_len += strlen(line);
+					new_segment.seq = arena_append(arena, new_segment.seq, seq_len, arena->line, line_len);
+					seq_len += line_len;
 				}
-			} 
-
-			/* Quality Values */ 
-			else if (state == 2) { 
-				if (qual_len == 0) {
-					if ((new_segment.qual = malloc(buffsize + 1)) == NULL) {
-						fprintf(stderr, "Out of memory (malloc for qualities)\n");
-						exit(EXIT_FAILURE);
-					}
-
-					if (strlen(line) > buffsize) {
-						while (strlen(line) > buffsize) {
-							buffsize *= 2;
-						}
-
-						if ((tmp = realloc(new_segment.qual, buffsize + 1)) == NULL) {
-							fprintf(stderr, "Out of memory (realloc for qualities)\n");
-							exit(EXIT_FAILURE);
-						}
-						new_segment.qual = tmp;
-					}
+			}
 
-					strcpy(new_segment.qual, line);
+			/* Quality Values */
+			else {
+				if (qual_len < seq_len) {
+					new_segment.qual = arena_append(arena, new_segment.qual, qual_len, arena->line, line_len);
 				}
 
-				else if (qual_len < seq_len) {
-					if ((qual_len + strlen(line) > buffsize)) {
-						while ((qual_len + strlen(line) > buffsize)) {
-							buffsize *= 2;
-						}
-
-						if ((tmp = realloc(new_segment.qual, buffsize + 1)) == NULL) {
-							fprintf(stderr, "Out of memory (realloc for qualities)\n");
-							exit(EXIT_FAILURE);
-						}
-						new_segment.qual = tmp;
-					}
-
-					strcat(new_segment.seq, line);
-				}	
-
-				qual_len += strlen(line);
+				qual_len += line_len;
 
 				if (qual_len == seq_len) {
 					/* End of quality values */
-					free(line);
+					arena_finish(arena, qual_len);
 
 					/* Check for EOF */
 					if ((c = getc(f)) != '@') {
@@ -400,7 +408,7 @@ seg_return get_next_seg(FILE *f, int format) {
 					}
 					else {
 						if (ungetc(c, f) == EOF) {
-							fprintf(stderr, "ERROR: ungetc in get_next_seg failed\n");
+							fprintf(stderr, "ERROR: ungetc in arena_next_seg failed\n");
 							exit(EXIT_FAILURE);
 						}
 					}
@@ -412,25 +420,200 @@ seg_return get_next_seg(FILE *f, int format) {
 					fprintf(stderr, "ERROR: Quality string too long\n");
 					exit(EXIT_FAILURE);
 				}
+
+				else if (bEOF) {
+					fprintf(stderr, "ERROR: Fastq file ends before all quality values\n");
+					exit(EXIT_FAILURE);
+				}
 			}
+		}
+	}
 
-			else {
-				fprintf(stderr, "ERROR: Automaton should never get here!!\n");
-				exit(EXIT_FAILURE);
+	new_segment.length = seq_len;
+	to_return.segment = new_segment;
+
+	return to_return;
+}
+
+
+seg_batch *create_seg_batch(int max_segs, size_t max_bytes) {
+
+	seg_batch *batch;
+
+	if ((batch = malloc(sizeof(seg_batch))) == NULL || (batch->segs = malloc(max_segs * sizeof(segment))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	batch->arena = create_segment_arena();
+	batch->num_segs = 0;
+	batch->max_segs = max_segs;
+	batch->max_bytes = max_bytes;
+	batch->bEOF = false;
+
+	return batch;
+}
+
+
+void free_seg_batch(seg_batch *batch) {
+
+	free_segment_arena(batch->arena);
+	free(batch->segs);
+	free(batch);
+
+	return;
+}
+
+
+int get_next_batch(FILE *f, int format, seg_batch *batch) {
+
+	/* Replace the contents of batch with the next records of f: as many as fit in max_segs records and max_bytes
+	 * bytes, but always at least one. Returns the number of records read.
+	 */
+
+	seg_return ret;
+
+	reset_segment_arena(batch->arena);
+	batch->num_segs = 0;
+
+	do {
+		ret = arena_next_seg(f, format, batch->arena);
+		batch->segs[batch->num_segs++] = ret.segment;
+	} while (!ret.bEOF && batch->num_segs < batch->max_segs && batch->arena->bytes < batch->max_bytes);
+
+	batch->bEOF = ret.bEOF;
+
+	return batch->num_segs;
+}
+
+
+size_t find_line_end(const char *data, size_t pos, size_t size) {
+
+	/* Returns the index just past the newline ending the line which contains pos (or size if the data ends first) */
+
+	const char *newline = memchr(data + pos, '\n', size - pos);
+
+	return (newline == NULL) ? size : (size_t) (newline - data) + 1;
+}
+
+
+static size_t line_length(const char *data, size_t pos, size_t line_end) {
+
+	/* Length of the line from pos to line_end, not counting its newline */
+
+	return line_end - pos - (line_end > pos && data[line_end - 1] == '\n');
+}
+
+
+static void copy_bases(char **seq, unsigned long seq_len, unsigned int *buffsize, const char *line, size_t line_len) {
+
+	/* Append line (which is not null terminated, e.g. one inside a mapped file) to the seq_len bases of *seq, growing it
+	 * if necessary
+	 */
+
+	char *tmp;
+
+	if (seq_len + line_len > *buffsize) {
+		while (seq_len + line_len > *buffsize) {
+			*buffsize *= 2;
+		}
+
+		if ((tmp = realloc(*seq, *buffsize + 1)) == NULL) {
+			fprintf(stderr, "Out of memory (realloc for sequence)\n");
+			exit(EXIT_FAILURE);
+		}
+		*seq = tmp;
+	}
+
+	memcpy(*seq + seq_len, line, line_len);
+	(*seq)[seq_len + line_len] = '\0';
+
+	return;
+}
+
+
+size_t scan_record(const char *data, size_t pos, size_t size, int format, char **seq, unsigned long *seq_len, unsigned int *buffsize) {
+
+	/* Parses the record starting at pos in an in-memory copy of a fast(a/q) file, returning the index of the first byte
+	 * after it. Record boundaries are the same as those used by arena_next_seg, so read numbers agree between the two.
+	 * If seq is not NULL the bases of the record are copied into *seq (which holds *buffsize bases and is grown as
+	 * needed), and their number is stored in *seq_len.
+	 */
+
+	size_t line_end;
+	unsigned long bases = 0;
+	unsigned long qual_len = 0;
+
+	pos = find_line_end(data, pos, size);
+
+	if (seq) {
+		(*seq)[0] = '\0';
+	}
+
+	/* Fasta: the record carries on until the next line starting with '>' */
+	if (format == 0) {
+		while (pos < size && data[pos] != '>') {
+			line_end = find_line_end(data, pos, size);
+			if (seq) {
+				copy_bases(seq, bases, buffsize, data + pos, line_length(data, pos, line_end));
 			}
+			bases += line_length(data, pos, line_end);
+			pos = line_end;
 		}
 	}
 
+	/* Fastq: sequence lines up to the '+' line, then quality lines until there are as many quality values as bases */
 	else {
-		/* Should never reach here - Format needs to equal 0 or 1 */
-		fprintf(stderr, "ERROR: Format variable needs to equal 0 or 1, currently equals %d\n", format);
-		fprintf(stderr, "This is almost certainly an error in the program, not with the data\n");
-		exit(EXIT_FAILURE);
+		while (pos < size && data[pos] != '+') {
+			line_end = find_line_end(data, pos, size);
+			if (seq) {
+				copy_bases(seq, bases, buffsize, data + pos, line_length(data, pos, line_end));
+			}
+			bases += line_length(data, pos, line_end);
+			pos = line_end;
+		}
+
+		if (pos == size) {
+			fprintf(stderr, "ERROR: Fastq file ends before quality values\n");
+			exit(EXIT_FAILURE);
+		}
+
+		pos = find_line_end(data, pos, size);
+		if (pos == size) {
+			fprintf(stderr, "ERROR: File ends after + but before quality scores\n");
+			exit(EXIT_FAILURE);
+		}
+
+		while (pos < size && qual_len < bases) {
+			line_end = find_line_end(data, pos, size);
+			qual_len += line_length(data, pos, line_end);
+			pos = line_end;
+		}
+
+		if (qual_len > bases) {
+			fprintf(stderr, "ERROR: Quality string too long\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* arena_next_seg treats anything other than a new record after the quality values (e.g. a blank line) as the end
+		 * of the file
+		 */
+		if (pos < size && data[pos] != '@') {
+			pos = size;
+		}
 	}
 
-	new_segment.length = seq_len;
-	to_return.segment = new_segment;
+	if (seq_len) {
+		*seq_len = bases;
+	}
 
-	return to_return;
+	return pos;
 }
 
+
+size_t find_record_end(const char *data, size_t pos, size_t size, int format) {
+
+	/* Returns the index of the first byte after the record starting at pos */
+
+	return scan_record(data, pos, size, format, NULL, NULL, NULL);
+}
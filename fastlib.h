@@ -13,10 +13,56 @@ typedef struct {
 	bool bEOF;
 } seg_return;
 
+/* Segments read with arena_next_seg are stored in blocks owned by an arena rather than allocated one by one. Resetting
+ * the arena reclaims all of them at once and keeps the blocks for the next reads.
+ */
+#define SEGMENT_ARENA_BLOCK_SIZE (1 << 20)
+#define SEGMENT_ARENA_LINE_SIZE 10000
+
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+} arena_block;
+
+typedef struct {
+	arena_block *first;
+	arena_block *current; /* Block the next string is built in; blocks after it are unused */
+	char *line; /* Line buffer reused by getline */
+	size_t line_size;
+	size_t line_bytes; /* Bytes of the file taken by the last line read, including its newline */
+	size_t bytes; /* Bytes handed out since the last reset */
+} segment_arena;
+
+/* A batch of consecutive records of one file, read by get_next_batch. The names, sequences and qualities of the records
+ * are packed one after another in the batch's arena, and stay valid until the next batch is read.
+ */
+#define SEG_BATCH_READS 4096
+#define SEG_BATCH_BYTES (4 << 20)
+
+typedef struct {
+	segment_arena *arena;
+	segment *segs;
+	int num_segs;
+	int max_segs;
+	size_t max_bytes; /* No more records are added once this many bytes have been stored */
+	bool bEOF; /* Set if the last record of the batch is the last record of the file */
+} seg_batch;
+
 float calc_gc(char *seq);
 void fastq_to_fasta(FILE *f);
 void rename_reads(FILE *f, char *name, unsigned long min_length);
 int which_format(FILE *f);
-seg_return get_next_seg(FILE *f, int format);
+segment_arena *create_segment_arena(void);
+void reset_segment_arena(segment_arena *arena);
+void free_segment_arena(segment_arena *arena);
+seg_return arena_next_seg(FILE *f, int format, segment_arena *arena);
+seg_batch *create_seg_batch(int max_segs, size_t max_bytes);
+void free_seg_batch(seg_batch *batch);
+int get_next_batch(FILE *f, int format, seg_batch *batch);
+size_t find_line_end(const char *data, size_t pos, size_t size);
+size_t scan_record(const char *data, size_t pos, size_t size, int format, char **seq, unsigned long *seq_len, unsigned int *buffsize);
+size_t find_record_end(const char *data, size_t pos, size_t size, int format);
 
 #endif
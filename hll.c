@@ -0,0 +1,102 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "c_tools.h"
+#include "hll.h"
+
+
+/* XORed into a k-mer before mixing it, so that the registers don't follow the sparse table's shards */
+#define HLL_SALT 0x9e3779b97f4a7c15ULL
+
+
+hyperloglog *create_hll(void) {
+
+	hyperloglog *hll;
+
+	if ((hll = calloc(1, sizeof(hyperloglog))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return hll;
+}
+
+
+void free_hll(hyperloglog *hll) {
+
+	free(hll);
+
+	return;
+}
+
+
+void hll_add(hyperloglog *hll, uint64_t kmer) {
+
+	uint64_t mixed = mix_hash(kmer ^ HLL_SALT);
+	uint32_t reg = mixed >> (64 - HLL_BITS);
+	uint8_t rank;
+
+	/* The sentinel bit caps the rank when the rest of the hash is all zeros */
+	rank = __builtin_clzll((mixed << HLL_BITS) | (1ULL << (HLL_BITS - 1))) + 1;
+
+	if (rank > hll->registers[reg]) {
+		hll->registers[reg] = rank;
+	}
+	hll->occurrences++;
+
+	return;
+}
+
+
+uint64_t hll_estimate(hyperloglog *hll) {
+
+	/* The raw estimate is biased upwards for small cardinalities, where linear counting of the empty registers is used
+	 * instead. With a 64-bit hash no correction is needed at the top of the range.
+	 */
+
+	double m = HLL_REGISTERS;
+	double alpha = 0.7213 / (1 + 1.079 / m);
+	double sum = 0;
+	double estimate;
+	uint32_t zeros = 0;
+	uint32_t i; /* For loop counter */
+
+	for (i = 0; i < HLL_REGISTERS; i++) {
+		sum += ldexp(1.0, -hll->registers[i]);
+		zeros += (hll->registers[i] == 0);
+	}
+
+	estimate = alpha * m * m / sum;
+
+	if (estimate <= 2.5 * m && zeros > 0) {
+		estimate = m * log(m / zeros);
+	}
+
+	return (uint64_t) (estimate + 0.5);
+}
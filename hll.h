@@ -0,0 +1,24 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stdint.h>
+
+/* A HyperLogLog estimates the number of distinct k-mers in a few KiB: each k-mer's mixed hash picks a register by its
+ * top HLL_BITS bits, and the register keeps the longest run of leading zeros seen in the rest of the hash. The
+ * estimate has a standard error of about 1.04 / sqrt(2^HLL_BITS), i.e. 0.8%. It is only updated by one thread.
+ */
+
+#define HLL_BITS 14
+#define HLL_REGISTERS (1U << HLL_BITS)
+
+typedef struct hyperloglog {
+	uint8_t registers[HLL_REGISTERS];
+	uint64_t occurrences; /* Total number of k-mers added, counting repeats */
+} hyperloglog;
+
+hyperloglog *create_hll(void);
+void free_hll(hyperloglog *hll);
+void hll_add(hyperloglog *hll, uint64_t kmer);
+uint64_t hll_estimate(hyperloglog *hll);
+
+#endif
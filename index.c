@@ -0,0 +1,312 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "index.h"
+
+
+bool map_data_file(char *file_name, mapped_file *file) {
+
+	/* Maps a whole data file into memory. Returns false if it is not a regular file (e.g. a pipe), in which case it has
+	 * to be read serially.
+	 */
+
+	if ((file->fd = open(file_name, O_RDONLY)) == -1 || fstat(file->fd, &file->file_stat) != 0) {
+		fprintf(stderr, "ERROR: Could not open data file %s\n", file_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!S_ISREG(file->file_stat.st_mode)) {
+		close(file->fd);
+		return false;
+	}
+
+	file->size = file->file_stat.st_size;
+
+	if (file->size == 0) {
+		fprintf(stderr, "File too short!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0)) == MAP_FAILED) {
+		close(file->fd);
+		return false;
+	}
+
+	if (file->data[0] == '>') {
+		file->format = 0;
+	}
+	else if (file->data[0] == '@') {
+		file->format = 1;
+	}
+	else {
+		fprintf(stderr, "Formatting error: File must be in fast(a/q) format (file provided does not begin with '>' or '@')\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return true;
+}
+
+
+void unmap_data_file(mapped_file *file) {
+
+	munmap(file->data, file->size);
+	close(file->fd);
+
+	return;
+}
+
+
+void free_record_index(record_index *idx) {
+
+	free(idx->offsets);
+	free(idx);
+
+	return;
+}
+
+
+static record_index *build_record_index(mapped_file *file, uint64_t interval) {
+
+	record_index *idx;
+	uint64_t *tmp;
+	uint64_t capacity = 1024;
+	size_t pos;
+
+	if ((idx = malloc(sizeof(record_index))) == NULL || (idx->offsets = malloc(capacity * sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	idx->file_size = file->size;
+	idx->mtime = file->file_stat.st_mtime;
+	idx->interval = interval;
+	idx->num_records = 0;
+	idx->num_offsets = 0;
+
+	madvise(file->data, file->size, MADV_SEQUENTIAL);
+
+	for (pos = 0; pos < file->size; pos = find_record_end(file->data, pos, file->size, file->format)) {
+		if (idx->num_records % interval == 0) {
+			if (idx->num_offsets == capacity) {
+				capacity *= 2;
+				if ((tmp = realloc(idx->offsets, capacity * sizeof(uint64_t))) == NULL) {
+					fprintf(stderr, "ERROR: Out of memory\n");
+					exit(EXIT_FAILURE);
+				}
+				idx->offsets = tmp;
+			}
+			idx->offsets[idx->num_offsets++] = pos;
+		}
+		idx->num_records++;
+	}
+
+	return idx;
+}
+
+
+static bool write_record_index(record_index *idx, char *index_file_name) {
+
+	FILE *f;
+	bool written;
+
+	if ((f = fopen(index_file_name, "wb")) == NULL) {
+		return false;
+	}
+
+	written = fwrite(INDEX_MAGIC, 1, 8, f) == 8
+			&& fwrite(&idx->file_size, sizeof(uint64_t), 1, f) == 1
+			&& fwrite(&idx->mtime, sizeof(int64_t), 1, f) == 1
+			&& fwrite(&idx->interval, sizeof(uint64_t), 1, f) == 1
+			&& fwrite(&idx->num_records, sizeof(uint64_t), 1, f) == 1
+			&& fwrite(&idx->num_offsets, sizeof(uint64_t), 1, f) == 1
+			&& fwrite(idx->offsets, sizeof(uint64_t), idx->num_offsets, f) == idx->num_offsets;
+
+	if (fclose(f) != 0 || !written) {
+		remove(index_file_name);
+		return false;
+	}
+
+	return true;
+}
+
+
+static record_index *read_record_index(char *index_file_name, mapped_file *file) {
+
+	/* Returns NULL if there is no usable index for file */
+
+	FILE *f;
+	record_index *idx;
+	char magic[8];
+	uint64_t i; /* For loop counter */
+
+	if ((f = fopen(index_file_name, "rb")) == NULL) {
+		return NULL;
+	}
+
+	if ((idx = malloc(sizeof(record_index))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	idx->offsets = NULL;
+
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, INDEX_MAGIC, 8) != 0
+			|| fread(&idx->file_size, sizeof(uint64_t), 1, f) != 1
+			|| fread(&idx->mtime, sizeof(int64_t), 1, f) != 1
+			|| fread(&idx->interval, sizeof(uint64_t), 1, f) != 1
+			|| fread(&idx->num_records, sizeof(uint64_t), 1, f) != 1
+			|| fread(&idx->num_offsets, sizeof(uint64_t), 1, f) != 1) {
+		goto stale;
+	}
+
+	/* The data file has changed since it was indexed */
+	if (idx->file_size != file->size || idx->mtime != (int64_t) file->file_stat.st_mtime || idx->num_offsets == 0 || idx->interval == 0) {
+		goto stale;
+	}
+
+	if ((idx->offsets = malloc(idx->num_offsets * sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(idx->offsets, sizeof(uint64_t), idx->num_offsets, f) != idx->num_offsets || idx->offsets[0] != 0) {
+		goto stale;
+	}
+
+	/* Every offset must lie inside the file, in order, at the start of a record */
+	for (i = 1; i < idx->num_offsets; i++) {
+		if (idx->offsets[i] <= idx->offsets[i - 1] || idx->offsets[i] >= file->size || file->data[idx->offsets[i] - 1] != '\n'
+				|| file->data[idx->offsets[i]] != file->data[0]) {
+			goto stale;
+		}
+	}
+
+	fclose(f);
+
+	return idx;
+
+stale:
+	fclose(f);
+	free_record_index(idx);
+
+	return NULL;
+}
+
+
+record_index *load_or_build_index(char *file_name, mapped_file *file, uint64_t interval, bool quiet) {
+
+	/* Uses the index next to file_name if it is still valid, otherwise indexes the file and tries to save the index for
+	 * next time
+	 */
+
+	char index_file_name[strlen(file_name) + strlen(INDEX_SUFFIX) + 1];
+	record_index *idx;
+
+	sprintf(index_file_name, "%s%s", file_name, INDEX_SUFFIX);
+
+	if ((idx = read_record_index(index_file_name, file)) != NULL) {
+		return idx;
+	}
+
+	idx = build_record_index(file, interval);
+
+	if (!write_record_index(idx, index_file_name) && !quiet) {
+		fprintf(stderr, "WARNING: Failed to write index file %s - continuing anyway\n", index_file_name);
+	}
+
+	return idx;
+}
+
+
+void index_files(int num_files, char **files, uint64_t interval, bool quiet) {
+
+	/* Write (or rewrite) the index of each of the files */
+
+	mapped_file file;
+	record_index *idx;
+	int i; /* For loop counter */
+
+	for (i = 0; i < num_files; i++) {
+		char index_file_name[strlen(files[i]) + strlen(INDEX_SUFFIX) + 1];
+
+		if (!map_data_file(files[i], &file)) {
+			fprintf(stderr, "ERROR: %s is not a regular file, so cannot be indexed\n", files[i]);
+			exit(EXIT_FAILURE);
+		}
+
+		idx = build_record_index(&file, interval);
+
+		sprintf(index_file_name, "%s%s", files[i], INDEX_SUFFIX);
+		if (!write_record_index(idx, index_file_name)) {
+			fprintf(stderr, "ERROR: Failed to write index file %s\n", index_file_name);
+			exit(EXIT_FAILURE);
+		}
+
+		if (!quiet) {
+			fprintf(stderr, "%s: indexed %" PRIu64 " reads in %" PRIu64 " ranges\n", files[i], idx->num_records, idx->num_offsets);
+		}
+
+		free_record_index(idx);
+		unmap_data_file(&file);
+	}
+
+	return;
+}
+
+
+uint64_t count_record_range(mapped_file *file, record_index *idx, uint64_t range, kmer_params *params, uint32_t *hash_table, segment *seg, unsigned int *buffsize) {
+
+	/* Count the k-mers of the reads in one range of the index, using seg (whose seq holds *buffsize bases) to hold each
+	 * read in turn. Returns the number of reads in the range.
+	 */
+
+	size_t pos = idx->offsets[range];
+	size_t end = (range + 1 < idx->num_offsets) ? idx->offsets[range + 1] : file->size;
+	uint64_t num_records = 0;
+
+	while (pos < end) {
+		pos = scan_record(file->data, pos, file->size, file->format, &seg->seq, &seg->length, buffsize);
+		num_records++;
+
+		if (seg->length >= params->window_size) {
+			process_read(seg, hash_phase, params, hash_table, NULL);
+		}
+	}
+
+	return num_records;
+}
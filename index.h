@@ -0,0 +1,51 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/* Index files (<data file>.zki) record the byte offset of every interval'th record of an uncompressed fast(a/q) file,
+ * so that the file can be split into independent byte ranges which always start at a record boundary:
+ *
+ *		char magic[8]				"ZKCIDX1\0"
+ *		uint64_t file_size			Size of the data file when it was indexed
+ *		int64_t mtime				Modification time of the data file when it was indexed
+ *		uint64_t interval			Number of records between consecutive offsets
+ *		uint64_t num_records
+ *		uint64_t num_offsets
+ *		uint64_t offsets[num_offsets]		offsets[0] is always 0
+ *
+ * An index is only used if the size and modification time of the data file still match.
+ */
+
+#define INDEX_MAGIC "ZKCIDX1"
+#define INDEX_SUFFIX ".zki"
+#define DEFAULT_INDEX_INTERVAL 10000
+
+typedef struct {
+	uint64_t file_size;
+	int64_t mtime;
+	uint64_t interval;
+	uint64_t num_records;
+	uint64_t num_offsets;
+	uint64_t *offsets;
+} record_index;
+
+/* A data file mapped into memory */
+typedef struct {
+	char *data;
+	size_t size;
+	int fd;
+	int format;
+	struct stat file_stat;
+} mapped_file;
+
+bool map_data_file(char *file_name, mapped_file *file);
+void unmap_data_file(mapped_file *file);
+void free_record_index(record_index *idx);
+record_index *load_or_build_index(char *file_name, mapped_file *file, uint64_t interval, bool quiet);
+void index_files(int num_files, char **files, uint64_t interval, bool quiet);
+uint64_t count_record_range(mapped_file *file, record_index *idx, uint64_t range, kmer_params *params, uint32_t *hash_table, segment *seg, unsigned int *buffsize);
+
+#endif
@@ -0,0 +1,313 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "zkc2.h"
+#include "table_memory.h"
+#include "libzkc.h"
+
+
+struct zkc_table {
+	uint32_t *hash_table;
+	uint64_t num_cells;
+	kmer_params params;
+	int num_threads;
+	bool quiet;
+};
+
+typedef struct {
+	zkc_table *table;
+	const char **seqs;
+	const unsigned long *lengths;
+	int first_seq;
+	int num_seqs;
+} add_job;
+
+
+zkc_options zkc_default_options(int kmer_size) {
+
+	zkc_options options;
+
+	options.kmer_size = kmer_size;
+	options.region_size = -1;
+	options.interval_size = -1;
+	options.use_canonical = false;
+	options.num_threads = 1;
+	options.quiet = true;
+
+	return options;
+}
+
+
+static bool options_are_valid(zkc_options options) {
+
+	/* The same rules as parse_arguments, which reports them; here the caller just gets NULL */
+
+	if (options.kmer_size != 13 && options.kmer_size != 15 && options.kmer_size != 17) {
+		return false;
+	}
+
+	if (options.kmer_size == 15) {
+		if (options.region_size != -1 && options.region_size != 1 && options.region_size != 3 && options.region_size != 5 && options.region_size != 15) {
+			return false;
+		}
+	}
+	else if (options.region_size != -1 || options.interval_size != -1) {
+		return false;
+	}
+
+	return options.interval_size >= -1 && options.num_threads >= 1;
+}
+
+
+static zkc_table *new_table(zkc_options options) {
+
+	zkc_table *table;
+	argument_struct args;
+
+	if ((table = malloc(sizeof(zkc_table))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* get_kmer_params only looks at the k-mer options */
+	memset(&args, 0, sizeof(args));
+	args.kmer_size = options.kmer_size;
+	args.region_size = options.region_size;
+	args.interval_size = options.interval_size;
+	args.use_canonical = options.use_canonical;
+
+	table->params = get_kmer_params(args);
+	table->params.concurrent = (options.num_threads > 1);
+	table->num_cells = 1UL << (2 * options.kmer_size);
+	table->hash_table = alloc_hash_table(table->num_cells, 0, 0, options.quiet);
+	table->num_threads = options.num_threads;
+	table->quiet = options.quiet;
+
+	return table;
+}
+
+
+zkc_table *zkc_create(zkc_options options) {
+
+	if (!options_are_valid(options)) {
+		return NULL;
+	}
+
+	return new_table(options);
+}
+
+
+zkc_table *zkc_load(const char *file, zkc_options options) {
+
+	zkc_table *table;
+	struct stat st;
+
+	if (!options_are_valid(options) || stat(file, &st) != 0) {
+		return NULL;
+	}
+
+	/* read_hash_table_from_file would end the process over a file of the wrong size */
+	if ((uint64_t) st.st_size != (1UL << (2 * options.kmer_size)) * sizeof(uint32_t)) {
+		return NULL;
+	}
+
+	table = new_table(options);
+	read_hash_table_from_file(table->hash_table, (char *) file, options.quiet, table->num_cells);
+
+	return table;
+}
+
+
+bool zkc_save(zkc_table *table, const char *file) {
+
+	return write_hash_table_to_file(table->hash_table, (char *) file, table->quiet, table->num_cells);
+}
+
+
+void zkc_free(zkc_table *table) {
+
+	free_hash_table(table->hash_table);
+	free(table);
+
+	return;
+}
+
+
+static void add_sequence_range(zkc_table *table, const char **seqs, const unsigned long *lengths, int first_seq, int num_seqs) {
+
+	segment seg;
+	int i; /* For loop counter */
+
+	seg.name = "";
+	seg.qual = "";
+
+	for (i = first_seq; i < first_seq + num_seqs; i++) {
+		seg.seq = (char *) seqs[i];
+		seg.length = (lengths == NULL) ? strlen(seqs[i]) : lengths[i];
+
+		if (seg.length >= table->params.window_size) {
+			process_read(&seg, hash_phase, &table->params, table->hash_table, NULL);
+		}
+	}
+
+	return;
+}
+
+
+static void *add_job_sequences(void *arg) {
+
+	add_job *job = (add_job *) arg;
+
+	add_sequence_range(job->table, job->seqs, job->lengths, job->first_seq, job->num_seqs);
+
+	return NULL;
+}
+
+
+void zkc_add_sequences(zkc_table *table, const char **seqs, const unsigned long *lengths, int num_seqs) {
+
+	/* Each thread counts a contiguous share of the batch; the counts are added atomically, as with -t/--threads */
+
+	int num_threads = (num_seqs < table->num_threads) ? num_seqs : table->num_threads;
+	pthread_t threads[table->num_threads];
+	add_job jobs[table->num_threads];
+	int i; /* For loop counter */
+
+	if (num_threads <= 1) {
+		add_sequence_range(table, seqs, lengths, 0, num_seqs);
+		return;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		jobs[i].table = table;
+		jobs[i].seqs = seqs;
+		jobs[i].lengths = lengths;
+		jobs[i].first_seq = (long) num_seqs * i / num_threads;
+		jobs[i].num_seqs = (long) num_seqs * (i + 1) / num_threads - jobs[i].first_seq;
+		if (pthread_create(&threads[i], NULL, add_job_sequences, &jobs[i]) != 0) {
+			fprintf(stderr, "ERROR: Failed to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	return;
+}
+
+
+uint32_t zkc_query(zkc_table *table, const char *kmer, unsigned long length) {
+
+	uint32_t count = 0;
+
+	if (length < table->params.window_size) {
+		return 0;
+	}
+	zkc_query_sequence(table, kmer, table->params.window_size, &count);
+
+	return count;
+}
+
+
+unsigned long zkc_query_sequence(zkc_table *table, const char *seq, unsigned long length, uint32_t *counts) {
+
+	segment seg;
+	uint64_t *hashes;
+	unsigned long num_windows;
+	unsigned long i; /* For loop counter */
+
+	if (length < table->params.window_size) {
+		return 0;
+	}
+	num_windows = length - table->params.window_size + 1;
+
+	if ((hashes = malloc(length * sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < length; i++) {
+		hashes[i] = NO_KMER;
+	}
+
+	seg.name = "";
+	seg.qual = "";
+	seg.seq = (char *) seq;
+	seg.length = length;
+	process_read(&seg, encode_phase, &table->params, NULL, hashes);
+
+	for (i = 0; i < num_windows; i++) {
+		counts[i] = (hashes[i] == NO_KMER) ? 0 : lookup_kmer(&table->params, table->hash_table, hashes[i]);
+	}
+
+	free(hashes);
+
+	return num_windows;
+}
+
+
+int zkc_count_hits(zkc_table *table, const char *seq, unsigned long length, unsigned int min_val, unsigned int max_val) {
+
+	kmer_params params = table->params;
+	read_bitmaps bitmaps = {NULL, NULL, 0};
+	segment seg;
+	int kmer_hits;
+
+	if (length < params.window_size) {
+		return 0;
+	}
+
+	params.min_val = min_val;
+	params.max_val = max_val;
+
+	seg.name = "";
+	seg.qual = "";
+	seg.seq = (char *) seq;
+	seg.length = length;
+
+	ensure_read_bitmaps(&bitmaps, length);
+	kmer_hits = process_read(&seg, extract_phase, &params, table->hash_table, bitmaps.hits);
+	free_read_bitmaps(&bitmaps);
+
+	return kmer_hits;
+}
+
+
+void zkc_histogram(zkc_table *table, long *hist, unsigned int histogram_size) {
+
+	compute_histogram(hist, table->quiet, histogram_size, table->hash_table, table->num_cells);
+
+	return;
+}
@@ -0,0 +1,57 @@
+#ifndef LIBZKC_H
+#define LIBZKC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* libzkc counts k-mers into the same dense hash table as zkc2, hashing them in the same way, for programs which would
+ * rather call the counting, lookup and histogram code than run zkc2 and read its files. A table is only reached through
+ * its handle. Sequences may be added from one thread at a time (each batch is split between the table's threads), and
+ * looked up from any number of threads once nothing is being added. As in zkc2, running out of memory ends the process.
+ *
+ * Tables written by zkc_save can be given to zkc2 with -i/--in and vice versa, provided the k-mer options match.
+ */
+
+#define ZKC_API_VERSION 1
+
+#define ZKC_API __attribute__((visibility("default")))
+
+typedef struct zkc_table zkc_table;
+
+typedef struct {
+	int kmer_size; /* 13, 15 or 17 */
+	int region_size; /* As -r/--region-size (-1 = kmer_size) */
+	int interval_size; /* As -g/--interval-size (-1 = 0) */
+	bool use_canonical;
+	int num_threads; /* Threads which count each batch of sequences */
+	bool quiet; /* Suppress progress messages on stderr */
+} zkc_options;
+
+ZKC_API zkc_options zkc_default_options(int kmer_size);
+
+/* Both return NULL if the options are invalid; zkc_load also does if the file is missing or the wrong size */
+ZKC_API zkc_table *zkc_create(zkc_options options);
+ZKC_API zkc_table *zkc_load(const char *file, zkc_options options);
+ZKC_API bool zkc_save(zkc_table *table, const char *file);
+ZKC_API void zkc_free(zkc_table *table);
+
+/* lengths may be NULL if the sequences are NUL-terminated */
+ZKC_API void zkc_add_sequences(zkc_table *table, const char **seqs, const unsigned long *lengths, int num_seqs);
+
+/* Count of the k-mer word starting at kmer, which holds length bases (0 if they are fewer than the window, as with
+ * -r/-g spacing, or the word contains an N)
+ */
+ZKC_API uint32_t zkc_query(zkc_table *table, const char *kmer, unsigned long length);
+
+/* Stores the count of each k-mer word of seq in counts (length - window + 1 of them, 0 for a word containing an N) and
+ * returns their number
+ */
+ZKC_API unsigned long zkc_query_sequence(zkc_table *table, const char *seq, unsigned long length, uint32_t *counts);
+
+/* Number of k-mer words of seq with counts from min_val to max_val, as extract counts a read's hits */
+ZKC_API int zkc_count_hits(zkc_table *table, const char *seq, unsigned long length, unsigned int min_val, unsigned int max_val);
+
+/* hist[i] is the number of k-mers seen i + 1 times, except the last bin, which holds all those seen more often */
+ZKC_API void zkc_histogram(zkc_table *table, long *hist, unsigned int histogram_size);
+
+#endif
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "index.h"
+#include "serve.h"
+
+
+int main(int argc, char **argv) {
+
+	argument_struct args;
+
+	args = parse_arguments(argc, argv);
+
+	if (args.index_reads) {
+		index_files(argc - args.index_first_file, argv + args.index_first_file, args.index_interval, args.quiet);
+	}
+	else if (args.merge_tables) {
+		merge_stored_tables(args, argc, argv);
+	}
+	else if (args.serve_table) {
+		serve_table(args, argv[args.index_first_file]);
+	}
+	else if (args.bench_server) {
+		bench_server(args, argc, argv);
+	}
+	else if (args.select_reads) {
+		apply_selection(args.selection_file, args.output_file, args.bgzf_output, args.num_threads, args.quiet, argc - args.index_first_file, argv + args.index_first_file);
+	}
+	else if (args.num_samples > 0) {
+		count_samples(args, argc, argv);
+	}
+	else if (args.approx_memory > 0) {
+		count_approximately(args, argc, argv);
+	}
+	else if (args.bloom_memory > 0) {
+		count_with_bloom_filter(args, argc, argv);
+	}
+	else if (args.sample_rate > 0) {
+		count_sample(args, argc, argv);
+	}
+	else {
+		phase_automaton(args, argc, argv);
+	}
+
+	return 0;
+}
@@ -0,0 +1,279 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "merge.h"
+
+
+typedef struct {
+	char **table_files;
+	int *fds;
+	int num_tables;
+	int operation;
+	int out_fd; /* -1 if the merged table isn't written */
+	uint64_t first_cell;
+	uint64_t end_cell;
+	long *hist; /* This range's histogram, added to the others' at the end */
+	unsigned int histogram_size;
+} merge_range;
+
+
+static int open_table(char *table_file, uint64_t num_cells, int kmer_size) {
+
+	int fd;
+	struct stat st;
+
+	if ((fd = open(table_file, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "ERROR: Failed to open hash table file %s\n", table_file);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Tables have no header, so their size is the only check that they were counted with the same k */
+	if ((uint64_t) st.st_size != num_cells * sizeof(uint32_t)) {
+		fprintf(stderr, "ERROR: %s is not a hash table of %d-mers (which would be %" PRIu64 " bytes)\n", table_file, kmer_size, num_cells * sizeof(uint32_t));
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
+
+static void read_cells(int fd, char *table_file, uint32_t *cells, uint64_t first_cell, uint64_t num_cells) {
+
+	char *to = (char *) cells;
+	size_t left = num_cells * sizeof(uint32_t);
+	off_t offset = first_cell * sizeof(uint32_t);
+	ssize_t num_read;
+
+	while (left > 0) {
+		if ((num_read = pread(fd, to, left, offset)) <= 0) {
+			fprintf(stderr, "ERROR: Failed to read hash table file %s\n", table_file);
+			exit(EXIT_FAILURE);
+		}
+		to += num_read;
+		left -= num_read;
+		offset += num_read;
+	}
+
+	return;
+}
+
+
+static void write_cells(int fd, uint32_t *cells, uint64_t first_cell, uint64_t num_cells) {
+
+	char *from = (char *) cells;
+	size_t left = num_cells * sizeof(uint32_t);
+	off_t offset = first_cell * sizeof(uint32_t);
+	ssize_t num_written;
+
+	while (left > 0) {
+		if ((num_written = pwrite(fd, from, left, offset)) <= 0) {
+			fprintf(stderr, "ERROR: Failed to write merged hash table\n");
+			exit(EXIT_FAILURE);
+		}
+		from += num_written;
+		left -= num_written;
+		offset += num_written;
+	}
+
+	return;
+}
+
+
+static void combine_cells(uint32_t *restrict result, const uint32_t *restrict cells, uint64_t num_cells, int operation) {
+
+	/* Each loop is written without branches so that the compiler vectorises it. A sum which wraps is less than either
+	 * addend.
+	 */
+
+	uint32_t sum;
+	uint64_t i; /* For loop counter */
+
+	if (operation == sum_op) {
+		for (i = 0; i < num_cells; i++) {
+			sum = result[i] + cells[i];
+			result[i] = (sum < result[i]) ? UINT32_MAX : sum;
+		}
+	}
+	else if (operation == subtract_op) {
+		for (i = 0; i < num_cells; i++) {
+			result[i] = (cells[i] == 0) ? result[i] : 0;
+		}
+	}
+	else if (operation == intersect_op) {
+		for (i = 0; i < num_cells; i++) {
+			result[i] = (cells[i] != 0) ? result[i] : 0;
+		}
+	}
+	else if (operation == min_op) {
+		for (i = 0; i < num_cells; i++) {
+			result[i] = (cells[i] < result[i]) ? cells[i] : result[i];
+		}
+	}
+	else {
+		for (i = 0; i < num_cells; i++) {
+			result[i] = (cells[i] > result[i]) ? cells[i] : result[i];
+		}
+	}
+
+	return;
+}
+
+
+static void *merge_range_worker(void *arg) {
+
+	merge_range *range = (merge_range *) arg;
+	uint32_t *result;
+	uint32_t *cells;
+	uint64_t block;
+	uint64_t num_cells;
+	uint64_t i; /* For loop counter */
+	int t; /* For loop counter */
+
+	if ((result = malloc(MERGE_BLOCK_CELLS * sizeof(uint32_t))) == NULL || (cells = malloc(MERGE_BLOCK_CELLS * sizeof(uint32_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (block = range->first_cell; block < range->end_cell; block += num_cells) {
+		num_cells = (range->end_cell - block < MERGE_BLOCK_CELLS) ? range->end_cell - block : MERGE_BLOCK_CELLS;
+
+		read_cells(range->fds[0], range->table_files[0], result, block, num_cells);
+		for (t = 1; t < range->num_tables; t++) {
+			read_cells(range->fds[t], range->table_files[t], cells, block, num_cells);
+			combine_cells(result, cells, num_cells, range->operation);
+		}
+
+		if (range->out_fd != -1) {
+			write_cells(range->out_fd, result, block, num_cells);
+		}
+
+		/* In the same bins as compute_histogram */
+		for (i = 0; i < num_cells; i++) {
+			if (result[i] > 0) {
+				range->hist[(result[i] < range->histogram_size) ? result[i] - 1 : range->histogram_size - 1]++;
+			}
+		}
+	}
+
+	free(result);
+	free(cells);
+
+	return NULL;
+}
+
+
+void merge_tables(char **table_files, int num_tables, int kmer_size, int operation, char *out_file, int num_threads, long *hist, unsigned int histogram_size, bool quiet) {
+
+	char *operation_names[] = {"Adding up", "Subtracting", "Intersecting", "Taking the minimum of", "Taking the maximum of"};
+
+	uint64_t num_cells = 1UL << (2 * kmer_size);
+	uint64_t cells_per_thread;
+	int fds[num_tables];
+	int out_fd = -1;
+	struct stat in_st, out_st;
+	pthread_t threads[num_threads];
+	merge_range ranges[num_threads];
+	unsigned int j; /* For loop counter */
+	int i; /* For loop counter */
+
+	for (i = 0; i < num_tables; i++) {
+		fds[i] = open_table(table_files[i], num_cells, kmer_size);
+	}
+
+	if (out_file) {
+		/* Truncating the output would clear an input which is the same file before its cells had been read */
+		if (stat(out_file, &out_st) == 0) {
+			for (i = 0; i < num_tables; i++) {
+				if (fstat(fds[i], &in_st) == 0 && in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+					fprintf(stderr, "ERROR: Merged hash table file %s is also one of the tables to merge\n", out_file);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+
+		if ((out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 || ftruncate(out_fd, num_cells * sizeof(uint32_t)) != 0) {
+			fprintf(stderr, "ERROR: Failed to create merged hash table file %s\n", out_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!quiet) {
+		fprintf(stderr, "%s %d hash tables%s%s\n", operation_names[operation], num_tables, out_file ? " into " : "", out_file ? out_file : "");
+	}
+
+	/* Whole blocks for each thread, so that only the last range ends part-way through one */
+	cells_per_thread = (num_cells / num_threads + MERGE_BLOCK_CELLS - 1) / MERGE_BLOCK_CELLS * MERGE_BLOCK_CELLS;
+
+	for (i = 0; i < num_threads; i++) {
+		ranges[i].table_files = table_files;
+		ranges[i].fds = fds;
+		ranges[i].num_tables = num_tables;
+		ranges[i].operation = operation;
+		ranges[i].out_fd = out_fd;
+		ranges[i].first_cell = (i * cells_per_thread < num_cells) ? i * cells_per_thread : num_cells;
+		ranges[i].end_cell = ((i + 1) * cells_per_thread < num_cells) ? (i + 1) * cells_per_thread : num_cells;
+		ranges[i].histogram_size = histogram_size;
+		if ((ranges[i].hist = calloc(histogram_size, sizeof(long))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (pthread_create(&threads[i], NULL, merge_range_worker, &ranges[i]) != 0) {
+			fprintf(stderr, "ERROR: Failed to create merging thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (j = 0; j < histogram_size; j++) {
+		hist[j] = 0;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+		for (j = 0; j < histogram_size; j++) {
+			hist[j] += ranges[i].hist[j];
+		}
+		free(ranges[i].hist);
+	}
+
+	for (i = 0; i < num_tables; i++) {
+		close(fds[i]);
+	}
+
+	if (out_fd != -1 && close(out_fd) != 0) {
+		fprintf(stderr, "ERROR: Failed to write merged hash table file %s\n", out_file);
+		exit(EXIT_FAILURE);
+	}
+
+	return;
+}
@@ -0,0 +1,23 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdbool.h>
+
+/* Stored hash tables (from -o/--out) of runs over different inputs are combined cell by cell: added up, so that a
+ * count can be split between machines and its parts combined, or compared, e.g. to find the k-mers of a sample which
+ * are missing from a control. The first table is combined with each of the others in turn. The tables are streamed a
+ * block at a time, each thread taking its own range of cells, so memory use doesn't depend on the size of the tables.
+ */
+
+#define MERGE_BLOCK_CELLS (1UL << 20)
+
+/* sum_op: counts are added up (saturating)
+ * subtract_op: the first table's counts of the k-mers in none of the others
+ * intersect_op: the first table's counts of the k-mers in all of the others
+ * min_op, max_op: the smallest or largest count of each k-mer
+ */
+enum merge_op_enum {sum_op, subtract_op, intersect_op, min_op, max_op};
+
+void merge_tables(char **table_files, int num_tables, int kmer_size, int operation, char *out_file, int num_threads, long *hist, unsigned int histogram_size, bool quiet);
+
+#endif
@@ -0,0 +1,170 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "table_memory.h"
+#include "sparse_table.h"
+#include "multi_table.h"
+
+
+multi_table *create_multi_table(uint64_t num_cells, int num_samples, int numa, int huge_pages, bool quiet) {
+
+	multi_table *table;
+	uint64_t num_bytes = num_cells * num_samples;
+	int i; /* For loop counter */
+
+	if ((table = malloc(sizeof(multi_table))) == NULL || (table->overflow = malloc(num_samples * sizeof(sparse_table *))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (num_bytes > MULTI_DENSE_MAX_BYTES) {
+		if (!quiet) {
+			fprintf(stderr, "Counting %d samples in a sparse table each (a shared table would take %" PRIu64 " MiB)\n", num_samples, num_bytes >> 20);
+		}
+		table->counters = NULL;
+	}
+	else {
+		if (!quiet) {
+			fprintf(stderr, "Counting %d samples in a table of %" PRIu64 " MiB\n", num_samples, num_bytes >> 20);
+		}
+
+		/* Allocated like the hash table, so that it gets the same huge pages and NUMA placement */
+		table->counters = (uint8_t *) alloc_hash_table((num_bytes + 3) / 4, numa, huge_pages, quiet);
+	}
+	table->num_cells = num_cells;
+	table->num_samples = num_samples;
+
+	for (i = 0; i < num_samples; i++) {
+		table->overflow[i] = create_sparse_table(0);
+	}
+
+	return table;
+}
+
+
+void free_multi_table(multi_table *table) {
+
+	int i; /* For loop counter */
+
+	for (i = 0; i < table->num_samples; i++) {
+		free_sparse_table(table->overflow[i]);
+	}
+	free(table->overflow);
+	if (table->counters) {
+		free_hash_table((uint32_t *) table->counters);
+	}
+	free(table);
+
+	return;
+}
+
+
+void multi_add(multi_table *table, uint64_t kmer, int sample, bool concurrent) {
+
+	uint8_t *counter;
+	uint8_t old;
+
+	if (table->counters == NULL) {
+		sparse_add(table->overflow[sample], kmer, 1, concurrent);
+		return;
+	}
+
+	counter = &table->counters[kmer * table->num_samples + sample];
+
+	if (!concurrent) {
+		if (*counter < MULTI_MAX_COUNT) {
+			(*counter)++;
+		}
+		else {
+			sparse_add(table->overflow[sample], kmer, 1, false);
+		}
+		return;
+	}
+
+	old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	do {
+		if (old == MULTI_MAX_COUNT) {
+			sparse_add(table->overflow[sample], kmer, 1, true);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(counter, &old, old + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return;
+}
+
+
+uint32_t multi_count(multi_table *table, uint64_t kmer, int sample) {
+
+	uint32_t count;
+
+	if (table->counters == NULL) {
+		return sparse_count(table->overflow[sample], kmer);
+	}
+
+	count = table->counters[kmer * table->num_samples + sample];
+
+	if (count == MULTI_MAX_COUNT) {
+		count += sparse_count(table->overflow[sample], kmer);
+	}
+
+	return count;
+}
+
+
+void multi_histograms(multi_table *table, long *hists, unsigned int histogram_size) {
+
+	/* hists holds a histogram (in the same bins as compute_histogram) for each sample, one after the other */
+
+	uint32_t count;
+	uint64_t kmer; /* For loop counter */
+	uint64_t i; /* For loop counter */
+	int s; /* For loop counter */
+
+	for (i = 0; i < histogram_size * table->num_samples; i++) {
+		hists[i] = 0;
+	}
+
+	if (table->counters == NULL) {
+		for (s = 0; s < table->num_samples; s++) {
+			sparse_histogram(table->overflow[s], hists + s * histogram_size, histogram_size);
+		}
+		return;
+	}
+
+	for (kmer = 0; kmer < table->num_cells; kmer++) {
+		for (s = 0; s < table->num_samples; s++) {
+			if (table->counters[kmer * table->num_samples + s] > 0) {
+				count = multi_count(table, kmer, s);
+				hists[s * histogram_size + ((count < histogram_size) ? count - 1 : histogram_size - 1)]++;
+			}
+		}
+	}
+
+	return;
+}
@@ -0,0 +1,35 @@
+#ifndef MULTI_TABLE_H
+#define MULTI_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Counts of every k-mer in each of several samples, in one table: the cell of a k-mer is a row of one 8-bit counter for
+ * each sample, so a k-mer's counts in all of the samples share a cache line. A counter stops at MULTI_MAX_COUNT, and
+ * the k-mer's further occurrences in that sample are counted in the sample's overflow table, which stays small.
+ *
+ * The rows take 4^k * num_samples bytes (16 GiB for each sample at k = 17). Above MULTI_DENSE_MAX_BYTES there are no
+ * rows, and each sample's k-mers are counted in full in its sparse table instead, in memory proportional to the number
+ * of distinct k-mers in the sample.
+ */
+
+#define MULTI_MAX_COUNT UINT8_MAX
+#define MULTI_MAX_SAMPLES 256
+#define MULTI_DENSE_MAX_BYTES (4UL << 30)
+
+struct sparse_table;
+
+typedef struct multi_table {
+	uint8_t *counters; /* num_cells rows of num_samples counters (NULL if every count is in the sparse tables) */
+	uint64_t num_cells;
+	int num_samples;
+	struct sparse_table **overflow; /* One for each sample, holding the whole count if there are no rows */
+} multi_table;
+
+multi_table *create_multi_table(uint64_t num_cells, int num_samples, int numa, int huge_pages, bool quiet);
+void free_multi_table(multi_table *table);
+void multi_add(multi_table *table, uint64_t kmer, int sample, bool concurrent);
+uint32_t multi_count(multi_table *table, uint64_t kmer, int sample);
+void multi_histograms(multi_table *table, long *hists, unsigned int histogram_size);
+
+#endif
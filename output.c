@@ -0,0 +1,464 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "output.h"
+
+
+/* Empty BGZF block which marks the end of a BGZF file */
+static const char bgzf_eof_block[28] = "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024 /* Linux limit on the number of iovecs given to one writev call */
+#endif
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FOOTER_SIZE 8
+
+
+typedef struct {
+	out_buffer *buf;
+	int first_chunk;
+	int num_chunks;
+	int stride;
+} compress_job;
+
+
+out_writer *open_out_writer(char *file_name, bool bgzf, int num_threads) {
+
+	out_writer *writer;
+
+	if ((writer = malloc(sizeof(out_writer))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (file_name == NULL) {
+		/* Anything already printed to stdout (e.g. a histogram) must come before our output */
+		fflush(stdout);
+		writer->fd = STDOUT_FILENO;
+		writer->close_fd = false;
+	}
+	else {
+		if ((writer->fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+			fprintf(stderr, "ERROR: Could not open output file %s\n", file_name);
+			exit(EXIT_FAILURE);
+		}
+		writer->close_fd = true;
+	}
+
+	writer->bgzf = bgzf;
+	writer->num_threads = (num_threads > 0) ? num_threads : 1;
+	pthread_mutex_init(&writer->lock, NULL);
+
+	return writer;
+}
+
+
+static void write_all(int fd, struct iovec *iov, int iovcnt) {
+
+	/* Keep calling writev until everything has been written. iov is modified to track partial writes. */
+
+	ssize_t written;
+
+	while (iovcnt > 0) {
+		written = writev(fd, iov, (iovcnt < IOV_MAX) ? iovcnt : IOV_MAX);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: Failed to write output (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return;
+}
+
+
+void out_writer_writev(out_writer *writer, struct iovec *iov, int iovcnt) {
+
+	/* Write data which is not held in an out_buffer (only for uncompressed output). iov may be modified. */
+
+	pthread_mutex_lock(&writer->lock);
+	write_all(writer->fd, iov, iovcnt);
+	pthread_mutex_unlock(&writer->lock);
+
+	return;
+}
+
+
+void close_out_writer(out_writer *writer) {
+
+	struct iovec eof_iov;
+
+	if (writer->bgzf) {
+		eof_iov.iov_base = (void *) bgzf_eof_block;
+		eof_iov.iov_len = sizeof(bgzf_eof_block);
+		write_all(writer->fd, &eof_iov, 1);
+	}
+
+	if (writer->close_fd) {
+		if (close(writer->fd) != 0) {
+			fprintf(stderr, "ERROR: Failed to close output file (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_mutex_destroy(&writer->lock);
+	free(writer);
+
+	return;
+}
+
+
+static void add_chunk(out_buffer *buf) {
+
+	struct iovec *tmp;
+
+	if ((tmp = realloc(buf->chunks, (buf->num_chunks + 1) * sizeof(struct iovec))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	buf->chunks = tmp;
+
+	if ((buf->chunks[buf->num_chunks].iov_base = malloc(BGZF_BLOCK_SIZE)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	buf->chunks[buf->num_chunks].iov_len = 0;
+
+	if (buf->writer->bgzf) {
+		if ((tmp = realloc(buf->blocks, (buf->num_chunks + 1) * sizeof(struct iovec))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		buf->blocks = tmp;
+
+		if ((buf->blocks[buf->num_chunks].iov_base = malloc(BGZF_MAX_BLOCK_SIZE)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		buf->blocks[buf->num_chunks].iov_len = 0;
+	}
+
+	buf->num_chunks++;
+
+	return;
+}
+
+
+out_buffer *create_out_buffer(out_writer *writer) {
+
+	out_buffer *buf;
+	int i; /* For loop counter */
+
+	if ((buf = malloc(sizeof(out_buffer))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	buf->writer = writer;
+	buf->chunks = NULL;
+	buf->blocks = NULL;
+	buf->num_chunks = 0;
+	buf->current_chunk = 0;
+
+	for (i = 0; i < OUT_BUFFER_FLUSH_CHUNKS; i++) {
+		add_chunk(buf);
+	}
+
+	return buf;
+}
+
+
+void free_out_buffer(out_buffer *buf) {
+
+	int i; /* For loop counter */
+
+	flush_out_buffer(buf);
+
+	for (i = 0; i < buf->num_chunks; i++) {
+		free(buf->chunks[i].iov_base);
+		if (buf->writer->bgzf) {
+			free(buf->blocks[i].iov_base);
+		}
+	}
+
+	free(buf->chunks);
+	free(buf->blocks);
+	free(buf);
+
+	return;
+}
+
+
+static size_t compress_bgzf_block(unsigned char *dest, const unsigned char *src, size_t src_len) {
+
+	/* Compress src into a complete BGZF block at dest, returning the size of the block */
+
+	z_stream zs;
+	size_t block_len;
+	uLong crc;
+	int level = Z_DEFAULT_COMPRESSION;
+	int ret;
+
+	while (true) {
+		zs.zalloc = Z_NULL;
+		zs.zfree = Z_NULL;
+		zs.opaque = Z_NULL;
+
+		if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			fprintf(stderr, "ERROR: Failed to initialise compression\n");
+			exit(EXIT_FAILURE);
+		}
+
+		zs.next_in = (unsigned char *) src;
+		zs.avail_in = src_len;
+		zs.next_out = dest + BGZF_HEADER_SIZE;
+		zs.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+
+		ret = deflate(&zs, Z_FINISH);
+		deflateEnd(&zs);
+
+		if (ret == Z_STREAM_END) {
+			break;
+		}
+
+		/* Incompressible data can come out larger than it went in, so store it uncompressed instead */
+		if (level == Z_NO_COMPRESSION) {
+			fprintf(stderr, "INTERNAL ERROR: Failed to fit data into a BGZF block\n");
+			exit(EXIT_FAILURE);
+		}
+		level = Z_NO_COMPRESSION;
+	}
+
+	block_len = BGZF_HEADER_SIZE + zs.total_out + BGZF_FOOTER_SIZE;
+
+	/* gzip header with the 'BC' extra subfield holding the total block size minus one */
+	memcpy(dest, "\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00", 16);
+	dest[16] = (block_len - 1) & 0xff;
+	dest[17] = (block_len - 1) >> 8;
+
+	crc = crc32(crc32(0L, Z_NULL, 0), src, src_len);
+	dest[block_len - 8] = crc & 0xff;
+	dest[block_len - 7] = (crc >> 8) & 0xff;
+	dest[block_len - 6] = (crc >> 16) & 0xff;
+	dest[block_len - 5] = (crc >> 24) & 0xff;
+	dest[block_len - 4] = src_len & 0xff;
+	dest[block_len - 3] = (src_len >> 8) & 0xff;
+	dest[block_len - 2] = (src_len >> 16) & 0xff;
+	dest[block_len - 1] = (src_len >> 24) & 0xff;
+
+	return block_len;
+}
+
+
+static void *compress_chunks(void *arg) {
+
+	compress_job *job = arg;
+	out_buffer *buf = job->buf;
+	int i; /* For loop counter */
+
+	for (i = job->first_chunk; i < job->num_chunks; i += job->stride) {
+		buf->blocks[i].iov_len = compress_bgzf_block(buf->blocks[i].iov_base, buf->chunks[i].iov_base, buf->chunks[i].iov_len);
+	}
+
+	return NULL;
+}
+
+
+void flush_out_buffer(out_buffer *buf) {
+
+	out_writer *writer = buf->writer;
+	int num_chunks = buf->current_chunk + (buf->chunks[buf->current_chunk].iov_len > 0);
+	int num_threads = (writer->num_threads < num_chunks) ? writer->num_threads : num_chunks;
+	pthread_t threads[num_threads > 0 ? num_threads : 1];
+	compress_job jobs[num_threads > 0 ? num_threads : 1];
+	struct iovec to_write[num_chunks > 0 ? num_chunks : 1];
+	int i; /* For loop counter */
+
+	if (num_chunks == 0) {
+		return;
+	}
+
+	if (writer->bgzf) {
+		/* Compress outside of the lock, so that other threads can carry on writing meanwhile */
+		for (i = 0; i < num_threads; i++) {
+			jobs[i].buf = buf;
+			jobs[i].first_chunk = i;
+			jobs[i].num_chunks = num_chunks;
+			jobs[i].stride = num_threads;
+		}
+
+		for (i = 1; i < num_threads; i++) {
+			if (pthread_create(&threads[i], NULL, compress_chunks, &jobs[i]) != 0) {
+				fprintf(stderr, "ERROR: Failed to create compression thread\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		compress_chunks(&jobs[0]);
+		for (i = 1; i < num_threads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+
+		memcpy(to_write, buf->blocks, num_chunks * sizeof(struct iovec));
+	}
+	else {
+		memcpy(to_write, buf->chunks, num_chunks * sizeof(struct iovec));
+	}
+
+	pthread_mutex_lock(&writer->lock);
+	write_all(writer->fd, to_write, num_chunks);
+	pthread_mutex_unlock(&writer->lock);
+
+	for (i = 0; i < num_chunks; i++) {
+		buf->chunks[i].iov_len = 0;
+	}
+	buf->current_chunk = 0;
+
+	return;
+}
+
+
+void out_buffer_write(out_buffer *buf, const char *data, size_t len) {
+
+	struct iovec *chunk;
+	size_t to_copy;
+
+	while (len > 0) {
+		chunk = &buf->chunks[buf->current_chunk];
+
+		if (chunk->iov_len == BGZF_BLOCK_SIZE) {
+			if (++buf->current_chunk == buf->num_chunks) {
+				add_chunk(buf);
+			}
+			continue;
+		}
+
+		to_copy = BGZF_BLOCK_SIZE - chunk->iov_len;
+		to_copy = (len < to_copy) ? len : to_copy;
+
+		memcpy((char *) chunk->iov_base + chunk->iov_len, data, to_copy);
+		chunk->iov_len += to_copy;
+		data += to_copy;
+		len -= to_copy;
+	}
+
+	return;
+}
+
+
+void out_buffer_write_char(out_buffer *buf, char c) {
+
+	struct iovec *chunk = &buf->chunks[buf->current_chunk];
+
+	if (chunk->iov_len < BGZF_BLOCK_SIZE) {
+		((char *) chunk->iov_base)[chunk->iov_len++] = c;
+	}
+	else {
+		out_buffer_write(buf, &c, 1);
+	}
+
+	return;
+}
+
+
+void out_buffer_write_uint(out_buffer *buf, unsigned long val) {
+
+	char digits[20];
+	int i = sizeof(digits);
+
+	do {
+		digits[--i] = '0' + (val % 10);
+		val /= 10;
+	} while (val > 0);
+
+	out_buffer_write(buf, digits + i, sizeof(digits) - i);
+
+	return;
+}
+
+
+void out_buffer_end_record(out_buffer *buf) {
+
+	if (buf->current_chunk >= OUT_BUFFER_FLUSH_CHUNKS - 1) {
+		flush_out_buffer(buf);
+	}
+
+	return;
+}
+
+
+void out_buffer_write_fasta(out_buffer *buf, char *name, int kmer_hits, char *seq, unsigned long length) {
+
+	/* Equivalent to printf(">%s %d\n%s\n", name, kmer_hits, seq) */
+
+	out_buffer_write_char(buf, '>');
+	out_buffer_write(buf, name, strlen(name));
+	out_buffer_write_char(buf, ' ');
+	out_buffer_write_uint(buf, kmer_hits);
+	out_buffer_write_char(buf, '\n');
+	out_buffer_write(buf, seq, length);
+	out_buffer_write_char(buf, '\n');
+
+	return;
+}
+
+
+void out_buffer_write_fastq(out_buffer *buf, char *name, int kmer_hits, char *seq, char *qual, unsigned long length) {
+
+	/* Equivalent to printf("@%s %d\n%s\n+\n%s\n", name, kmer_hits, seq, qual) */
+
+	out_buffer_write_char(buf, '@');
+	out_buffer_write(buf, name, strlen(name));
+	out_buffer_write_char(buf, ' ');
+	out_buffer_write_uint(buf, kmer_hits);
+	out_buffer_write_char(buf, '\n');
+	out_buffer_write(buf, seq, length);
+	out_buffer_write(buf, "\n+\n", 3);
+	out_buffer_write(buf, qual, length);
+	out_buffer_write_char(buf, '\n');
+
+	return;
+}
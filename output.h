@@ -0,0 +1,46 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+/* Largest amount of uncompressed data put into one BGZF block (as used by htslib). Plain output uses the same chunk size. */
+#define BGZF_BLOCK_SIZE 0xff00
+#define BGZF_MAX_BLOCK_SIZE 0x10000
+
+/* A buffer is flushed once a record ends with at least this many chunks filled (~4 MiB). Records are never split
+ * between flushes, so a buffer grows past this if it has to hold one very long record.
+ */
+#define OUT_BUFFER_FLUSH_CHUNKS 64
+
+typedef struct {
+	int fd;
+	bool close_fd; /* False when writing to stdout */
+	bool bgzf; /* Compress output into BGZF blocks */
+	int num_threads; /* Number of threads used to compress the chunks of a buffer */
+	pthread_mutex_t lock; /* Held while a buffer is being written, so that buffers from different threads never interleave */
+} out_writer;
+
+typedef struct {
+	out_writer *writer;
+	struct iovec *chunks; /* Uncompressed data */
+	struct iovec *blocks; /* Compressed BGZF blocks, one per chunk (only used if writer->bgzf) */
+	int num_chunks; /* Number of chunks allocated */
+	int current_chunk;
+} out_buffer;
+
+out_writer *open_out_writer(char *file_name, bool bgzf, int num_threads);
+void close_out_writer(out_writer *writer);
+void out_writer_writev(out_writer *writer, struct iovec *iov, int iovcnt);
+out_buffer *create_out_buffer(out_writer *writer);
+void free_out_buffer(out_buffer *buf);
+void flush_out_buffer(out_buffer *buf);
+void out_buffer_write(out_buffer *buf, const char *data, size_t len);
+void out_buffer_write_char(out_buffer *buf, char c);
+void out_buffer_write_uint(out_buffer *buf, unsigned long val);
+void out_buffer_end_record(out_buffer *buf); /* Call after each complete record (or group of records which must stay together) */
+void out_buffer_write_fasta(out_buffer *buf, char *name, int kmer_hits, char *seq, unsigned long length);
+void out_buffer_write_fastq(out_buffer *buf, char *name, int kmer_hits, char *seq, char *qual, unsigned long length);
+
+#endif
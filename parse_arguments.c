@@ -9,13 +9,20 @@
 
 #include "parse_arguments.h"
 #include "c_tools.h"
+#include "fastlib.h"
+#include "output.h"
+#include "zkc2.h"
+#include "multi_table.h"
+#include "merge.h"
+#include "table_memory.h"
+#include "async_reader.h"
 
 
 void print_usage(char *prog_loc) {
 	fprintf(stderr, "usage:"
 								"\t%s <mode> [options] file [file, ...]\n"
 								"\t%s [-h | --help]\n\n"
-								"\twhere <mode> is one of {hist, extract, both}\n\n"
+								"\twhere <mode> is one of {hist, extract, both, select, index, merge, serve, bench}\n\n"
 					, prog_loc, prog_loc);
 }
 
@@ -29,7 +36,12 @@ void print_help(char *prog_loc) {
 	fprintf(stderr, "modes:\n"
 						"\thist : only count k-mers and print histogram\n"
 						"\textract : extract reads with above 'cutoff' number of k-mers mapping to it\n"
-						"\tboth : do both hist and extract\n\n"
+						"\tboth : do both hist and extract\n"
+						"\tselect : print the reads recorded in a selection file written by extract -S\n"
+						"\tmerge : combine hash tables stored with -o/--out by runs over different inputs (given as the files), print the histogram of the result and, with -o/--out, store the merged table, which can be given to extract with -i/--in\n"
+						"\tserve : map a hash table stored with -o/--out (given as the file) and answer queries about sequences, one per line - 'count <seq>' (the count of each k-mer word) or 'hits <seq>' (the number of k-mer words with counts from -a/--min to -b/--max, and the number of words) - on stdin/stdout, or on each connection to a -U/--socket\n"
+						"\tbench : send the reads of the files to a serve -U/--socket as hits queries, from -t/--threads connections, and report the queries answered per second\n"
+						"\tindex : write the byte offset of every N'th read of each file to <file>.zki, so that counting with more than one thread can split the file between threads\n\n"
 
 					"options (default):\n"
 						"\tapplicable in both functions:\n"
@@ -39,14 +51,52 @@ void print_help(char *prog_loc) {
 							"\t\t-v, --verbose : print each k-mer as it is hashed (only really useful for debugging) (false)\n"
 							"\t\t-c, --canonical : count canonical version of k-mers (i.e. the lowest scoring hash of the k-mer and its reverse complement) (false)\n"
 							"\t\t-r, --region-size : number of bases in each region (15)\n"
-							"\t\t-g, --interval-size : number of bases in gap between each region (0)\n\n"
+							"\t\t-g, --interval-size : number of bases in gap between each region (0)\n"
+							"\t\t-t, --threads : number of threads to use - uncompressed files are split between threads using their index, which is built and saved if missing or out of date (1)\n"
+							"\t\t-R, --reader : how input files are read - stdio, thread (a thread keeps several large reads in flight ahead of the parser) or uring (as thread, but using io_uring) (stdio)\n"
+							"\t\t-L, --pipeline : <encoders>,<counters> - parse, hash and count reads in a pipeline of one reader thread, this many threads hashing k-mer words and this many threads updating (or looking up) the hash table, and report how long each stage waited for the others (off)\n"
+							"\t\t-N, --numa : placement of the hash table on NUMA machines - off, interleave (pages spread across all nodes) or partition (each node holds a contiguous slice of the table; -L/--pipeline counters are pinned to a node and only update k-mers in its slice, while other counting threads are spread across the nodes) (off)\n"
+							"\t\t-H, --huge-pages : back the hash table with huge pages - off, thp (transparent huge pages), 2M or 1G (explicit huge pages from the kernel's reserved pool); if there are not enough, the next smaller size is tried, down to normal pages, and the page size obtained is reported (off)\n"
+							"\t\t-w, --targets : only count the k-mers in this file - the k-mers of each record of a fasta or fastq file (e.g. a panel's probes), or of each line of a list of k-mers - in memory proportional to their number rather than the full hash table (off)\n"
+							"\t\t-C, --chunk-size : when counting fasta files, stream records in chunks of this many bases and count the chunks on all threads, so that very long records (e.g. chromosomes) never have to be held in memory (0 = off) (0)\n"
+							"\t\t-M, --max-memory : MiB the table may take; the first of these which fits is used - the dense hash table, the compact hash table (16-bit counts), a sparse table sized for the number of distinct k-mers (estimated in a pass over the input), or (hist only) a sparse table for each of several partitions of the k-mers, which are kept in temporary files until they are counted - the choice is printed, and the run stops before counting if nothing fits (0 = no limit) (0)\n"
+							"\t\t-E, --estimate-every : estimate the number of distinct k-mers for -M/--max-memory, or for sizing the table of -F/--sample-rate, from every N'th read - quicker, but the estimate is scaled up by N and so errs towards a bigger table (1)\n"
+							"\t\t-T, --temp-dir : directory for the temporary files of -M/--max-memory partitions (TMPDIR or /tmp)\n\n"
+
+						"\tonly applicable in hist function:\n"
+							"\t\t-A, --approximate : count k-mers approximately in a count-min sketch of this many MiB instead of the exact hash table, then estimate the histogram in a second pass over the input, printing a bound on the error of the counts (0 = off) (0)\n"
+							"\t\t-B, --bloom : keep k-mers seen only once out of the table with a Bloom filter of this many MiB, counting the rest in a sparse table instead of the exact hash table; the histogram is out by about the filter's false positive rate, which is printed (0 = off) (0)\n"
+							"\t\t-m, --multi-sample : count each file under a sample, given as <sample>=<file> (a file without one is its own sample), in one table holding each k-mer's count in every sample, and print a column of the histogram for each sample - the table takes a byte for each possible k-mer in each sample, or, if that would be over 4 GiB (e.g. at k = 17), each sample's k-mers are counted in a sparse table of their own (false)\n"
+							"\t\t-F, --sample-rate : only count the k-mers whose hash falls in the lowest 1/N of its range, in a sparse table instead of the exact hash table, and scale the histogram up by N - each sampled k-mer is counted exactly, so the histogram's shape is kept at a fraction of the time and memory (0 = off) (0)\n\n"
+
+						"\tonly applicable in merge function:\n"
+							"\t\t-e, --operation : how the tables are combined - sum (counts are added up, saturating at 2^32 - 1), subtract (the first table's counts of the k-mers in none of the others), intersect (the first table's counts of the k-mers in all of the others), min or max (sum)\n\n"
+
+						"\tonly applicable in serve and bench functions:\n"
+							"\t\t-U, --socket : Unix domain socket to serve on (replacing any file there) or to benchmark - serve answers on stdin/stdout without one (off)\n"
+							"\t\t-a, --min, -b, --max : as for extract, for hits queries (1, no limit)\n\n"
 
 						"\tonly applicable in extract function:\n"
 							"\t\t-a, --min : minimum number of occurrences of k-mer for it to be masked on read (1)\n"
 							"\t\t-b, --max : maximum number of occurrences of k-mer for it to be masked on read (999)\n"
 							"\t\t-u, --cutoff : minimum number of k-mers mapped to read for read to be printed (see notes)\n"
 							"\t\t-x, --max-difference : maximum difference between number of k-mer hits and number of possible k-mer hits for the read (see notes)\n"
-							"\t\t-d, --disable-mask : leave bases not occurring in desired k-mer peaks unmasked when extracting reads (faslse)\n\n"
+							"\t\t-d, --disable-mask : leave bases not occurring in desired k-mer peaks unmasked when extracting reads (faslse)\n"
+							"\t\t-O, --output : file in which to write extracted reads (stdout)\n"
+							"\t\t-z, --bgzf : write extracted reads as BGZF-compressed data (false)\n"
+							"\t\t-Q, --fastq-output : print extracted reads as fastq, giving masked bases the lowest quality value (requires fastq input) (false)\n"
+							"\t\t-S, --selection : instead of printing reads, write a bitset of the extracted reads of each file to this file, and their numbers of k-mer hits to <file>.hits\n"
+							"\t\t-p, --paired : input files are pairs of mate files (R1 R2 [R1 R2 ...]); mates are extracted or dropped together (false)\n"
+							"\t\t-I, --interleaved : as --paired, but mates are consecutive records of each file (false)\n"
+							"\t\t-P, --pair-rule : how pairs are chosen - both (both mates pass), either (one mate passes) or sum (pair passes as though it were one read) (both)\n\n"
+
+						"\tonly applicable in select function:\n"
+							"\t\t-S, --selection : selection file written by extract (required)\n"
+							"\t\t-O, --output, -z, --bgzf, -t, --threads, -q, --quiet : as above\n\n"
+
+						"\tonly applicable in index function:\n"
+							"\t\t-n, --index-interval : number of reads between consecutive offsets in the index, also used when hist builds a missing index (10000)\n"
+							"\t\t-q, --quiet : as above\n\n"
 
 						"\tmisc:\n"
 							"\t\t-h, --help : print this message\n\n"
@@ -73,6 +123,47 @@ void print_help(char *prog_loc) {
 }
 
 
+bool tag_samples(argument_struct *args, int argc, char **argv) {
+
+	/* Split each input file argument of the form <sample>=<file> into its sample, which is looked up (or added) in
+	 * sample_names, and its file, which replaces the argument. Returns false if there are too many samples.
+	 */
+
+	int num_files = argc - args->index_first_file;
+	char *file;
+	char *separator;
+	int i; /* For loop counter */
+	int s; /* For loop counter */
+
+	if ((args->sample_names = malloc(num_files * sizeof(char *))) == NULL || (args->file_samples = malloc(num_files * sizeof(int))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < num_files; i++) {
+		file = argv[args->index_first_file + i];
+
+		if ((separator = strchr(file, '=')) != NULL) {
+			*separator = '\0';
+			argv[args->index_first_file + i] = separator + 1;
+		}
+
+		for (s = 0; s < args->num_samples && strcmp(args->sample_names[s], file); s++);
+
+		if (s == args->num_samples) {
+			if (args->num_samples == MULTI_MAX_SAMPLES) {
+				fprintf(stderr, "ERROR: -m/--multi-sample can count at most %d samples\n", MULTI_MAX_SAMPLES);
+				return false;
+			}
+			args->sample_names[args->num_samples++] = file;
+		}
+		args->file_samples[i] = s;
+	}
+
+	return true;
+}
+
+
 argument_struct parse_arguments(int argc, char **argv) {
 
 	argument_struct to_return;
@@ -83,6 +174,13 @@ argument_struct parse_arguments(int argc, char **argv) {
 
 	to_return.print_hist = false;
 	to_return.extract_reads = false;
+	to_return.select_reads = false;
+	to_return.index_reads = false;
+	to_return.merge_tables = false;
+	to_return.serve_table = false;
+	to_return.bench_server = false;
+	to_return.socket_path = NULL;
+	to_return.merge_operation = sum_op;
 	to_return.min_kmer_hits = -1;
 	to_return.max_kmers_missed = -1;
 	to_return.min_val = 0;
@@ -97,6 +195,32 @@ argument_struct parse_arguments(int argc, char **argv) {
 	to_return.region_size = -1;
 	to_return.interval_size = -1;
 	to_return.index_first_file = argc - 1;
+	to_return.output_file = NULL;
+	to_return.bgzf_output = false;
+	to_return.fastq_output = false;
+	to_return.selection_file = NULL;
+	to_return.paired = false;
+	to_return.interleaved = false;
+	to_return.pair_rule = pair_both;
+	to_return.num_threads = 1;
+	to_return.chunk_size = 0;
+	to_return.index_interval = 10000;
+	to_return.reader = stdio_reader;
+	to_return.pipeline_encoders = 0;
+	to_return.pipeline_counters = 0;
+	to_return.numa = no_numa;
+	to_return.huge_pages = no_huge_pages;
+	to_return.approx_memory = 0;
+	to_return.bloom_memory = 0;
+	to_return.sample_rate = 0;
+	to_return.max_memory = 0;
+	to_return.estimate_every = 1;
+	to_return.temp_dir = NULL;
+	to_return.multi_sample = false;
+	to_return.num_samples = 0;
+	to_return.sample_names = NULL;
+	to_return.file_samples = NULL;
+	to_return.targets_file = NULL;
 
 	if (argc <= 2) {
 		if (argc == 2) {
@@ -127,6 +251,26 @@ argument_struct parse_arguments(int argc, char **argv) {
 		to_return.extract_reads = true;
 	}
 
+	else if (!strcmp(argv[1], "select")) {
+		to_return.select_reads = true;
+	}
+
+	else if (!strcmp(argv[1], "index")) {
+		to_return.index_reads = true;
+	}
+
+	else if (!strcmp(argv[1], "merge")) {
+		to_return.merge_tables = true;
+	}
+
+	else if (!strcmp(argv[1], "serve")) {
+		to_return.serve_table = true;
+	}
+
+	else if (!strcmp(argv[1], "bench")) {
+		to_return.bench_server = true;
+	}
+
 	else {
 		fprintf(stderr, "ERROR: Mode not recognised\n");
 		print_usage(argv[0]);
@@ -176,7 +320,7 @@ argument_struct parse_arguments(int argc, char **argv) {
 		}
 
 		else if (!strcmp(argv[arg_i], "-a") || !strcmp(argv[arg_i], "--min")) {
-			if (!to_return.extract_reads) {
+			if (!to_return.extract_reads && !to_return.serve_table) {
 				fprintf(stderr, "ERROR: -a/--min-val must not be specified in this mode\n");
 				argument_error = true;
 			}
@@ -196,7 +340,7 @@ argument_struct parse_arguments(int argc, char **argv) {
 		}
 
 		else if (!strcmp(argv[arg_i], "-b") || !strcmp(argv[arg_i], "--max")) {
-			if (!to_return.extract_reads) {
+			if (!to_return.extract_reads && !to_return.serve_table) {
 				fprintf(stderr, "ERROR: -b/--max-val must not be specified in this mode\n");
 				argument_error = true;
 			}
@@ -272,6 +416,33 @@ argument_struct parse_arguments(int argc, char **argv) {
 			}
 		}
 
+		else if (!strcmp(argv[arg_i], "-e") || !strcmp(argv[arg_i], "--operation")) {
+			if (!to_return.merge_tables) {
+				fprintf(stderr, "ERROR: -e/--operation must not be specified in this mode\n");
+				argument_error = true;
+			}
+			arg_i++;
+			if (!strcmp(argv[arg_i], "sum")) {
+				to_return.merge_operation = sum_op;
+			}
+			else if (!strcmp(argv[arg_i], "subtract")) {
+				to_return.merge_operation = subtract_op;
+			}
+			else if (!strcmp(argv[arg_i], "intersect")) {
+				to_return.merge_operation = intersect_op;
+			}
+			else if (!strcmp(argv[arg_i], "min")) {
+				to_return.merge_operation = min_op;
+			}
+			else if (!strcmp(argv[arg_i], "max")) {
+				to_return.merge_operation = max_op;
+			}
+			else {
+				fprintf(stderr, "ERROR: -e/--operation must be one of sum, subtract, intersect, min, or max\n");
+				argument_error = true;
+			}
+		}
+
 		else if (!strcmp(argv[arg_i], "-i") || !strcmp(argv[arg_i], "--in")) {
 			to_return.stored_hash_table_location = argv[++arg_i];
 		}
@@ -280,6 +451,257 @@ argument_struct parse_arguments(int argc, char **argv) {
 			to_return.where_to_save_hash_table = argv[++arg_i];
 		}
 
+		else if (!strcmp(argv[arg_i], "-O") || !strcmp(argv[arg_i], "--output")) {
+			if (!to_return.extract_reads && !to_return.select_reads) {
+				fprintf(stderr, "ERROR: -O/--output must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.output_file = argv[++arg_i];
+		}
+
+		else if (!strcmp(argv[arg_i], "-z") || !strcmp(argv[arg_i], "--bgzf")) {
+			if (!to_return.extract_reads && !to_return.select_reads) {
+				fprintf(stderr, "ERROR: -z/--bgzf must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.bgzf_output = true;
+		}
+
+		else if (!strcmp(argv[arg_i], "-Q") || !strcmp(argv[arg_i], "--fastq-output")) {
+			if (!to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -Q/--fastq-output must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.fastq_output = true;
+		}
+
+		else if (!strcmp(argv[arg_i], "-S") || !strcmp(argv[arg_i], "--selection")) {
+			if (!to_return.extract_reads && !to_return.select_reads) {
+				fprintf(stderr, "ERROR: -S/--selection must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.selection_file = argv[++arg_i];
+		}
+
+		else if (!strcmp(argv[arg_i], "-p") || !strcmp(argv[arg_i], "--paired")) {
+			if (!to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -p/--paired must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.paired = true;
+		}
+
+		else if (!strcmp(argv[arg_i], "-I") || !strcmp(argv[arg_i], "--interleaved")) {
+			if (!to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -I/--interleaved must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.interleaved = true;
+		}
+
+		else if (!strcmp(argv[arg_i], "-P") || !strcmp(argv[arg_i], "--pair-rule")) {
+			if (!to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -P/--pair-rule must not be specified in this mode\n");
+				argument_error = true;
+			}
+			arg_i++;
+			if (!strcmp(argv[arg_i], "both")) {
+				to_return.pair_rule = pair_both;
+			}
+			else if (!strcmp(argv[arg_i], "either")) {
+				to_return.pair_rule = pair_either;
+			}
+			else if (!strcmp(argv[arg_i], "sum")) {
+				to_return.pair_rule = pair_sum;
+			}
+			else {
+				fprintf(stderr, "ERROR: -P/--pair-rule must be one of both, either, or sum\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-t") || !strcmp(argv[arg_i], "--threads")) {
+			if (is_str_integer(argv[++arg_i])) {
+				to_return.num_threads = atoi(argv[arg_i]);
+				if (to_return.num_threads < 1) {
+					fprintf(stderr, "ERROR: -t/--threads must be a positive integer\n");
+					argument_error = true;
+				}
+			}
+			else {
+				fprintf(stderr, "ERROR: -t/--threads must be a positive integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-C") || !strcmp(argv[arg_i], "--chunk-size")) {
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) >= 0) {
+				to_return.chunk_size = atol(argv[arg_i]);
+			}
+			else {
+				fprintf(stderr, "ERROR: -C/--chunk-size must be a non-negative integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-R") || !strcmp(argv[arg_i], "--reader")) {
+			arg_i++;
+			if (!strcmp(argv[arg_i], "stdio")) {
+				to_return.reader = stdio_reader;
+			}
+			else if (!strcmp(argv[arg_i], "thread")) {
+				to_return.reader = thread_reader;
+			}
+			else if (!strcmp(argv[arg_i], "uring")) {
+				to_return.reader = uring_reader;
+			}
+			else {
+				fprintf(stderr, "ERROR: -R/--reader must be one of stdio, thread, or uring\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-L") || !strcmp(argv[arg_i], "--pipeline")) {
+			if (sscanf(argv[++arg_i], "%d,%d", &to_return.pipeline_encoders, &to_return.pipeline_counters) != 2
+					|| to_return.pipeline_encoders < 1 || to_return.pipeline_counters < 1) {
+				fprintf(stderr, "ERROR: -L/--pipeline must be two positive integers separated by a comma\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-N") || !strcmp(argv[arg_i], "--numa")) {
+			arg_i++;
+			if (!strcmp(argv[arg_i], "off")) {
+				to_return.numa = no_numa;
+			}
+			else if (!strcmp(argv[arg_i], "interleave")) {
+				to_return.numa = interleave_numa;
+			}
+			else if (!strcmp(argv[arg_i], "partition")) {
+				to_return.numa = partition_numa;
+			}
+			else {
+				fprintf(stderr, "ERROR: -N/--numa must be one of off, interleave, or partition\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-H") || !strcmp(argv[arg_i], "--huge-pages")) {
+			arg_i++;
+			if (!strcmp(argv[arg_i], "off")) {
+				to_return.huge_pages = no_huge_pages;
+			}
+			else if (!strcmp(argv[arg_i], "thp")) {
+				to_return.huge_pages = transparent_huge_pages;
+			}
+			else if (!strcmp(argv[arg_i], "2M")) {
+				to_return.huge_pages = huge_2m_pages;
+			}
+			else if (!strcmp(argv[arg_i], "1G")) {
+				to_return.huge_pages = huge_1g_pages;
+			}
+			else {
+				fprintf(stderr, "ERROR: -H/--huge-pages must be one of off, thp, 2M, or 1G\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-A") || !strcmp(argv[arg_i], "--approximate")) {
+			if (!to_return.print_hist || to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -A/--approximate must not be specified in this mode\n");
+				argument_error = true;
+			}
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) >= 0) {
+				to_return.approx_memory = atol(argv[arg_i]) << 20;
+			}
+			else {
+				fprintf(stderr, "ERROR: -A/--approximate must be a non-negative integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-B") || !strcmp(argv[arg_i], "--bloom")) {
+			if (!to_return.print_hist || to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -B/--bloom must not be specified in this mode\n");
+				argument_error = true;
+			}
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) >= 0) {
+				to_return.bloom_memory = atol(argv[arg_i]) << 20;
+			}
+			else {
+				fprintf(stderr, "ERROR: -B/--bloom must be a non-negative integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-m") || !strcmp(argv[arg_i], "--multi-sample")) {
+			if (!to_return.print_hist || to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -m/--multi-sample must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.multi_sample = true;
+		}
+
+		else if (!strcmp(argv[arg_i], "-F") || !strcmp(argv[arg_i], "--sample-rate")) {
+			if (!to_return.print_hist || to_return.extract_reads) {
+				fprintf(stderr, "ERROR: -F/--sample-rate must not be specified in this mode\n");
+				argument_error = true;
+			}
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) >= 0) {
+				to_return.sample_rate = atol(argv[arg_i]);
+			}
+			else {
+				fprintf(stderr, "ERROR: -F/--sample-rate must be a non-negative integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-M") || !strcmp(argv[arg_i], "--max-memory")) {
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) >= 0) {
+				to_return.max_memory = atol(argv[arg_i]) << 20;
+			}
+			else {
+				fprintf(stderr, "ERROR: -M/--max-memory must be a non-negative integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-E") || !strcmp(argv[arg_i], "--estimate-every")) {
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) > 0) {
+				to_return.estimate_every = atol(argv[arg_i]);
+			}
+			else {
+				fprintf(stderr, "ERROR: -E/--estimate-every must be a positive integer\n");
+				argument_error = true;
+			}
+		}
+
+		else if (!strcmp(argv[arg_i], "-w") || !strcmp(argv[arg_i], "--targets")) {
+			to_return.targets_file = argv[++arg_i];
+		}
+
+		else if (!strcmp(argv[arg_i], "-U") || !strcmp(argv[arg_i], "--socket")) {
+			if (!to_return.serve_table && !to_return.bench_server) {
+				fprintf(stderr, "ERROR: -U/--socket must not be specified in this mode\n");
+				argument_error = true;
+			}
+			to_return.socket_path = argv[++arg_i];
+		}
+
+		else if (!strcmp(argv[arg_i], "-T") || !strcmp(argv[arg_i], "--temp-dir")) {
+			to_return.temp_dir = argv[++arg_i];
+		}
+
+		else if (!strcmp(argv[arg_i], "-n") || !strcmp(argv[arg_i], "--index-interval")) {
+			if (is_str_integer(argv[++arg_i]) && atol(argv[arg_i]) > 0) {
+				to_return.index_interval = atol(argv[arg_i]);
+			}
+			else {
+				fprintf(stderr, "ERROR: -n/--index-interval must be a positive integer\n");
+				argument_error = true;
+			}
+		}
+
 		else if (!strcmp(argv[arg_i], "-r") || !strcmp(argv[arg_i], "--region-size")) {
 			if (is_str_integer(argv[++arg_i])) {
 				to_return.region_size = atoi(argv[arg_i]);
@@ -318,11 +740,47 @@ argument_struct parse_arguments(int argc, char **argv) {
 	/* ----- Error check user input ----- */
 
 
-	if (to_return.kmer_size == 0) {
+	if (to_return.select_reads) {
+		if (to_return.selection_file == NULL) {
+			fprintf(stderr, "ERROR: -S/--selection must be specified in select mode\n");
+			argument_error = true;
+		}
+	}
+
+	else if (to_return.kmer_size == 0 && !to_return.index_reads && !to_return.bench_server) {
 		fprintf(stderr, "ERROR: -k/--kmer-size must be specified\n");
 		argument_error = true;
 	}
 
+	if (to_return.merge_tables && to_return.stored_hash_table_location) {
+		fprintf(stderr, "ERROR: -i/--in must not be specified in merge mode (the tables to merge are given as the files)\n");
+		argument_error = true;
+	}
+
+	if (to_return.serve_table) {
+		if (to_return.stored_hash_table_location || to_return.where_to_save_hash_table) {
+			fprintf(stderr, "ERROR: -i/--in and -o/--out must not be specified in serve mode (the table to serve is given as the file)\n");
+			argument_error = true;
+		}
+
+		if (to_return.max_val != 0 && to_return.max_val < to_return.min_val) {
+			fprintf(stderr, "ERROR: -a/--min-val must not be greater than -b/--max-val\n");
+			argument_error = true;
+		}
+	}
+
+	if (to_return.bench_server && to_return.socket_path == NULL) {
+		fprintf(stderr, "ERROR: -U/--socket must be specified in bench mode\n");
+		argument_error = true;
+	}
+
+	if (to_return.selection_file && to_return.extract_reads) {
+		if (to_return.output_file || to_return.bgzf_output || to_return.fastq_output) {
+			fprintf(stderr, "ERROR: -S/--selection cannot be used with -O/--output, -z/--bgzf or -Q/--fastq-output when extracting reads\n");
+			argument_error = true;
+		}
+	}
+
 	if (to_return.extract_reads) {
 		if (to_return.min_val == 0 || to_return.max_val == 0) {
 			fprintf(stderr, "ERROR: -a/--min-val and -b/--max-val must both be specified and non-zero when extracting reads\n");
@@ -361,11 +819,89 @@ argument_struct parse_arguments(int argc, char **argv) {
 		}
 	}
 
+	if (to_return.paired && to_return.interleaved) {
+		fprintf(stderr, "ERROR: Cannot specify both -p/--paired and -I/--interleaved\n");
+		argument_error = true;
+	}
+
+	if ((to_return.paired || to_return.interleaved) && to_return.pipeline_encoders > 0) {
+		fprintf(stderr, "ERROR: -L/--pipeline cannot be used with -p/--paired or -I/--interleaved\n");
+		argument_error = true;
+	}
+
+	if (to_return.paired && to_return.selection_file) {
+		/* Both files of a pair would need their selections written at the same time */
+		fprintf(stderr, "ERROR: -S/--selection cannot be used with -p/--paired (use -I/--interleaved input instead)\n");
+		argument_error = true;
+	}
+
 	if (to_return.stored_hash_table_location && to_return.where_to_save_hash_table) {
 		fprintf(stderr, "ERROR: Cannot specify both -i/--in and -o/--out\n");
 		argument_error = true;
 	}
 
+	if ((to_return.approx_memory > 0) + (to_return.bloom_memory > 0) + (to_return.sample_rate > 0) > 1) {
+		fprintf(stderr, "ERROR: Only one of -A/--approximate, -B/--bloom and -F/--sample-rate may be specified\n");
+		argument_error = true;
+	}
+
+	if (to_return.approx_memory > 0 || to_return.bloom_memory > 0 || to_return.sample_rate > 0) {
+		if (to_return.stored_hash_table_location || to_return.where_to_save_hash_table) {
+			fprintf(stderr, "ERROR: -A/--approximate, -B/--bloom and -F/--sample-rate cannot be used with -i/--in or -o/--out\n");
+			argument_error = true;
+		}
+
+		if (to_return.numa == partition_numa) {
+			/* Neither the sketch nor the sparse table is laid out by hash, so can't be partitioned between nodes */
+			fprintf(stderr, "ERROR: -A/--approximate, -B/--bloom and -F/--sample-rate cannot be used with -N/--numa partition\n");
+			argument_error = true;
+		}
+	}
+
+	if (to_return.max_memory > 0 && (to_return.approx_memory > 0 || to_return.bloom_memory > 0 || to_return.sample_rate > 0)) {
+		/* These set their own memory */
+		fprintf(stderr, "ERROR: -M/--max-memory cannot be used with -A/--approximate, -B/--bloom or -F/--sample-rate\n");
+		argument_error = true;
+	}
+
+	if (to_return.targets_file) {
+		if (to_return.approx_memory > 0 || to_return.bloom_memory > 0 || to_return.sample_rate > 0 || to_return.max_memory > 0 || to_return.multi_sample) {
+			fprintf(stderr, "ERROR: -w/--targets cannot be used with -A/--approximate, -B/--bloom, -F/--sample-rate, -M/--max-memory or -m/--multi-sample\n");
+			argument_error = true;
+		}
+
+		if (to_return.stored_hash_table_location || to_return.where_to_save_hash_table) {
+			fprintf(stderr, "ERROR: -w/--targets cannot be used with -i/--in or -o/--out\n");
+			argument_error = true;
+		}
+
+		if (to_return.numa == partition_numa) {
+			fprintf(stderr, "ERROR: -w/--targets cannot be used with -N/--numa partition\n");
+			argument_error = true;
+		}
+	}
+
+	if (to_return.multi_sample) {
+		if (to_return.approx_memory > 0 || to_return.bloom_memory > 0 || to_return.sample_rate > 0 || to_return.max_memory > 0) {
+			fprintf(stderr, "ERROR: -m/--multi-sample cannot be used with -A/--approximate, -B/--bloom, -F/--sample-rate or -M/--max-memory\n");
+			argument_error = true;
+		}
+
+		if (to_return.stored_hash_table_location || to_return.where_to_save_hash_table) {
+			fprintf(stderr, "ERROR: -m/--multi-sample cannot be used with -i/--in or -o/--out\n");
+			argument_error = true;
+		}
+
+		if (to_return.numa == partition_numa) {
+			fprintf(stderr, "ERROR: -m/--multi-sample cannot be used with -N/--numa partition\n");
+			argument_error = true;
+		}
+
+		if (!tag_samples(&to_return, argc, argv)) {
+			argument_error = true;
+		}
+	}
+
 	if (to_return.quiet && to_return.verbose) {
 		fprintf(stderr, "ERROR: Cannot enable both -q/--quiet and -v/--verbose modes\n");
 		argument_error = true;
@@ -1,6 +1,13 @@
 typedef struct argument_struct {
 	bool print_hist;
 	bool extract_reads;
+	bool select_reads; /* Apply a selection file written by extract to the input files */
+	bool index_reads; /* Write a record-offset index for each of the input files */
+	bool merge_tables; /* Combine the stored hash tables given as the input files */
+	bool serve_table; /* Answer k-mer queries against the stored hash table given as the file */
+	bool bench_server; /* Time queries of the reads of the files against a server */
+	char *socket_path; /* Unix domain socket served on or benchmarked (NULL = stdin/stdout) */
+	int merge_operation; /* One of merge_op_enum (merge.h) */
 	int min_kmer_hits;
 	int max_kmers_missed;
 	unsigned int min_val;
@@ -15,5 +22,31 @@ typedef struct argument_struct {
 	int region_size;
 	int interval_size;
 	int index_first_file;
+	char *output_file; /* NULL = stdout */
+	bool bgzf_output;
+	bool fastq_output; /* Print extracted reads as fastq, keeping their quality values */
+	char *selection_file;
+	bool paired; /* Input files are given in pairs of mates (R1 R2 R1 R2 ...) */
+	bool interleaved; /* Mates of each pair are consecutive records of one file */
+	int pair_rule; /* One of pair_rule_enum (zkc2.h) */
+	int num_threads;
+	unsigned long chunk_size; /* If non-zero, fasta records are streamed and counted in chunks of this many bases */
+	unsigned long index_interval; /* Number of records between offsets in index files */
+	int reader; /* One of reader_enum (async_reader.h): stdio, read-ahead thread or io_uring */
+	int pipeline_encoders; /* If non-zero, reads are counted by a pipeline with this many encoder threads... */
+	int pipeline_counters; /* ... and this many counter threads */
+	int numa; /* One of numa_enum (table_memory.h): off, interleave table pages across nodes, or partition table between nodes */
+	int huge_pages; /* One of huge_page_enum (table_memory.h): off, transparent, 2 MiB or 1 GiB huge pages */
+	unsigned long approx_memory; /* If non-zero, k-mers are counted approximately in a count-min sketch of this many bytes */
+	unsigned long bloom_memory; /* If non-zero, singleton k-mers are kept out of a sparse table by a Bloom filter of this many bytes */
+	unsigned long sample_rate; /* If non-zero, only 1 / sample_rate of the k-mers (chosen by hash) are counted */
+	unsigned long max_memory; /* If non-zero, the table is chosen to fit in this many bytes */
+	unsigned long estimate_every; /* The number of distinct k-mers is estimated from every estimate_every'th read */
+	char *temp_dir; /* Where k-mers are kept when they are counted a partition at a time (NULL = TMPDIR or /tmp) */
+	bool multi_sample; /* Count the input files under the samples they are tagged with */
+	int num_samples; /* 0 unless multi_sample */
+	char **sample_names;
+	int *file_samples; /* Sample of each input file */
+	char *targets_file; /* If set, only the k-mers in this file are counted */
 } argument_struct;
 argument_struct parse_arguments(int argc, char **argv);
@@ -0,0 +1,437 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "queue.h"
+#include "pipeline.h"
+#include "table_memory.h"
+
+
+typedef struct {
+	seg_batch *reads;
+	long sequence; /* Position of the batch in the file, so that batches can be written in order */
+	uint64_t *hashes; /* Hashes of every window of every read, one read after another (NO_KMER if there is no word) */
+	unsigned long *first_hash; /* Index in hashes of each read's first window */
+	unsigned long num_hashes;
+	unsigned long hashes_size; /* Number of hashes allocated */
+	int *kmer_hits;
+	bool *passes;
+	int partitions_left; /* Partitions of the table still to be updated from this batch */
+} pipeline_batch;
+
+typedef struct {
+	FILE *f;
+	int format;
+	int phase;
+	argument_struct *args;
+	kmer_params *params;
+	uint32_t *hash_table;
+	long *read_count;
+	work_queue free_batches;
+	work_queue to_encode;
+	work_queue *to_count; /* One queue for each partition of the table */
+	work_queue to_write;
+	int num_counters;
+	int num_partitions;
+	uint64_t partition_cells;
+	int encoders_running;
+	int counters_running;
+} pipeline;
+
+typedef struct {
+	pipeline *p;
+	int partition;
+} counter_args;
+
+
+static void *reader_stage(void *arg) {
+
+	pipeline *p = arg;
+	pipeline_batch *batch;
+	long sequence = 0;
+	bool bEOF = false;
+	int i; /* For loop counter */
+
+	while (!bEOF) {
+		batch = pop_work(&p->free_batches);
+		get_next_batch(p->f, p->format, batch->reads);
+		batch->sequence = sequence++;
+		bEOF = batch->reads->bEOF;
+
+		for (i = 0; i < batch->reads->num_segs; i++) {
+			(*p->read_count)++;
+			update_progress(p->read_count, p->args->quiet);
+		}
+
+		push_work(&p->to_encode, batch);
+	}
+
+	for (i = 0; i < p->args->pipeline_encoders; i++) {
+		push_work(&p->to_encode, NULL);
+	}
+
+	return NULL;
+}
+
+
+static void *encoder_stage(void *arg) {
+
+	pipeline *p = arg;
+	pipeline_batch *batch;
+	segment *seg;
+	unsigned long num_hashes;
+	unsigned long window_size = p->params->window_size;
+	uint64_t *tmp;
+	int i; /* For loop counter */
+
+	while ((batch = pop_work(&p->to_encode)) != NULL) {
+		num_hashes = 0;
+		for (i = 0; i < batch->reads->num_segs; i++) {
+			batch->first_hash[i] = num_hashes;
+			if (batch->reads->segs[i].length >= window_size) {
+				num_hashes += batch->reads->segs[i].length - window_size + 1;
+			}
+		}
+
+		if (num_hashes > batch->hashes_size) {
+			if ((tmp = realloc(batch->hashes, num_hashes * sizeof(uint64_t))) == NULL) {
+				fprintf(stderr, "ERROR: Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			batch->hashes = tmp;
+			batch->hashes_size = num_hashes;
+		}
+		memset(batch->hashes, 0xff, num_hashes * sizeof(uint64_t));
+		batch->num_hashes = num_hashes;
+
+		for (i = 0; i < batch->reads->num_segs; i++) {
+			seg = &batch->reads->segs[i];
+			if (seg->length >= window_size) {
+				process_read(seg, encode_phase, p->params, p->hash_table, batch->hashes + batch->first_hash[i]);
+			}
+		}
+
+		if (p->phase == hash_phase) {
+			/* Every partition's counters need to see the batch */
+			batch->partitions_left = p->num_partitions;
+			for (i = 0; i < p->num_partitions; i++) {
+				push_work(&p->to_count[i], batch);
+			}
+		}
+		else {
+			/* Lookups don't write to the table, so any partition's counters can take the batch */
+			push_work(&p->to_count[batch->sequence % p->num_partitions], batch);
+		}
+	}
+
+	/* The last encoder to finish tells the counters to stop */
+	if (__atomic_sub_fetch(&p->encoders_running, 1, __ATOMIC_ACQ_REL) == 0) {
+		for (i = 0; i < p->num_counters; i++) {
+			push_work(&p->to_count[i % p->num_partitions], NULL);
+		}
+	}
+
+	return NULL;
+}
+
+
+static void match_read(pipeline *p, pipeline_batch *batch, int i, read_bitmaps *bitmaps) {
+
+	/* Look up each k-mer word of read i of batch, decide whether the read is extracted, and mask it if so */
+
+	segment *seg = &batch->reads->segs[i];
+	uint64_t *hashes = batch->hashes + batch->first_hash[i];
+	unsigned long num_windows = seg->length - p->params->window_size + 1;
+	unsigned long start; /* For loop counter */
+	int kmer_hits = 0;
+	uint32_t count;
+
+	ensure_read_bitmaps(bitmaps, seg->length);
+
+	for (start = 0; start < num_windows; start++) {
+		if (hashes[start] != NO_KMER) {
+			count = COUNTS_ALL_IN_HASH_TABLE(p->params) ? p->hash_table[hashes[start]] : lookup_kmer(p->params, p->hash_table, hashes[start]);
+			if (count >= p->params->min_val && count <= p->params->max_val) {
+				SET_BIT(bitmaps->hits, start);
+				kmer_hits++;
+			}
+		}
+	}
+
+	batch->kmer_hits[i] = kmer_hits;
+	batch->passes[i] = kmer_hits >= get_cutoff(p->args, num_kmers_in_read(seg, p->args->kmer_size));
+
+	if (batch->passes[i] && !p->args->selection_file && (p->args->mask == strict_mask || p->args->mask == normal_mask)) {
+		/* Leaves the bitmaps zeroed */
+		mask_read(seg, bitmaps, p->args->mask, p->params, p->args->fastq_output);
+	}
+	else {
+		memset(bitmaps->hits, 0, BITMAP_WORDS(seg->length) * sizeof(uint64_t));
+	}
+
+	return;
+}
+
+
+static void *counter_stage(void *arg) {
+
+	pipeline *p = ((counter_args *) arg)->p;
+	int partition = ((counter_args *) arg)->partition;
+	uint64_t first_cell = partition * p->partition_cells;
+	pipeline_batch *batch;
+	read_bitmaps bitmaps = {NULL, NULL, 0};
+	unsigned long h; /* For loop counter */
+	int i; /* For loop counter */
+
+	if (p->args->numa != no_numa) {
+		pin_thread_to_node(partition);
+	}
+
+	while ((batch = pop_work(&p->to_count[partition])) != NULL) {
+		if (p->phase == hash_phase) {
+			/* Only count the k-mers in this partition (which also skips NO_KMER, as it is beyond every partition) */
+			for (h = 0; h < batch->num_hashes; h++) {
+				if (batch->hashes[h] - first_cell < p->partition_cells) {
+					if (COUNTS_ALL_IN_HASH_TABLE(p->params)) {
+						COUNT_KMER(p->hash_table, batch->hashes[h], p->params->concurrent);
+					}
+					else {
+						count_kmer(p->params, p->hash_table, batch->hashes[h]);
+					}
+				}
+			}
+
+			if (__atomic_sub_fetch(&batch->partitions_left, 1, __ATOMIC_ACQ_REL) == 0) {
+				push_work(&p->free_batches, batch);
+			}
+		}
+
+		else {
+			for (i = 0; i < batch->reads->num_segs; i++) {
+				batch->kmer_hits[i] = 0;
+				batch->passes[i] = false;
+				if (batch->reads->segs[i].length >= p->params->window_size) {
+					match_read(p, batch, i, &bitmaps);
+				}
+			}
+
+			push_work(&p->to_write, batch);
+		}
+	}
+
+	free_read_bitmaps(&bitmaps);
+
+	/* The last counter to finish tells the writer to stop */
+	if (__atomic_sub_fetch(&p->counters_running, 1, __ATOMIC_ACQ_REL) == 0 && p->phase == extract_phase) {
+		push_work(&p->to_write, NULL);
+	}
+
+	return NULL;
+}
+
+
+static void write_batches(pipeline *p, int num_batches, out_buffer *out_buf, selection_writer *sel) {
+
+	/* Counters can finish batches out of order, so hold on to each batch until all of the ones before it have been
+	 * written
+	 */
+
+	pipeline_batch *waiting[num_batches];
+	pipeline_batch *batch;
+	long next_sequence = 0;
+	int i; /* For loop counter */
+
+	for (i = 0; i < num_batches; i++) {
+		waiting[i] = NULL;
+	}
+
+	while ((batch = pop_work(&p->to_write)) != NULL) {
+		waiting[batch->sequence % num_batches] = batch;
+
+		while ((batch = waiting[next_sequence % num_batches]) != NULL && batch->sequence == next_sequence) {
+			for (i = 0; i < batch->reads->num_segs; i++) {
+				if (sel) {
+					selection_add_read(sel, batch->passes[i], batch->kmer_hits[i]);
+				}
+				else if (batch->passes[i]) {
+					write_read(&batch->reads->segs[i], batch->kmer_hits[i], p->args, out_buf);
+					out_buffer_end_record(out_buf);
+				}
+			}
+
+			waiting[next_sequence % num_batches] = NULL;
+			next_sequence++;
+			push_work(&p->free_batches, batch);
+		}
+	}
+
+	return;
+}
+
+
+static void print_stage_waits(pipeline *p) {
+
+	double count_full_wait = 0, count_empty_wait = 0;
+	int i; /* For loop counter */
+
+	for (i = 0; i < p->num_partitions; i++) {
+		count_full_wait += p->to_count[i].full_wait;
+		count_empty_wait += p->to_count[i].empty_wait;
+	}
+
+	fprintf(stderr, "Pipeline waits (s): reader %.2f for batches, %.2f for encoders; encoders %.2f for input, %.2f for counters; counters %.2f for input",
+			p->free_batches.empty_wait, p->to_encode.full_wait, p->to_encode.empty_wait, count_full_wait, count_empty_wait);
+
+	if (p->phase == extract_phase) {
+		fprintf(stderr, ", %.2f for writer; writer %.2f for input", p->to_write.full_wait, p->to_write.empty_wait);
+	}
+
+	fprintf(stderr, "\n");
+
+	return;
+}
+
+
+void run_pipeline(FILE *f, int format, int phase, argument_struct *args, kmer_params *base_params, uint32_t *hash_table, out_buffer *out_buf, selection_writer *sel, long *read_count) {
+
+	/* Count (or extract) the reads of f using args->pipeline_encoders encoder threads and args->pipeline_counters counter
+	 * threads
+	 */
+
+	pipeline p;
+	kmer_params params = *base_params;
+	uint64_t num_cells = 1UL << (2 * args->kmer_size);
+	int num_partitions = (args->numa == partition_numa) ? numa_node_count() : 1;
+	int num_encoders = args->pipeline_encoders;
+	int num_counters = (args->pipeline_counters > num_partitions) ? args->pipeline_counters : num_partitions;
+	int num_batches = 2 * (num_encoders + num_counters) + 2;
+	pipeline_batch batches[num_batches];
+	work_queue to_count[num_partitions];
+	counter_args counter_partitions[num_counters];
+	pthread_t reader, encoders[num_encoders], counters[num_counters];
+	int i; /* For loop counter */
+
+	if (num_counters > args->pipeline_counters && !args->quiet) {
+		fprintf(stderr, "WARNING: Using %d counter threads, one for each NUMA node - continuing anyway\n", num_counters);
+	}
+
+	/* Counter i updates partition i % num_partitions, so a partition only needs atomic updates if it has several */
+	params.concurrent = (num_counters > num_partitions);
+
+	p.f = f;
+	p.format = format;
+	p.phase = phase;
+	p.args = args;
+	p.params = &params;
+	p.hash_table = hash_table;
+	p.read_count = read_count;
+	p.to_count = to_count;
+	p.num_counters = num_counters;
+	p.num_partitions = num_partitions;
+	p.partition_cells = (num_partitions > 1) ? numa_partition_cells(hash_table, num_cells) : num_cells;
+	p.encoders_running = num_encoders;
+	p.counters_running = num_counters;
+
+	init_work_queue(&p.free_batches, num_batches);
+	init_work_queue(&p.to_encode, num_batches + num_encoders);
+	for (i = 0; i < num_partitions; i++) {
+		init_work_queue(&to_count[i], num_batches + num_counters);
+	}
+	init_work_queue(&p.to_write, num_batches + 1);
+
+	for (i = 0; i < num_batches; i++) {
+		batches[i].reads = create_seg_batch(SEG_BATCH_READS, PIPELINE_BATCH_BYTES);
+		batches[i].hashes = NULL;
+		batches[i].hashes_size = 0;
+		if ((batches[i].first_hash = malloc(SEG_BATCH_READS * sizeof(unsigned long))) == NULL
+				|| (batches[i].kmer_hits = malloc(SEG_BATCH_READS * sizeof(int))) == NULL
+				|| (batches[i].passes = malloc(SEG_BATCH_READS * sizeof(bool))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		push_work(&p.free_batches, &batches[i]);
+	}
+
+	if (pthread_create(&reader, NULL, reader_stage, &p) != 0) {
+		fprintf(stderr, "ERROR: Failed to create reader thread\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < num_encoders; i++) {
+		if (pthread_create(&encoders[i], NULL, encoder_stage, &p) != 0) {
+			fprintf(stderr, "ERROR: Failed to create encoder thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < num_counters; i++) {
+		counter_partitions[i].p = &p;
+		counter_partitions[i].partition = i % num_partitions;
+		if (pthread_create(&counters[i], NULL, counter_stage, &counter_partitions[i]) != 0) {
+			fprintf(stderr, "ERROR: Failed to create counter thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (phase == extract_phase) {
+		write_batches(&p, num_batches, out_buf, sel);
+	}
+
+	pthread_join(reader, NULL);
+	for (i = 0; i < num_encoders; i++) {
+		pthread_join(encoders[i], NULL);
+	}
+	for (i = 0; i < num_counters; i++) {
+		pthread_join(counters[i], NULL);
+	}
+
+	if (!args->quiet) {
+		print_stage_waits(&p);
+	}
+
+	for (i = 0; i < num_batches; i++) {
+		free_seg_batch(batches[i].reads);
+		free(batches[i].hashes);
+		free(batches[i].first_hash);
+		free(batches[i].kmer_hits);
+		free(batches[i].passes);
+	}
+
+	destroy_work_queue(&p.free_batches);
+	destroy_work_queue(&p.to_encode);
+	for (i = 0; i < num_partitions; i++) {
+		destroy_work_queue(&to_count[i]);
+	}
+	destroy_work_queue(&p.to_write);
+
+	return;
+}
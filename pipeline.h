@@ -0,0 +1,17 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/* Batches of reads flow through three stages, connected by bounded queues:
+ *
+ *		reader (1 thread)  -->  encoders (hash the k-mer words)  -->  counters (update or look up the table)
+ *
+ * When extracting, the calling thread then writes out the counted batches in their original order. If the hash table
+ * is partitioned between NUMA nodes, each counter is pinned to a node and every batch is counted once per partition,
+ * each counter only updating the k-mers which live on its node.
+ */
+
+#define PIPELINE_BATCH_BYTES (1 << 20)
+
+void run_pipeline(FILE *f, int format, int phase, argument_struct *args, kmer_params *base_params, uint32_t *hash_table, out_buffer *out_buf, selection_writer *sel, long *read_count);
+
+#endif
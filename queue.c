@@ -0,0 +1,113 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "queue.h"
+
+
+static double seconds_now(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+void init_work_queue(work_queue *queue, int capacity) {
+
+	if ((queue->items = malloc(capacity * sizeof(void *))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->count = 0;
+	queue->full_wait = 0;
+	queue->empty_wait = 0;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+
+	return;
+}
+
+
+void destroy_work_queue(work_queue *queue) {
+
+	free(queue->items);
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_cond_destroy(&queue->not_full);
+
+	return;
+}
+
+
+void push_work(work_queue *queue, void *item) {
+
+	double wait_start;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count == queue->capacity) {
+		wait_start = seconds_now();
+		while (queue->count == queue->capacity) {
+			pthread_cond_wait(&queue->not_full, &queue->lock);
+		}
+		queue->full_wait += seconds_now() - wait_start;
+	}
+	queue->items[(queue->head + queue->count) % queue->capacity] = item;
+	queue->count++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+
+	return;
+}
+
+
+void *pop_work(work_queue *queue) {
+
+	void *item;
+	double wait_start;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count == 0) {
+		wait_start = seconds_now();
+		while (queue->count == 0) {
+			pthread_cond_wait(&queue->not_empty, &queue->lock);
+		}
+		queue->empty_wait += seconds_now() - wait_start;
+	}
+	item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+
+	return item;
+}
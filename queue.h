@@ -0,0 +1,26 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+
+/* Bounded blocking queue of pointers, used to pass work between threads. The time threads spend blocked on each side
+ * is recorded, so that a pipeline can show which of its stages is holding the others up.
+ */
+typedef struct {
+	void **items;
+	int capacity;
+	int head;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	double full_wait; /* Seconds spent waiting for room to push */
+	double empty_wait; /* Seconds spent waiting for something to pop */
+} work_queue;
+
+void init_work_queue(work_queue *queue, int capacity);
+void destroy_work_queue(work_queue *queue);
+void push_work(work_queue *queue, void *item);
+void *pop_work(work_queue *queue);
+
+#endif
@@ -0,0 +1,390 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "index.h"
+#include "async_reader.h"
+#include "scheduler.h"
+#include "table_memory.h"
+
+
+typedef struct {
+	char *file_name;
+	mapped_file file;
+	record_index *idx;
+	uint64_t ranges_left; /* Ranges of the file still to be counted */
+	uint64_t reads; /* Reads of the file counted so far */
+} file_job;
+
+typedef struct {
+	int file;
+	int64_t range; /* -1 until the file has been split into ranges */
+} task;
+
+typedef struct {
+	task *tasks;
+	int capacity;
+	int front;
+	int count;
+	pthread_mutex_t lock;
+} task_deque;
+
+typedef struct {
+	file_job *jobs;
+	task_deque *deques;
+	int num_workers;
+	int64_t tasks_left; /* Tasks which have been queued but not finished */
+	pthread_mutex_t lock; /* Idle workers wait on cond until new tasks are queued or everything has finished */
+	pthread_cond_t cond;
+	uint64_t generation; /* Incremented whenever they should look again */
+	uint64_t reads_done; /* Across all files, for progress dots */
+	kmer_params *params;
+	uint32_t *hash_table;
+	uint64_t interval;
+	int reader;
+	int numa;
+	bool quiet;
+} scheduler;
+
+typedef struct {
+	scheduler *sched;
+	int id;
+} worker_args;
+
+
+static void push_task(task_deque *deque, task t) {
+
+	task *tmp;
+	int i; /* For loop counter */
+
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count == deque->capacity) {
+		if ((tmp = malloc(2 * deque->capacity * sizeof(task))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < deque->count; i++) {
+			tmp[i] = deque->tasks[(deque->front + i) % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = tmp;
+		deque->front = 0;
+		deque->capacity *= 2;
+	}
+
+	deque->tasks[(deque->front + deque->count) % deque->capacity] = t;
+	deque->count++;
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return;
+}
+
+
+static bool take_task(task_deque *deque, task *t, bool from_front) {
+
+	/* The owner of a deque takes from the back, thieves from the front */
+
+	bool found = false;
+
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count > 0) {
+		if (from_front) {
+			*t = deque->tasks[deque->front];
+			deque->front = (deque->front + 1) % deque->capacity;
+		}
+		else {
+			*t = deque->tasks[(deque->front + deque->count - 1) % deque->capacity];
+		}
+		deque->count--;
+		found = true;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return found;
+}
+
+
+static void wake_workers(scheduler *sched) {
+
+	pthread_mutex_lock(&sched->lock);
+	sched->generation++;
+	pthread_cond_broadcast(&sched->cond);
+	pthread_mutex_unlock(&sched->lock);
+
+	return;
+}
+
+
+static void add_reads(scheduler *sched, file_job *job, uint64_t num_reads) {
+
+	uint64_t done = __atomic_fetch_add(&sched->reads_done, num_reads, __ATOMIC_RELAXED);
+	uint64_t dot; /* For loop counter */
+
+	__atomic_fetch_add(&job->reads, num_reads, __ATOMIC_RELAXED);
+
+	/* One dot for each 500,000 reads, as in the serial reader */
+	if (!sched->quiet) {
+		for (dot = done / 500000; dot < (done + num_reads) / 500000; dot++) {
+			fprintf(stderr, ".");
+		}
+	}
+
+	return;
+}
+
+
+static void finish_file(scheduler *sched, file_job *job) {
+
+	if (!sched->quiet) {
+		fprintf(stderr, "%s: counted %" PRIu64 " reads\n", job->file_name, job->reads);
+	}
+
+	if (job->idx) {
+		free_record_index(job->idx);
+		unmap_data_file(&job->file);
+	}
+
+	return;
+}
+
+
+static void count_whole_file(scheduler *sched, file_job *job) {
+
+	/* Files which cannot be mapped (e.g. pipes) are read from start to finish by one worker */
+
+	FILE *f;
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+	int format;
+	int i; /* For loop counter */
+
+	if ((f = open_input_file(job->file_name, sched->reader, sched->quiet)) == NULL) {
+		fprintf(stderr, "ERROR: Could not open data file %s\n", job->file_name);
+		exit(EXIT_FAILURE);
+	}
+	format = which_format(f);
+
+	do {
+		get_next_batch(f, format, batch);
+
+		for (i = 0; i < batch->num_segs; i++) {
+			if (batch->segs[i].length >= sched->params->window_size) {
+				process_read(&batch->segs[i], hash_phase, sched->params, sched->hash_table, NULL);
+			}
+		}
+
+		add_reads(sched, job, batch->num_segs);
+
+	} while (!batch->bEOF);
+
+	free_seg_batch(batch);
+	fclose(f);
+
+	return;
+}
+
+
+static void run_task(scheduler *sched, int worker, task t, segment *seg, unsigned int *buffsize) {
+
+	file_job *job = &sched->jobs[t.file];
+	task range_task;
+	int64_t range; /* For loop counter */
+
+	if (t.range == -1) {
+		job->idx = NULL;
+
+		if (!map_data_file(job->file_name, &job->file)) {
+			count_whole_file(sched, job);
+			finish_file(sched, job);
+			return;
+		}
+
+		job->idx = load_or_build_index(job->file_name, &job->file, sched->interval, sched->quiet);
+		job->ranges_left = job->idx->num_offsets;
+
+		/* Pushed last range first, so that this worker goes through the file in order while thieves start at its end */
+		__atomic_fetch_add(&sched->tasks_left, job->idx->num_offsets, __ATOMIC_ACQ_REL);
+		range_task.file = t.file;
+		for (range = job->idx->num_offsets - 1; range >= 0; range--) {
+			range_task.range = range;
+			push_task(&sched->deques[worker], range_task);
+		}
+		wake_workers(sched);
+
+		return;
+	}
+
+	add_reads(sched, job, count_record_range(&job->file, job->idx, t.range, sched->params, sched->hash_table, seg, buffsize));
+
+	if (__atomic_sub_fetch(&job->ranges_left, 1, __ATOMIC_ACQ_REL) == 0) {
+		finish_file(sched, job);
+	}
+
+	return;
+}
+
+
+static void *scheduler_worker(void *arg) {
+
+	worker_args *args = arg;
+	scheduler *sched = args->sched;
+	unsigned int buffsize = 10000;
+	segment seg;
+	task t;
+	bool found;
+	uint64_t generation;
+	int victim; /* For loop counter */
+
+	if (sched->numa != no_numa) {
+		/* Spread the workers evenly over the nodes holding the table */
+		pin_thread_to_node(args->id);
+	}
+
+	if ((seg.seq = malloc(buffsize + 1)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	seg.name = "";
+	seg.qual = "\0";
+
+	while (__atomic_load_n(&sched->tasks_left, __ATOMIC_ACQUIRE) > 0) {
+		generation = __atomic_load_n(&sched->generation, __ATOMIC_ACQUIRE);
+		found = take_task(&sched->deques[args->id], &t, false);
+
+		for (victim = (args->id + 1) % sched->num_workers; !found && victim != args->id; victim = (victim + 1) % sched->num_workers) {
+			found = take_task(&sched->deques[victim], &t, true);
+		}
+
+		if (!found) {
+			/* Everything left is already being counted, but a file may yet be split into more ranges */
+			pthread_mutex_lock(&sched->lock);
+			while (sched->generation == generation && __atomic_load_n(&sched->tasks_left, __ATOMIC_ACQUIRE) > 0) {
+				pthread_cond_wait(&sched->cond, &sched->lock);
+			}
+			pthread_mutex_unlock(&sched->lock);
+			continue;
+		}
+
+		run_task(sched, args->id, t, &seg, &buffsize);
+
+		if (__atomic_sub_fetch(&sched->tasks_left, 1, __ATOMIC_ACQ_REL) == 0) {
+			wake_workers(sched);
+		}
+	}
+
+	free(seg.seq);
+
+	return NULL;
+}
+
+
+void count_files_in_parallel(int num_files, char **files, kmer_params *params, uint32_t *hash_table, int num_threads, uint64_t interval, int reader, int numa, bool quiet) {
+
+	/* Count the k-mers of all of the files into hash_table on num_threads threads. As every k-mer is added atomically,
+	 * the table ends up exactly as it would if the files were counted one after another.
+	 */
+
+	scheduler sched;
+	kmer_params worker_params = *params;
+	file_job jobs[num_files];
+	task_deque deques[num_threads];
+	worker_args args[num_threads];
+	pthread_t threads[num_threads];
+	task t;
+	int i; /* For loop counter */
+
+	worker_params.concurrent = true;
+
+	sched.jobs = jobs;
+	sched.deques = deques;
+	sched.num_workers = num_threads;
+	sched.tasks_left = num_files;
+	sched.generation = 0;
+	pthread_mutex_init(&sched.lock, NULL);
+	pthread_cond_init(&sched.cond, NULL);
+	sched.reads_done = 0;
+	sched.params = &worker_params;
+	sched.hash_table = hash_table;
+	sched.interval = interval;
+	sched.reader = reader;
+	sched.numa = numa;
+	sched.quiet = quiet;
+
+	for (i = 0; i < num_threads; i++) {
+		deques[i].capacity = 64;
+		deques[i].front = 0;
+		deques[i].count = 0;
+		if ((deques[i].tasks = malloc(deques[i].capacity * sizeof(task))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_mutex_init(&deques[i].lock, NULL);
+	}
+
+	/* Deal the files out round-robin */
+	for (i = 0; i < num_files; i++) {
+		jobs[i].file_name = files[i];
+		jobs[i].idx = NULL;
+		jobs[i].reads = 0;
+		t.file = i;
+		t.range = -1;
+		push_task(&deques[i % num_threads], t);
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		args[i].sched = &sched;
+		args[i].id = i;
+		if (pthread_create(&threads[i], NULL, scheduler_worker, &args[i]) != 0) {
+			fprintf(stderr, "ERROR: Failed to create counting thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		free(deques[i].tasks);
+		pthread_mutex_destroy(&deques[i].lock);
+	}
+	pthread_mutex_destroy(&sched.lock);
+	pthread_cond_destroy(&sched.cond);
+
+	return;
+}
@@ -0,0 +1,12 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/* Counting several input files at once. Each worker thread has a deque of tasks, which start out as whole files dealt
+ * round-robin between the workers. A worker which takes a file that can be mapped into memory splits it into the ranges
+ * of its index, pushing them onto the back of its deque and taking them from there in file order; idle workers steal
+ * from the front of other workers' deques, so they take the work their owner will reach last.
+ */
+
+void count_files_in_parallel(int num_files, char **files, kmer_params *params, uint32_t *hash_table, int num_threads, uint64_t interval, int reader, int numa, bool quiet);
+
+#endif
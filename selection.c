@@ -0,0 +1,303 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "selection.h"
+#include "output.h"
+
+
+/* Number of byte ranges collected before they are handed to writev */
+#define SELECTION_IOVECS 1024
+
+
+selection_writer *open_selection_writer(char *file_name, uint32_t num_files) {
+
+	selection_writer *sel;
+	char hits_file_name[strlen(file_name) + 6];
+
+	if ((sel = malloc(sizeof(selection_writer))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((sel->file = fopen(file_name, "wb")) == NULL) {
+		fprintf(stderr, "ERROR: Could not open selection file %s\n", file_name);
+		exit(EXIT_FAILURE);
+	}
+
+	if (fwrite(SELECTION_MAGIC, 1, 8, sel->file) != 8 || fwrite(&num_files, sizeof(uint32_t), 1, sel->file) != 1) {
+		fprintf(stderr, "ERROR: Failed to write selection file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(hits_file_name, "%s.hits", file_name);
+	sel->hits_writer = open_out_writer(hits_file_name, false, 1);
+	sel->hits_buf = create_out_buffer(sel->hits_writer);
+
+	sel->bits = NULL;
+	sel->num_reads = 0;
+	sel->num_words = 0;
+
+	return sel;
+}
+
+
+void selection_add_read(selection_writer *sel, bool extracted, uint32_t kmer_hits) {
+
+	uint64_t *tmp;
+	uint64_t new_num_words;
+
+	if (BITMAP_WORDS(sel->num_reads + 1) > sel->num_words) {
+		new_num_words = (sel->num_words > 0) ? 2 * sel->num_words : 1024;
+		if ((tmp = realloc(sel->bits, new_num_words * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(tmp + sel->num_words, 0, (new_num_words - sel->num_words) * sizeof(uint64_t));
+		sel->bits = tmp;
+		sel->num_words = new_num_words;
+	}
+
+	if (extracted) {
+		SET_BIT(sel->bits, sel->num_reads);
+	}
+	sel->num_reads++;
+
+	out_buffer_write(sel->hits_buf, (char *) &kmer_hits, sizeof(uint32_t));
+	out_buffer_end_record(sel->hits_buf);
+
+	return;
+}
+
+
+void selection_end_file(selection_writer *sel) {
+
+	uint64_t num_words = BITMAP_WORDS(sel->num_reads);
+
+	if (fwrite(&sel->num_reads, sizeof(uint64_t), 1, sel->file) != 1 || fwrite(sel->bits, sizeof(uint64_t), num_words, sel->file) != num_words) {
+		fprintf(stderr, "ERROR: Failed to write selection file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (num_words > 0) {
+		memset(sel->bits, 0, num_words * sizeof(uint64_t));
+	}
+	sel->num_reads = 0;
+
+	return;
+}
+
+
+void close_selection_writer(selection_writer *sel) {
+
+	if (fclose(sel->file) != 0) {
+		fprintf(stderr, "ERROR: Failed to close selection file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	free_out_buffer(sel->hits_buf);
+	close_out_writer(sel->hits_writer);
+	free(sel->bits);
+	free(sel);
+
+	return;
+}
+
+
+void apply_selection(char *selection_file, char *output_file, bool bgzf, int num_threads, bool quiet, int num_files, char **files) {
+
+	/* Stream each input file through mmap, writing the records whose bits are set straight out of the mapping */
+
+	FILE *sel_file;
+	char magic[8];
+	uint32_t sel_num_files;
+	uint64_t num_reads;
+	uint64_t *bits = NULL;
+	uint64_t *tmp;
+	uint64_t read_index;
+	uint64_t num_selected;
+	out_writer *writer;
+	out_buffer *buf = NULL;
+	struct iovec ranges[SELECTION_IOVECS];
+	int num_ranges;
+	struct stat file_stat;
+	char *data;
+	size_t size;
+	size_t pos, end;
+	int fd;
+	int format;
+	int file_index; /* For loop counter */
+
+	if ((sel_file = fopen(selection_file, "rb")) == NULL) {
+		fprintf(stderr, "ERROR: Could not open selection file %s\n", selection_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(magic, 1, 8, sel_file) != 8 || memcmp(magic, SELECTION_MAGIC, 8) != 0 || fread(&sel_num_files, sizeof(uint32_t), 1, sel_file) != 1) {
+		fprintf(stderr, "ERROR: %s is not a selection file\n", selection_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if (sel_num_files != (uint32_t) num_files) {
+		fprintf(stderr, "ERROR: Selection file describes %" PRIu32 " input files, but %d were given\n", sel_num_files, num_files);
+		exit(EXIT_FAILURE);
+	}
+
+	writer = open_out_writer(output_file, bgzf, num_threads);
+	if (bgzf) {
+		buf = create_out_buffer(writer);
+	}
+
+	for (file_index = 0; file_index < num_files; file_index++) {
+
+		if (fread(&num_reads, sizeof(uint64_t), 1, sel_file) != 1) {
+			fprintf(stderr, "ERROR: Selection file is truncated\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if ((tmp = realloc(bits, (BITMAP_WORDS(num_reads) + 1) * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		bits = tmp;
+
+		if (fread(bits, sizeof(uint64_t), BITMAP_WORDS(num_reads), sel_file) != BITMAP_WORDS(num_reads)) {
+			fprintf(stderr, "ERROR: Selection file is truncated\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if ((fd = open(files[file_index], O_RDONLY)) == -1 || fstat(fd, &file_stat) != 0) {
+			fprintf(stderr, "ERROR: Could not open data file %s\n", files[file_index]);
+			exit(EXIT_FAILURE);
+		}
+		size = file_stat.st_size;
+
+		if (size == 0) {
+			fprintf(stderr, "File too short!\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if ((data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+			fprintf(stderr, "ERROR: Could not map data file %s\n", files[file_index]);
+			exit(EXIT_FAILURE);
+		}
+		madvise(data, size, MADV_SEQUENTIAL);
+
+		if (data[0] == '>') {
+			format = 0;
+		}
+		else if (data[0] == '@') {
+			format = 1;
+		}
+		else {
+			fprintf(stderr, "Formatting error: File must be in fast(a/q) format (file provided does not begin with '>' or '@')\n");
+			exit(EXIT_FAILURE);
+		}
+
+		num_ranges = 0;
+		num_selected = 0;
+
+		for (pos = 0, read_index = 0; pos < size; pos = end, read_index++) {
+			end = find_record_end(data, pos, size, format);
+
+			if (read_index >= num_reads) {
+				break;
+			}
+
+			if ((bits[read_index / 64] & (1ULL << (read_index % 64))) == 0) {
+				continue;
+			}
+
+			num_selected++;
+
+			if (bgzf) {
+				out_buffer_write(buf, data + pos, end - pos);
+				out_buffer_end_record(buf);
+				continue;
+			}
+
+			/* Neighbouring records are merged into one range */
+			if (num_ranges > 0 && (char *) ranges[num_ranges - 1].iov_base + ranges[num_ranges - 1].iov_len == data + pos) {
+				ranges[num_ranges - 1].iov_len += end - pos;
+				continue;
+			}
+
+			if (num_ranges == SELECTION_IOVECS) {
+				out_writer_writev(writer, ranges, num_ranges);
+				num_ranges = 0;
+			}
+
+			ranges[num_ranges].iov_base = data + pos;
+			ranges[num_ranges].iov_len = end - pos;
+			num_ranges++;
+		}
+
+		if (read_index != num_reads || pos < size) {
+			fprintf(stderr, "ERROR: %s does not contain the same number of reads as recorded in the selection file\n", files[file_index]);
+			exit(EXIT_FAILURE);
+		}
+
+		if (num_ranges > 0) {
+			out_writer_writev(writer, ranges, num_ranges);
+		}
+
+		/* Make sure the last record ends with a newline, as it would have if it had been printed by extract */
+		if (num_reads > 0 && data[size - 1] != '\n' && (bits[(num_reads - 1) / 64] & (1ULL << ((num_reads - 1) % 64)))) {
+			if (bgzf) {
+				out_buffer_write_char(buf, '\n');
+			}
+			else {
+				ranges[0].iov_base = "\n";
+				ranges[0].iov_len = 1;
+				out_writer_writev(writer, ranges, 1);
+			}
+		}
+
+		if (!quiet) {
+			fprintf(stderr, "%s: selected %" PRIu64 " of %" PRIu64 " reads\n", files[file_index], num_selected, num_reads);
+		}
+
+		munmap(data, size);
+		close(fd);
+	}
+
+	if (bgzf) {
+		free_out_buffer(buf);
+	}
+	close_out_writer(writer);
+	free(bits);
+	fclose(sel_file);
+
+	return;
+}
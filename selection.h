@@ -0,0 +1,39 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "output.h"
+
+/* Selection files record which reads of each input file were extracted:
+ *
+ *		char magic[8]				"ZKCSEL1\0"
+ *		uint32_t num_files
+ *		for each file:
+ *			uint64_t num_reads
+ *			uint64_t bits[(num_reads + 63) / 64]	bit (i % 64) of bits[i / 64] is set if read i was extracted
+ *
+ * The number of k-mer hits of every read, in the same order, is written to a separate file (<selection>.hits) as one
+ * native-endian uint32_t per read.
+ */
+
+#define SELECTION_MAGIC "ZKCSEL1"
+
+typedef struct {
+	FILE *file;
+	out_writer *hits_writer;
+	out_buffer *hits_buf;
+	uint64_t *bits;
+	uint64_t num_reads; /* In the current input file */
+	uint64_t num_words; /* Number of words allocated to bits */
+} selection_writer;
+
+selection_writer *open_selection_writer(char *file_name, uint32_t num_files);
+void selection_add_read(selection_writer *sel, bool extracted, uint32_t kmer_hits);
+void selection_end_file(selection_writer *sel);
+void close_selection_writer(selection_writer *sel);
+void apply_selection(char *selection_file, char *output_file, bool bgzf, int num_threads, bool quiet, int num_files, char **files);
+
+#endif
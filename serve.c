@@ -0,0 +1,509 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "c_tools.h"
+#include "fastlib.h"
+#include "parse_arguments.h"
+#include "output.h"
+#include "zkc2.h"
+#include "serve.h"
+
+
+typedef struct {
+	argument_struct *args;
+	uint32_t *hash_table;
+	int in_fd;
+	int out_fd;
+} serve_connection;
+
+typedef struct {
+	char *data;
+	size_t used;
+	size_t size;
+} text_buffer;
+
+typedef struct {
+	argument_struct *args;
+	char **seqs;
+	unsigned long num_seqs;
+	int connection;
+	int num_connections;
+} bench_client;
+
+
+static double seconds_now(void) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+static void ensure_text(text_buffer *text, size_t extra) {
+
+	if (text->used + extra > text->size) {
+		while (text->used + extra > text->size) {
+			text->size = (text->size == 0) ? SERVE_BUFFER_BYTES : text->size * 2;
+		}
+		if ((text->data = realloc(text->data, text->size)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return;
+}
+
+
+static bool write_all(int fd, char *data, size_t length) {
+
+	ssize_t num_written;
+
+	while (length > 0) {
+		if ((num_written = write(fd, data, length)) <= 0) {
+			return false;
+		}
+		data += num_written;
+		length -= num_written;
+	}
+
+	return true;
+}
+
+
+static uint32_t *map_hash_table(char *table_file, uint64_t num_cells, bool quiet) {
+
+	/* Mapped rather than read, so the table's pages are shared with other servers and stay in the page cache between
+	 * runs
+	 */
+
+	int fd;
+	struct stat st;
+	void *table;
+
+	if ((fd = open(table_file, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "ERROR: Failed to open hash table file %s\n", table_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((uint64_t) st.st_size != num_cells * sizeof(uint32_t)) {
+		fprintf(stderr, "ERROR: %s is not a hash table of this -k/--kmer-size (which would be %" PRIu64 " bytes)\n", table_file, num_cells * sizeof(uint32_t));
+		exit(EXIT_FAILURE);
+	}
+
+	if ((table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map hash table file %s\n", table_file);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	if (!quiet) {
+		fprintf(stderr, "Mapped hash table %s\n", table_file);
+	}
+
+	return (uint32_t *) table;
+}
+
+
+static void answer_query(char *line, size_t length, kmer_params *params, uint32_t *hash_table, uint64_t **hashes, unsigned long *max_hashes, text_buffer *replies) {
+
+	segment seg;
+	bool count_query;
+	unsigned long num_windows;
+	unsigned long start; /* For loop counter */
+	uint32_t count;
+	long hits = 0;
+	long num_kmers = 0;
+
+	if (length > 0 && line[length - 1] == '\r') {
+		line[--length] = '\0';
+	}
+
+	if (!strncmp(line, "count ", 6)) {
+		count_query = true;
+		seg.seq = line + 6;
+	}
+	else if (!strncmp(line, "hits ", 5)) {
+		count_query = false;
+		seg.seq = line + 5;
+	}
+	else {
+		ensure_text(replies, 32);
+		replies->used += sprintf(replies->data + replies->used, "ERROR unknown query\n");
+		return;
+	}
+
+	seg.name = "";
+	seg.qual = "";
+	seg.length = length - (seg.seq - line);
+	num_windows = (seg.length >= params->window_size) ? seg.length - params->window_size + 1 : 0;
+
+	if (num_windows > 0) {
+		if (seg.length > *max_hashes) {
+			*max_hashes = seg.length;
+			if ((*hashes = realloc(*hashes, *max_hashes * sizeof(uint64_t))) == NULL) {
+				fprintf(stderr, "ERROR: Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		for (start = 0; start < seg.length; start++) {
+			(*hashes)[start] = NO_KMER;
+		}
+		process_read(&seg, encode_phase, params, NULL, *hashes);
+	}
+
+	/* At most 11 characters for each count */
+	ensure_text(replies, num_windows * 11 + 32);
+
+	for (start = 0; start < num_windows; start++) {
+		if ((*hashes)[start] == NO_KMER) {
+			if (count_query) {
+				replies->used += sprintf(replies->data + replies->used, (start > 0) ? " -" : "-");
+			}
+			continue;
+		}
+
+		count = lookup_kmer(params, hash_table, (*hashes)[start]);
+
+		if (count_query) {
+			replies->used += sprintf(replies->data + replies->used, (start > 0) ? " %" PRIu32 : "%" PRIu32, count);
+		}
+		else {
+			num_kmers++;
+			hits += (count >= params->min_val && count <= params->max_val);
+		}
+	}
+
+	if (count_query) {
+		replies->data[replies->used++] = '\n';
+	}
+	else {
+		replies->used += sprintf(replies->data + replies->used, "%ld %ld\n", hits, num_kmers);
+	}
+
+	return;
+}
+
+
+static void *serve_connection_queries(void *arg) {
+
+	/* Answer queries until the other end closes the connection (or stdin ends) */
+
+	serve_connection *conn = (serve_connection *) arg;
+	kmer_params params = get_kmer_params(*conn->args);
+	text_buffer queries = {NULL, 0, 0};
+	text_buffer replies = {NULL, 0, 0};
+	uint64_t *hashes = NULL;
+	unsigned long max_hashes = 0;
+	ssize_t num_read;
+	size_t line_start;
+	char *line_end;
+	bool bEOF = false;
+
+	params.verbose = false;
+
+	while (!bEOF) {
+		ensure_text(&queries, SERVE_BUFFER_BYTES / 2);
+
+		if ((num_read = read(conn->in_fd, queries.data + queries.used, queries.size - queries.used - 1)) <= 0) {
+			/* A last query without a newline is still answered */
+			bEOF = true;
+			if (queries.used > 0) {
+				queries.data[queries.used++] = '\n';
+			}
+		}
+		else {
+			queries.used += num_read;
+		}
+
+		line_start = 0;
+		while ((line_end = memchr(queries.data + line_start, '\n', queries.used - line_start)) != NULL) {
+			*line_end = '\0';
+			answer_query(queries.data + line_start, line_end - (queries.data + line_start), &params, conn->hash_table, &hashes, &max_hashes, &replies);
+			line_start = line_end - queries.data + 1;
+		}
+
+		memmove(queries.data, queries.data + line_start, queries.used - line_start);
+		queries.used -= line_start;
+
+		if (replies.used > 0) {
+			if (!write_all(conn->out_fd, replies.data, replies.used)) {
+				break;
+			}
+			replies.used = 0;
+		}
+	}
+
+	if (conn->in_fd != STDIN_FILENO) {
+		close(conn->in_fd);
+	}
+	free(queries.data);
+	free(replies.data);
+	free(hashes);
+	free(conn);
+
+	return NULL;
+}
+
+
+static int open_server_socket(char *socket_path, bool listening) {
+
+	int fd;
+	struct sockaddr_un address;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path %s is too long\n", socket_path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		fprintf(stderr, "ERROR: Could not create socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (listening) {
+		unlink(socket_path);
+		if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+			fprintf(stderr, "ERROR: Could not listen on socket %s\n", socket_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		fprintf(stderr, "ERROR: Could not connect to socket %s\n", socket_path);
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
+
+void serve_table(argument_struct args, char *table_file) {
+
+	uint32_t *hash_table = map_hash_table(table_file, 1UL << (2 * args.kmer_size), args.quiet);
+	serve_connection *conn;
+	pthread_t thread;
+	int listen_fd;
+	int fd;
+
+	/* Without -a/-b, a hit is any k-mer word which was seen at all */
+	if (args.min_val == 0 && args.max_val == 0) {
+		args.min_val = 1;
+	}
+	if (args.max_val == 0) {
+		args.max_val = UINT_MAX;
+	}
+
+	/* A client going away mid-reply only ends its connection */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (args.socket_path == NULL) {
+		if ((conn = malloc(sizeof(serve_connection))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		conn->args = &args;
+		conn->hash_table = hash_table;
+		conn->in_fd = STDIN_FILENO;
+		conn->out_fd = STDOUT_FILENO;
+		serve_connection_queries(conn);
+
+		munmap(hash_table, (1UL << (2 * args.kmer_size)) * sizeof(uint32_t));
+		return;
+	}
+
+	listen_fd = open_server_socket(args.socket_path, true);
+
+	if (!args.quiet) {
+		fprintf(stderr, "Serving queries on %s\n", args.socket_path);
+	}
+
+	/* Each connection gets its own thread; the table is only read, so they needn't coordinate */
+	while (true) {
+		if ((fd = accept(listen_fd, NULL, NULL)) == -1) {
+			continue;
+		}
+
+		if ((conn = malloc(sizeof(serve_connection))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		conn->args = &args;
+		conn->hash_table = hash_table;
+		conn->in_fd = fd;
+		conn->out_fd = fd;
+
+		if (pthread_create(&thread, NULL, serve_connection_queries, conn) != 0) {
+			fprintf(stderr, "WARNING: Failed to create thread for connection - continuing anyway\n");
+			close(fd);
+			free(conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
+
+
+static void *bench_client_queries(void *arg) {
+
+	/* Send this connection's share of the sequences in batches, reading each batch's replies before the next */
+
+	bench_client *client = (bench_client *) arg;
+	int fd = open_server_socket(client->args->socket_path, false);
+	text_buffer batch = {NULL, 0, 0};
+	char replies[SERVE_BUFFER_BYTES];
+	int queries_in_batch;
+	int replies_left;
+	ssize_t num_read;
+	ssize_t i; /* For loop counter */
+	unsigned long s; /* For loop counter */
+
+	for (s = client->connection; s < client->num_seqs; ) {
+		batch.used = 0;
+		for (queries_in_batch = 0; queries_in_batch < BENCH_BATCH_QUERIES && s < client->num_seqs; queries_in_batch++) {
+			ensure_text(&batch, strlen(client->seqs[s]) + 8);
+			batch.used += sprintf(batch.data + batch.used, "hits %s\n", client->seqs[s]);
+			s += client->num_connections;
+		}
+
+		if (!write_all(fd, batch.data, batch.used)) {
+			fprintf(stderr, "ERROR: Lost connection to server\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (replies_left = queries_in_batch; replies_left > 0; ) {
+			if ((num_read = read(fd, replies, sizeof(replies))) <= 0) {
+				fprintf(stderr, "ERROR: Lost connection to server\n");
+				exit(EXIT_FAILURE);
+			}
+			for (i = 0; i < num_read; i++) {
+				replies_left -= (replies[i] == '\n');
+			}
+		}
+	}
+
+	close(fd);
+	free(batch.data);
+
+	return NULL;
+}
+
+
+void bench_server(argument_struct args, int argc, char **argv) {
+
+	FILE *input_file;
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+	char **seqs = NULL;
+	unsigned long num_seqs = 0;
+	unsigned long max_seqs = 0;
+	unsigned long num_bases = 0;
+	pthread_t threads[args.num_threads];
+	bench_client clients[args.num_threads];
+	double start_time;
+	double seconds;
+	int format;
+	int file_index;
+	int i; /* For loop counter */
+
+	/* Everything is read first, so that only the queries are timed */
+	for (file_index = args.index_first_file; file_index < argc; file_index++) {
+		if ((input_file = fopen(argv[file_index], "r")) == NULL) {
+			fprintf(stderr, "ERROR: Could not open data file %s\n", argv[file_index]);
+			exit(EXIT_FAILURE);
+		}
+		format = which_format(input_file);
+
+		do {
+			get_next_batch(input_file, format, batch);
+			for (i = 0; i < batch->num_segs; i++) {
+				if (num_seqs == max_seqs) {
+					max_seqs = (max_seqs == 0) ? 1024 : max_seqs * 2;
+					if ((seqs = realloc(seqs, max_seqs * sizeof(char *))) == NULL) {
+						fprintf(stderr, "ERROR: Out of memory\n");
+						exit(EXIT_FAILURE);
+					}
+				}
+				if ((seqs[num_seqs++] = strdup(batch->segs[i].seq)) == NULL) {
+					fprintf(stderr, "ERROR: Out of memory\n");
+					exit(EXIT_FAILURE);
+				}
+				num_bases += batch->segs[i].length;
+			}
+		} while (!batch->bEOF);
+
+		fclose(input_file);
+	}
+
+	start_time = seconds_now();
+
+	for (i = 0; i < args.num_threads; i++) {
+		clients[i].args = &args;
+		clients[i].seqs = seqs;
+		clients[i].num_seqs = num_seqs;
+		clients[i].connection = i;
+		clients[i].num_connections = args.num_threads;
+		if (pthread_create(&threads[i], NULL, bench_client_queries, &clients[i]) != 0) {
+			fprintf(stderr, "ERROR: Failed to create client thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < args.num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	seconds = seconds_now() - start_time;
+
+	printf("%lu queries (%lu bases) in %.3f s over %d connections: %.0f queries/s, %.0f bases/s\n", num_seqs, num_bases, seconds,
+			args.num_threads, num_seqs / seconds, num_bases / seconds);
+
+	for (i = 0; i < (int) num_seqs; i++) {
+		free(seqs[i]);
+	}
+	free(seqs);
+	free_seg_batch(batch);
+
+	return;
+}
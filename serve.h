@@ -0,0 +1,21 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+/* serve maps a stored hash table once and answers queries about sequences, hashed as they are when counting, one per
+ * line, on stdin/stdout or (with -U/--socket) on each connection to a Unix domain socket:
+ *
+ *	count <sequence>	the count of each k-mer word of the sequence, in order ("-" for a word containing an N)
+ *	hits <sequence>		the number of k-mer words with counts from -a/--min to -b/--max, and the number of words
+ *
+ * Every complete query which has arrived is answered before the replies are written, so a client which sends queries
+ * in batches gets its replies in batches. bench sends the reads of its files to a server as hits queries, in batches
+ * from -t/--threads connections, and reports how many queries were answered each second.
+ */
+
+#define SERVE_BUFFER_BYTES (1 << 20)
+#define BENCH_BATCH_QUERIES 256
+
+void serve_table(argument_struct args, char *table_file);
+void bench_server(argument_struct args, int argc, char **argv);
+
+#endif
@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "c_tools.h"
+#include "table_memory.h"
+#include "sketch.h"
+
+
+/* Each row hashes k-mers with a different seed, so that two k-mers sharing a counter in one row are unlikely to share
+ * one in the others
+ */
+static const uint64_t row_seeds[SKETCH_DEPTH] = {0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9, 0xd6e8feb86659fd93};
+
+
+static inline uint64_t row_cell(count_min_sketch *sketch, uint64_t hash, int row) {
+
+	return row * sketch->width + (mix_hash(hash ^ row_seeds[row]) & (sketch->width - 1));
+}
+
+
+count_min_sketch *create_sketch(uint64_t memory_bytes, unsigned int histogram_size, int numa, int huge_pages, bool quiet) {
+
+	count_min_sketch *sketch;
+	unsigned int i; /* For loop counter */
+
+	if ((sketch = malloc(sizeof(count_min_sketch))) == NULL || (sketch->hist = malloc(histogram_size * sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Widest power of two whose rows fit in memory_bytes */
+	sketch->width = 1;
+	while (sketch->width * 2 * SKETCH_DEPTH * sizeof(uint32_t) <= memory_bytes) {
+		sketch->width *= 2;
+	}
+
+	sketch->counters = alloc_hash_table(sketch->width * SKETCH_DEPTH, numa, huge_pages, quiet);
+	sketch->estimating = false;
+	sketch->num_kmers = 0;
+	sketch->histogram_size = histogram_size;
+
+	for (i = 0; i < histogram_size; i++) {
+		sketch->hist[i] = 0;
+	}
+
+	if (!quiet) {
+		fprintf(stderr, "Counting k-mers approximately in a count-min sketch of %d rows of %" PRIu64 " counters (%" PRIu64 " MiB)\n",
+				SKETCH_DEPTH, sketch->width, (sketch->width * SKETCH_DEPTH * sizeof(uint32_t)) >> 20);
+	}
+
+	return sketch;
+}
+
+
+void free_sketch(count_min_sketch *sketch) {
+
+	free_hash_table(sketch->counters);
+	free(sketch->hist);
+	free(sketch);
+
+	return;
+}
+
+
+uint32_t sketch_estimate(count_min_sketch *sketch, uint64_t hash) {
+
+	uint32_t estimate = UINT32_MAX;
+	uint32_t count;
+	int row; /* For loop counter */
+
+	for (row = 0; row < SKETCH_DEPTH; row++) {
+		count = sketch->counters[row_cell(sketch, hash, row)];
+		estimate = (count < estimate) ? count : estimate;
+	}
+
+	return estimate;
+}
+
+
+static void sketch_add(count_min_sketch *sketch, uint64_t hash, bool concurrent) {
+
+	/* Counting on one thread, only the counters holding the current estimate are incremented (the "conservative
+	 * update"), which leaves far fewer counters inflated by other k-mers. Threads racing to do that could lose counts,
+	 * so with several threads every counter is incremented instead.
+	 */
+
+	uint32_t estimate;
+	uint64_t cell;
+	int row; /* For loop counter */
+
+	if (concurrent) {
+		for (row = 0; row < SKETCH_DEPTH; row++) {
+			__atomic_fetch_add(&sketch->counters[row_cell(sketch, hash, row)], 1, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	estimate = sketch_estimate(sketch, hash);
+
+	for (row = 0; row < SKETCH_DEPTH; row++) {
+		cell = row_cell(sketch, hash, row);
+		if (sketch->counters[cell] == estimate) {
+			sketch->counters[cell]++;
+		}
+	}
+
+	return;
+}
+
+
+static void sketch_add_to_histogram(count_min_sketch *sketch, uint64_t hash, bool concurrent) {
+
+	/* Called once for each occurrence of the k-mer, so the k-mer adds up to (about) one to its bin */
+
+	uint32_t estimate = sketch_estimate(sketch, hash);
+	unsigned int bin = (estimate < sketch->histogram_size) ? estimate - 1 : sketch->histogram_size - 1;
+
+	if (concurrent) {
+		__atomic_fetch_add(&sketch->hist[bin], (SKETCH_HIST_ONE + estimate / 2) / estimate, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&sketch->num_kmers, 1, __ATOMIC_RELAXED);
+	}
+	else {
+		sketch->hist[bin] += (SKETCH_HIST_ONE + estimate / 2) / estimate;
+		sketch->num_kmers++;
+	}
+
+	return;
+}
+
+
+void sketch_count(count_min_sketch *sketch, uint64_t hash, bool concurrent) {
+
+	if (sketch->estimating) {
+		sketch_add_to_histogram(sketch, hash, concurrent);
+	}
+	else {
+		sketch_add(sketch, hash, concurrent);
+	}
+
+	return;
+}
+
+
+void sketch_histogram(count_min_sketch *sketch, long *hist) {
+
+	unsigned int i; /* For loop counter */
+
+	for (i = 0; i < sketch->histogram_size; i++) {
+		hist[i] = (sketch->hist[i] + SKETCH_HIST_ONE / 2) / SKETCH_HIST_ONE;
+	}
+
+	return;
+}
+
+
+void print_sketch_bounds(count_min_sketch *sketch) {
+
+	/* The conservative update can only make the estimates lower, so the usual bound holds for either kind of update */
+
+	fprintf(stderr, "Approximate counts of %" PRIu64 " k-mers are at most %.0f too high, with probability %.1f%% for each k-mer\n",
+			sketch->num_kmers, ceil(exp(1) * sketch->num_kmers / sketch->width), 100 * (1 - exp(-SKETCH_DEPTH)));
+
+	return;
+}
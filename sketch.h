@@ -0,0 +1,35 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A count-min sketch counts k-mers approximately in a fixed amount of memory: each k-mer adds one to a counter in every
+ * row, and its count is estimated as the smallest of its counters. Estimates are never too low, and are too high by at
+ * most e * (k-mers counted) / width with probability 1 - e^-depth.
+ *
+ * The sketch cannot list the k-mers it has seen, so the histogram is estimated by a second pass over the reads in
+ * which every k-mer adds 1 / (its estimated count) to the bin of its estimated count, which sums to one for each
+ * distinct k-mer.
+ */
+
+#define SKETCH_DEPTH 4
+#define SKETCH_HIST_ONE (1UL << 20) /* Fixed-point 1 in the estimated histogram */
+
+typedef struct count_min_sketch {
+	uint32_t *counters; /* SKETCH_DEPTH rows of width counters */
+	uint64_t width; /* Power of two */
+	bool estimating; /* Set for the second pass, in which k-mers are added to the histogram instead of counted */
+	uint64_t *hist; /* Estimated number of distinct k-mers with each count, in units of SKETCH_HIST_ONE */
+	unsigned int histogram_size;
+	uint64_t num_kmers; /* K-mers seen while estimating the histogram */
+} count_min_sketch;
+
+count_min_sketch *create_sketch(uint64_t memory_bytes, unsigned int histogram_size, int numa, int huge_pages, bool quiet);
+void free_sketch(count_min_sketch *sketch);
+void sketch_count(count_min_sketch *sketch, uint64_t hash, bool concurrent);
+uint32_t sketch_estimate(count_min_sketch *sketch, uint64_t hash);
+void sketch_histogram(count_min_sketch *sketch, long *hist);
+void print_sketch_bounds(count_min_sketch *sketch);
+
+#endif
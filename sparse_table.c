@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "c_tools.h"
+#include "sparse_table.h"
+
+
+#define ENTRY_KMER(entry) (((entry) >> SPARSE_COUNT_BITS) - 1)
+#define ENTRY_COUNT(entry) ((uint32_t) ((entry) & SPARSE_MAX_COUNT))
+#define MIN_SHARD_CAPACITY 1024
+
+
+static uint64_t *alloc_entries(uint64_t capacity) {
+
+	uint64_t *entries;
+
+	if ((entries = calloc(capacity, sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return entries;
+}
+
+
+static uint64_t shard_capacity_for(uint64_t expected_kmers) {
+
+	/* Shards start big enough for expected_kmers between them, so that they needn't grow if the guess is right */
+
+	uint64_t capacity = MIN_SHARD_CAPACITY;
+
+	while (capacity * 3 / 4 < expected_kmers / SPARSE_SHARDS + 1) {
+		capacity *= 2;
+	}
+
+	return capacity;
+}
+
+
+sparse_table *create_sparse_table(uint64_t expected_kmers) {
+
+	sparse_table *table;
+	uint64_t capacity = shard_capacity_for(expected_kmers);
+	int i; /* For loop counter */
+
+	if ((table = malloc(sizeof(sparse_table))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < SPARSE_SHARDS; i++) {
+		table->shards[i].entries = alloc_entries(capacity);
+		table->shards[i].capacity = capacity;
+		table->shards[i].used = 0;
+		pthread_mutex_init(&table->shards[i].lock, NULL);
+	}
+
+	return table;
+}
+
+
+void free_sparse_table(sparse_table *table) {
+
+	int i; /* For loop counter */
+
+	for (i = 0; i < SPARSE_SHARDS; i++) {
+		free(table->shards[i].entries);
+		pthread_mutex_destroy(&table->shards[i].lock);
+	}
+	free(table);
+
+	return;
+}
+
+
+static uint64_t find_slot(uint64_t *entries, uint64_t capacity, uint64_t kmer, uint64_t mixed) {
+
+	/* Linear probing from the low bits of the mixed hash, stopping at the k-mer or an empty slot */
+
+	uint64_t slot = mixed & (capacity - 1);
+
+	while (entries[slot] != 0 && ENTRY_KMER(entries[slot]) != kmer) {
+		slot = (slot + 1) & (capacity - 1);
+	}
+
+	return slot;
+}
+
+
+static void grow_shard(sparse_shard *shard) {
+
+	uint64_t *old_entries = shard->entries;
+	uint64_t old_capacity = shard->capacity;
+	uint64_t kmer;
+	uint64_t i; /* For loop counter */
+
+	shard->capacity *= 2;
+	shard->entries = alloc_entries(shard->capacity);
+
+	for (i = 0; i < old_capacity; i++) {
+		if (old_entries[i] != 0) {
+			kmer = ENTRY_KMER(old_entries[i]);
+			shard->entries[find_slot(shard->entries, shard->capacity, kmer, mix_hash(kmer))] = old_entries[i];
+		}
+	}
+
+	free(old_entries);
+
+	return;
+}
+
+
+void sparse_add(sparse_table *table, uint64_t kmer, uint32_t new_count, bool concurrent) {
+
+	/* Add one to the count of kmer, or insert it with a count of new_count if it isn't in the table yet */
+
+	uint64_t mixed = mix_hash(kmer);
+	sparse_shard *shard = &table->shards[mixed >> 56];
+	uint64_t slot;
+
+	if (concurrent) {
+		pthread_mutex_lock(&shard->lock);
+	}
+
+	slot = find_slot(shard->entries, shard->capacity, kmer, mixed);
+
+	if (shard->entries[slot] == 0) {
+		shard->entries[slot] = ((kmer + 1) << SPARSE_COUNT_BITS) | new_count;
+		if (++shard->used > shard->capacity * 3 / 4) {
+			grow_shard(shard);
+		}
+	}
+	else if (ENTRY_COUNT(shard->entries[slot]) < SPARSE_MAX_COUNT) {
+		shard->entries[slot]++;
+	}
+
+	if (concurrent) {
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	return;
+}
+
+
+uint32_t sparse_count(sparse_table *table, uint64_t kmer) {
+
+	/* Only safe while nothing is being added */
+
+	uint64_t mixed = mix_hash(kmer);
+	sparse_shard *shard = &table->shards[mixed >> 56];
+	uint64_t entry = shard->entries[find_slot(shard->entries, shard->capacity, kmer, mixed)];
+
+	return (entry == 0) ? 0 : ENTRY_COUNT(entry);
+}
+
+
+uint64_t sparse_num_kmers(sparse_table *table) {
+
+	uint64_t num_kmers = 0;
+	int i; /* For loop counter */
+
+	for (i = 0; i < SPARSE_SHARDS; i++) {
+		num_kmers += table->shards[i].used;
+	}
+
+	return num_kmers;
+}
+
+
+uint64_t sparse_memory(sparse_table *table) {
+
+	uint64_t bytes = sizeof(sparse_table);
+	int i; /* For loop counter */
+
+	for (i = 0; i < SPARSE_SHARDS; i++) {
+		bytes += table->shards[i].capacity * sizeof(uint64_t);
+	}
+
+	return bytes;
+}
+
+
+uint64_t sparse_memory_for(uint64_t expected_kmers) {
+
+	/* What create_sparse_table(expected_kmers) allocates, if the k-mers are spread evenly over the shards */
+
+	return sizeof(sparse_table) + SPARSE_SHARDS * shard_capacity_for(expected_kmers) * sizeof(uint64_t);
+}
+
+
+void sparse_histogram(sparse_table *table, long *hist, unsigned int histogram_size) {
+
+	/* Adds the table's k-mers to hist, in the same bins as compute_histogram */
+
+	uint64_t entry;
+	uint64_t j; /* For loop counter */
+	int i; /* For loop counter */
+
+	for (i = 0; i < SPARSE_SHARDS; i++) {
+		for (j = 0; j < table->shards[i].capacity; j++) {
+			entry = table->shards[i].entries[j];
+			if (entry != 0) {
+				hist[(ENTRY_COUNT(entry) < histogram_size) ? ENTRY_COUNT(entry) - 1 : histogram_size - 1]++;
+			}
+		}
+	}
+
+	return;
+}
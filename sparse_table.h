@@ -0,0 +1,39 @@
+#ifndef SPARSE_TABLE_H
+#define SPARSE_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* A hash table holding only the k-mers which have been seen, for when the 4^k cells of the dense table would mostly be
+ * empty. It is split into shards by the high bits of the mixed hash; each shard is an open-addressing table which
+ * doubles when it is three quarters full, under its own lock when several threads are counting.
+ *
+ * Each entry packs (k-mer + 1) above a SPARSE_COUNT_BITS-bit count, which saturates; an empty entry is 0.
+ */
+
+#define SPARSE_SHARDS 256
+#define SPARSE_COUNT_BITS 29
+#define SPARSE_MAX_COUNT ((1U << SPARSE_COUNT_BITS) - 1)
+
+typedef struct {
+	uint64_t *entries;
+	uint64_t capacity; /* Power of two */
+	uint64_t used;
+	pthread_mutex_t lock;
+} sparse_shard;
+
+typedef struct sparse_table {
+	sparse_shard shards[SPARSE_SHARDS];
+} sparse_table;
+
+sparse_table *create_sparse_table(uint64_t expected_kmers);
+void free_sparse_table(sparse_table *table);
+void sparse_add(sparse_table *table, uint64_t kmer, uint32_t new_count, bool concurrent);
+uint32_t sparse_count(sparse_table *table, uint64_t kmer);
+uint64_t sparse_num_kmers(sparse_table *table);
+uint64_t sparse_memory(sparse_table *table);
+uint64_t sparse_memory_for(uint64_t expected_kmers);
+void sparse_histogram(sparse_table *table, long *hist, unsigned int histogram_size);
+
+#endif
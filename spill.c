@@ -0,0 +1,195 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "c_tools.h"
+#include "sparse_table.h"
+#include "spill.h"
+
+
+/* XORed into a k-mer before mixing it to pick its partition, so that each partition's k-mers still use every shard of
+ * the sparse table (which picks them by the unsalted mixed hash)
+ */
+#define SPILL_SALT 0xc2b2ae3d27d4eb4fULL
+
+
+static FILE *open_temp_file(char *temp_dir) {
+
+	/* The file is unlinked straight away, so that it goes when it is closed, or if zkc2 is killed */
+
+	char *template;
+	int fd;
+	FILE *file;
+
+	if ((template = malloc(strlen(temp_dir) + 20)) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(template, "%s/zkc2-spill-XXXXXX", temp_dir);
+
+	if ((fd = mkstemp(template)) == -1 || (file = fdopen(fd, "w+b")) == NULL) {
+		fprintf(stderr, "ERROR: Could not create a temporary file in %s\n", temp_dir);
+		exit(EXIT_FAILURE);
+	}
+	unlink(template);
+	free(template);
+
+	return file;
+}
+
+
+kmer_spill *create_spill(int num_partitions, char *temp_dir) {
+
+	kmer_spill *spill;
+	int i; /* For loop counter */
+
+	if (temp_dir == NULL) {
+		temp_dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	}
+
+	if ((spill = malloc(sizeof(kmer_spill))) == NULL || (spill->partitions = malloc(num_partitions * sizeof(spill_partition))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	spill->num_partitions = num_partitions;
+
+	for (i = 0; i < num_partitions; i++) {
+		if ((spill->partitions[i].buffer = malloc(SPILL_BUFFER_KMERS * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		spill->partitions[i].file = open_temp_file(temp_dir);
+		spill->partitions[i].used = 0;
+		pthread_mutex_init(&spill->partitions[i].lock, NULL);
+	}
+
+	return spill;
+}
+
+
+void free_spill(kmer_spill *spill) {
+
+	int i; /* For loop counter */
+
+	for (i = 0; i < spill->num_partitions; i++) {
+		fclose(spill->partitions[i].file);
+		free(spill->partitions[i].buffer);
+		pthread_mutex_destroy(&spill->partitions[i].lock);
+	}
+	free(spill->partitions);
+	free(spill);
+
+	return;
+}
+
+
+static void flush_partition(spill_partition *partition) {
+
+	if (fwrite(partition->buffer, sizeof(uint64_t), partition->used, partition->file) != partition->used) {
+		fprintf(stderr, "ERROR: Could not write k-mers to a temporary file (is the disk full?)\n");
+		exit(EXIT_FAILURE);
+	}
+	partition->used = 0;
+
+	return;
+}
+
+
+void spill_kmer(kmer_spill *spill, uint64_t kmer, bool concurrent) {
+
+	spill_partition *partition = &spill->partitions[mix_hash(kmer ^ SPILL_SALT) % spill->num_partitions];
+
+	if (concurrent) {
+		pthread_mutex_lock(&partition->lock);
+	}
+
+	partition->buffer[partition->used++] = kmer;
+	if (partition->used == SPILL_BUFFER_KMERS) {
+		flush_partition(partition);
+	}
+
+	if (concurrent) {
+		pthread_mutex_unlock(&partition->lock);
+	}
+
+	return;
+}
+
+
+void spill_histogram(kmer_spill *spill, uint64_t expected_kmers, long *hist, unsigned int histogram_size, bool quiet) {
+
+	/* Count each partition in turn, with a sparse table sized for expected_kmers (per partition), and add up their
+	 * histograms. Each partition's buffer is reused for reading its file back.
+	 */
+
+	spill_partition *partition;
+	sparse_table *table;
+	size_t num_read;
+	size_t j; /* For loop counter */
+	unsigned int i; /* For loop counter */
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] = 0;
+	}
+
+	for (i = 0; i < (unsigned int) spill->num_partitions; i++) {
+		if (!quiet) {
+			fprintf(stderr, "Counting partition %u of %d\n", i + 1, spill->num_partitions);
+		}
+
+		partition = &spill->partitions[i];
+		flush_partition(partition);
+		rewind(partition->file);
+
+		table = create_sparse_table(expected_kmers);
+
+		while ((num_read = fread(partition->buffer, sizeof(uint64_t), SPILL_BUFFER_KMERS, partition->file)) > 0) {
+			for (j = 0; j < num_read; j++) {
+				sparse_add(table, partition->buffer[j], 1, false);
+			}
+		}
+
+		if (ferror(partition->file)) {
+			fprintf(stderr, "ERROR: Could not read k-mers back from a temporary file\n");
+			exit(EXIT_FAILURE);
+		}
+
+		sparse_histogram(table, hist, histogram_size);
+		free_sparse_table(table);
+	}
+
+	return;
+}
+
+
+uint64_t spill_memory_for(int num_partitions) {
+
+	return sizeof(kmer_spill) + num_partitions * (sizeof(spill_partition) + SPILL_BUFFER_KMERS * sizeof(uint64_t));
+}
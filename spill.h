@@ -0,0 +1,35 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* For when no table of every k-mer fits in memory: each k-mer is written to the temporary file of one of
+ * num_partitions partitions (picked by hash, so that a k-mer's occurrences all go to the same one), and the partitions
+ * are then counted one at a time into a sparse table which only has to hold the k-mers of one partition.
+ */
+
+#define SPILL_BUFFER_KMERS 8192 /* K-mers held for each partition between writes */
+#define SPILL_MAX_PARTITIONS 1024
+
+typedef struct {
+	FILE *file;
+	uint64_t *buffer;
+	unsigned int used;
+	pthread_mutex_t lock;
+} spill_partition;
+
+typedef struct kmer_spill {
+	int num_partitions;
+	spill_partition *partitions;
+} kmer_spill;
+
+kmer_spill *create_spill(int num_partitions, char *temp_dir);
+void free_spill(kmer_spill *spill);
+void spill_kmer(kmer_spill *spill, uint64_t kmer, bool concurrent);
+void spill_histogram(kmer_spill *spill, uint64_t expected_kmers, long *hist, unsigned int histogram_size, bool quiet);
+uint64_t spill_memory_for(int num_partitions);
+
+#endif
@@ -0,0 +1,415 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+/* Needed for cpu_set_t and pthread_setaffinity_np */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/mman.h>
+
+#include "table_memory.h"
+
+
+/* Nodes which have CPUs, found the first time they are asked for */
+static struct {
+	int num_nodes;
+	int node[MAX_NUMA_NODES]; /* Kernel's number for each node */
+	cpu_set_t cpus[MAX_NUMA_NODES];
+} numa_layout;
+
+static pthread_once_t numa_layout_once = PTHREAD_ONCE_INIT;
+
+/* Tables can't be freed (or split between nodes) without knowing the size of the pages they were given */
+typedef struct table_mapping {
+	uint32_t *hash_table;
+	size_t length; /* Bytes mapped, a whole number of pages */
+	size_t page_size; /* Size of the pages asked for (which transparent huge pages may or may not get) */
+	struct table_mapping *next;
+} table_mapping;
+
+static table_mapping *table_mappings = NULL;
+static pthread_mutex_t table_mappings_lock = PTHREAD_MUTEX_INITIALIZER; /* Library callers may make and free tables from several threads */
+
+#define HUGE_PAGE_2M (2UL << 20)
+#define HUGE_PAGE_1G (1UL << 30)
+
+
+static bool read_list_file(char *path, cpu_set_t *set) {
+
+	/* Read a sysfs list such as "0-3,8-11" into set */
+
+	FILE *f;
+	char list[4096];
+	char *pos;
+	long from, to;
+	long i; /* For loop counter */
+
+	CPU_ZERO(set);
+
+	if ((f = fopen(path, "r")) == NULL) {
+		return false;
+	}
+	if (fgets(list, sizeof(list), f) == NULL) {
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	pos = list;
+	while (*pos >= '0' && *pos <= '9') {
+		from = strtol(pos, &pos, 10);
+		to = from;
+		if (*pos == '-') {
+			to = strtol(pos + 1, &pos, 10);
+		}
+		for (i = from; i <= to && i < CPU_SETSIZE; i++) {
+			CPU_SET(i, set);
+		}
+		if (*pos == ',') {
+			pos++;
+		}
+	}
+
+	return true;
+}
+
+
+static void find_numa_nodes(void) {
+
+	cpu_set_t online;
+	char path[64];
+	int n; /* For loop counter */
+
+	numa_layout.num_nodes = 0;
+
+	if (read_list_file("/sys/devices/system/node/online", &online)) {
+		for (n = 0; n < MAX_NUMA_NODES; n++) {
+			if (!CPU_ISSET(n, &online)) {
+				continue;
+			}
+			/* Memory-only nodes have no CPUs to pin threads to, so are left out */
+			sprintf(path, "/sys/devices/system/node/node%d/cpulist", n);
+			if (read_list_file(path, &numa_layout.cpus[numa_layout.num_nodes]) && CPU_COUNT(&numa_layout.cpus[numa_layout.num_nodes]) > 0) {
+				numa_layout.node[numa_layout.num_nodes] = n;
+				numa_layout.num_nodes++;
+			}
+		}
+	}
+
+	if (numa_layout.num_nodes == 0) {
+		/* No NUMA information (e.g. a kernel without CONFIG_NUMA), so treat the machine as one node */
+		numa_layout.num_nodes = 1;
+		numa_layout.node[0] = 0;
+		if (sched_getaffinity(0, sizeof(cpu_set_t), &numa_layout.cpus[0]) != 0) {
+			CPU_ZERO(&numa_layout.cpus[0]);
+		}
+	}
+
+	return;
+}
+
+
+int numa_node_count(void) {
+
+	pthread_once(&numa_layout_once, find_numa_nodes);
+
+	return numa_layout.num_nodes;
+}
+
+
+static table_mapping *find_mapping(uint32_t *hash_table) {
+
+	table_mapping *mapping;
+
+	pthread_mutex_lock(&table_mappings_lock);
+	for (mapping = table_mappings; mapping != NULL; mapping = mapping->next) {
+		if (mapping->hash_table == hash_table) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&table_mappings_lock);
+
+	if (mapping != NULL) {
+		return mapping;
+	}
+
+	fprintf(stderr, "INTERNAL ERROR: Hash table was not allocated by alloc_hash_table\n");
+	exit(EXIT_FAILURE);
+}
+
+
+uint64_t numa_partition_cells(uint32_t *hash_table, uint64_t num_cells) {
+
+	/* Cells in each node's partition of the table, rounded up to whole pages so that no page is shared by two nodes */
+
+	uint64_t cells_per_page = find_mapping(hash_table)->page_size / sizeof(uint32_t);
+	uint64_t num_nodes = numa_node_count();
+	uint64_t cells = (num_cells + num_nodes - 1) / num_nodes;
+
+	return ((cells + cells_per_page - 1) / cells_per_page) * cells_per_page;
+}
+
+
+void pin_thread_to_node(int node) {
+
+	/* Pinning is only a hint, so a thread which can't be pinned just carries on wherever the kernel runs it */
+
+	pthread_once(&numa_layout_once, find_numa_nodes);
+
+	if (CPU_COUNT(&numa_layout.cpus[node % numa_layout.num_nodes]) > 0) {
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &numa_layout.cpus[node % numa_layout.num_nodes]);
+	}
+
+	return;
+}
+
+
+static bool bind_memory(void *addr, size_t length, int mode, unsigned long nodemask) {
+
+	return syscall(SYS_mbind, addr, length, mode, &nodemask, (unsigned long) MAX_NUMA_NODES + 1, 0) == 0;
+}
+
+
+static void place_hash_table(uint32_t *hash_table, uint64_t num_cells, int numa, bool quiet) {
+
+	/* Set the NUMA policy of the table's pages, which takes effect as each page is first touched */
+
+	unsigned long all_nodes = 0;
+	uint64_t partition_cells, cells;
+	bool placed = true;
+	int n; /* For loop counter */
+
+	numa_node_count();
+
+	for (n = 0; n < numa_layout.num_nodes; n++) {
+		all_nodes |= 1UL << numa_layout.node[n];
+	}
+
+	if (numa == interleave_numa) {
+		placed = bind_memory(hash_table, find_mapping(hash_table)->length, MPOL_INTERLEAVE, all_nodes);
+	}
+	else {
+		partition_cells = numa_partition_cells(hash_table, num_cells);
+		for (n = 0; n < numa_layout.num_nodes && placed && (uint64_t) n * partition_cells < num_cells; n++) {
+			/* The last partition also takes whatever is left of the last page */
+			cells = find_mapping(hash_table)->length / sizeof(uint32_t) - n * partition_cells;
+			cells = (cells < partition_cells) ? cells : partition_cells;
+			placed = bind_memory(hash_table + n * partition_cells, cells * sizeof(uint32_t), MPOL_BIND, 1UL << numa_layout.node[n]);
+		}
+	}
+
+	if (!placed) {
+		if (!quiet) {
+			fprintf(stderr, "WARNING: Failed to set the NUMA placement of the hash table - continuing anyway\n");
+		}
+	}
+	else if (!quiet) {
+		fprintf(stderr, "Hash table %s across %d NUMA node%s\n", (numa == interleave_numa) ? "interleaved" : "partitioned",
+				numa_layout.num_nodes, (numa_layout.num_nodes == 1) ? "" : "s");
+	}
+
+	return;
+}
+
+
+static char *page_size_name(size_t page_size) {
+
+	return (page_size == HUGE_PAGE_1G) ? "1 GiB" : (page_size == HUGE_PAGE_2M) ? "2 MiB" : "4 KiB";
+}
+
+
+static uint32_t *trim_to_alignment(uint32_t *table, size_t length, size_t alignment) {
+
+	/* table was mapped alignment bytes longer than length, so unmap what comes before and after the aligned part */
+
+	uintptr_t start = (uintptr_t) table;
+	uintptr_t aligned = (start + alignment - 1) & ~(alignment - 1);
+
+	if (aligned > start) {
+		munmap(table, aligned - start);
+	}
+	munmap((void *) (aligned + length), start + alignment - aligned);
+
+	return (uint32_t *) aligned;
+}
+
+
+static uint32_t *map_table(size_t length, int flags) {
+
+	void *table = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+	return (table == MAP_FAILED) ? NULL : table;
+}
+
+
+uint32_t *alloc_hash_table(uint64_t num_cells, int numa, int huge_pages, bool quiet) {
+
+	/* Anonymous mappings are zeroed and only given pages as they are touched, just like a large calloc. Explicit huge
+	 * pages come from the kernel's reserved pool, so if there are not enough of them we fall back to the next smaller
+	 * size, then to transparent huge pages, then to normal pages.
+	 */
+
+	table_mapping *mapping;
+	size_t bytes = num_cells * sizeof(uint32_t);
+	size_t base_page_size = sysconf(_SC_PAGESIZE);
+	uint32_t *hash_table = NULL;
+
+	if ((mapping = malloc(sizeof(table_mapping))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (huge_pages == huge_1g_pages) {
+		mapping->page_size = HUGE_PAGE_1G;
+		mapping->length = ((bytes + HUGE_PAGE_1G - 1) / HUGE_PAGE_1G) * HUGE_PAGE_1G;
+		if ((hash_table = map_table(mapping->length, MAP_HUGETLB | MAP_HUGE_1GB)) == NULL) {
+			if (!quiet) {
+				fprintf(stderr, "WARNING: Could not get %zu 1 GiB huge pages for the hash table - trying 2 MiB pages\n", mapping->length / HUGE_PAGE_1G);
+			}
+			huge_pages = huge_2m_pages;
+		}
+	}
+
+	if (huge_pages == huge_2m_pages) {
+		mapping->page_size = HUGE_PAGE_2M;
+		mapping->length = ((bytes + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M) * HUGE_PAGE_2M;
+		if ((hash_table = map_table(mapping->length, MAP_HUGETLB | MAP_HUGE_2MB)) == NULL) {
+			if (!quiet) {
+				fprintf(stderr, "WARNING: Could not get %zu 2 MiB huge pages for the hash table - trying transparent huge pages\n", mapping->length / HUGE_PAGE_2M);
+			}
+			huge_pages = transparent_huge_pages;
+		}
+	}
+
+	if (huge_pages == transparent_huge_pages) {
+		/* Aligning the table to a huge page lets every page of it be a huge page (and NUMA partitions line up with them) */
+		mapping->page_size = HUGE_PAGE_2M;
+		mapping->length = ((bytes + HUGE_PAGE_2M - 1) / HUGE_PAGE_2M) * HUGE_PAGE_2M;
+		if ((hash_table = map_table(mapping->length + HUGE_PAGE_2M, 0)) != NULL) {
+			hash_table = trim_to_alignment(hash_table, mapping->length, HUGE_PAGE_2M);
+			if (madvise(hash_table, mapping->length, MADV_HUGEPAGE) != 0) {
+				if (!quiet) {
+					fprintf(stderr, "WARNING: Transparent huge pages are not available for the hash table - continuing with %s pages\n", page_size_name(base_page_size));
+				}
+				huge_pages = no_huge_pages;
+			}
+		}
+	}
+
+	if (hash_table == NULL) {
+		mapping->page_size = base_page_size;
+		mapping->length = ((bytes + base_page_size - 1) / base_page_size) * base_page_size;
+		if ((hash_table = map_table(mapping->length, 0)) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	mapping->hash_table = hash_table;
+	pthread_mutex_lock(&table_mappings_lock);
+	mapping->next = table_mappings;
+	table_mappings = mapping;
+	pthread_mutex_unlock(&table_mappings_lock);
+
+	if (!quiet && huge_pages != no_huge_pages) {
+		fprintf(stderr, "Hash table uses %s%s pages\n", (huge_pages == transparent_huge_pages) ? "transparent " : "", page_size_name(mapping->page_size));
+	}
+
+	if (numa != no_numa) {
+		place_hash_table(hash_table, num_cells, numa, quiet);
+	}
+
+	return hash_table;
+}
+
+
+void report_table_pages(uint32_t *hash_table) {
+
+	/* Print how much of the table really is in huge pages, as the kernel reports it in /proc/self/smaps */
+
+	FILE *smaps;
+	char line[256];
+	unsigned long start, kernel_page_size = 0, anon_huge = 0, rss = 0, hugetlb = 0;
+	bool in_table = false;
+
+	if ((smaps = fopen("/proc/self/smaps", "r")) == NULL) {
+		return;
+	}
+
+	while (fgets(line, sizeof(line), smaps)) {
+		if (sscanf(line, "%lx-", &start) == 1 && strchr(line, '-') == line + strspn(line, "0123456789abcdef")) {
+			in_table = (start == (unsigned long) hash_table);
+		}
+		else if (in_table) {
+			sscanf(line, "Rss: %lu kB", &rss);
+			sscanf(line, "KernelPageSize: %lu kB", &kernel_page_size);
+			sscanf(line, "AnonHugePages: %lu kB", &anon_huge);
+			sscanf(line, "Private_Hugetlb: %lu kB", &hugetlb); /* Explicit huge pages aren't counted in Rss */
+		}
+	}
+
+	fclose(smaps);
+
+	if (kernel_page_size == 0) {
+		return;
+	}
+
+	if (kernel_page_size * 1024 > (unsigned long) sysconf(_SC_PAGESIZE)) {
+		fprintf(stderr, "Hash table pages: %lu kB (explicit huge pages), %lu MiB resident\n", kernel_page_size, hugetlb >> 10);
+	}
+	else {
+		fprintf(stderr, "Hash table pages: %lu kB, %lu MiB resident of which %lu MiB in transparent huge pages\n", kernel_page_size, rss >> 10, anon_huge >> 10);
+	}
+
+	return;
+}
+
+
+void free_hash_table(uint32_t *hash_table) {
+
+	table_mapping **link = &table_mappings;
+	table_mapping *mapping;
+
+	pthread_mutex_lock(&table_mappings_lock);
+	while ((*link)->hash_table != hash_table) {
+		link = &(*link)->next;
+	}
+
+	mapping = *link;
+	*link = mapping->next;
+	pthread_mutex_unlock(&table_mappings_lock);
+
+	munmap(hash_table, mapping->length);
+	free(mapping);
+
+	return;
+}
@@ -0,0 +1,24 @@
+#ifndef TABLE_MEMORY_H
+#define TABLE_MEMORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The hash table is mapped straight from the kernel, so that it can be given huge pages and its pages can be placed on
+ * NUMA nodes before anything touches them. With partition_numa, cells [i * partition_cells, (i + 1) * partition_cells)
+ * live on the i'th node, so the high bits of a hash say which node owns it.
+ */
+
+enum numa_enum {no_numa, interleave_numa, partition_numa};
+enum huge_page_enum {no_huge_pages, transparent_huge_pages, huge_2m_pages, huge_1g_pages};
+
+#define MAX_NUMA_NODES 64
+
+uint32_t *alloc_hash_table(uint64_t num_cells, int numa, int huge_pages, bool quiet);
+void report_table_pages(uint32_t *hash_table);
+void free_hash_table(uint32_t *hash_table);
+int numa_node_count(void);
+uint64_t numa_partition_cells(uint32_t *hash_table, uint64_t num_cells);
+void pin_thread_to_node(int node);
+
+#endif
@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "sparse_table.h"
+#include "compact_table.h"
+#include "spill.h"
+#include "table_plan.h"
+
+
+uint64_t dense_table_bytes(int kmer_size) {
+
+	return (1UL << (2 * kmer_size)) * sizeof(uint32_t);
+}
+
+
+bool plan_needs_estimate(uint64_t max_memory, int kmer_size, bool dense_only) {
+
+	/* The estimate takes a pass over the input, so is only made if neither table of every possible k-mer fits */
+
+	return !dense_only && compact_memory_for(1UL << (2 * kmer_size)) > max_memory;
+}
+
+
+table_plan plan_table(uint64_t max_memory, int kmer_size, bool dense_only, bool hist_only, uint64_t distinct_kmers) {
+
+	/* Take the fastest choice which fits. distinct_kmers is only used if plan_needs_estimate() */
+
+	table_plan plan;
+	uint64_t num_cells = 1UL << (2 * kmer_size);
+
+	plan.kind = dense_kind;
+	plan.bytes = dense_table_bytes(kmer_size);
+	plan.expected_kmers = num_cells;
+	plan.num_partitions = 1;
+
+	if (plan.bytes <= max_memory) {
+		return plan;
+	}
+
+	if (dense_only) {
+		fprintf(stderr, "ERROR: The hash table needs %" PRIu64 " MiB, more than -M/--max-memory allows, and -i/--in, -o/--out and -N/--numa partition need the full hash table\n", plan.bytes >> 20);
+		exit(EXIT_FAILURE);
+	}
+
+	plan.kind = compact_kind;
+	plan.bytes = compact_memory_for(num_cells);
+
+	if (plan.bytes <= max_memory) {
+		return plan;
+	}
+
+	/* Headroom for the error of the estimate (a few standard errors of the HyperLogLog) */
+	plan.kind = sparse_kind;
+	plan.expected_kmers = distinct_kmers + distinct_kmers / 32;
+	plan.bytes = sparse_memory_for(plan.expected_kmers);
+
+	if (plan.bytes <= max_memory) {
+		return plan;
+	}
+
+	if (!hist_only) {
+		fprintf(stderr, "ERROR: About %" PRIu64 " distinct k-mers are expected, which need %" PRIu64 " MiB in a sparse table, more than -M/--max-memory allows, and extracting reads needs the count of every k-mer at once\n", distinct_kmers, plan.bytes >> 20);
+		exit(EXIT_FAILURE);
+	}
+
+	/* As few partitions as fit, as each costs a buffer and the partitions' k-mers are never spread quite evenly */
+	plan.kind = partitioned_kind;
+	for (plan.num_partitions = 2; plan.num_partitions <= SPILL_MAX_PARTITIONS; plan.num_partitions *= 2) {
+		plan.bytes = sparse_memory_for(plan.expected_kmers / plan.num_partitions) + spill_memory_for(plan.num_partitions);
+		if (plan.bytes <= max_memory) {
+			plan.expected_kmers /= plan.num_partitions;
+			return plan;
+		}
+	}
+
+	fprintf(stderr, "ERROR: About %" PRIu64 " distinct k-mers are expected, which don't fit in -M/--max-memory even split into %d partitions\n", distinct_kmers, SPILL_MAX_PARTITIONS);
+	exit(EXIT_FAILURE);
+}
+
+
+void print_table_plan(table_plan plan, uint64_t max_memory, int kmer_size) {
+
+	if (plan.kind == dense_kind) {
+		fprintf(stderr, "Counting %d-mers in the dense hash table: %" PRIu64 " MiB of the %" PRIu64 " MiB allowed\n", kmer_size, plan.bytes >> 20, max_memory >> 20);
+	}
+	else if (plan.kind == compact_kind) {
+		fprintf(stderr, "Counting %d-mers in the compact (16-bit) hash table: %" PRIu64 " MiB of the %" PRIu64 " MiB allowed\n", kmer_size, plan.bytes >> 20, max_memory >> 20);
+	}
+	else if (plan.kind == sparse_kind) {
+		fprintf(stderr, "Counting %d-mers in a sparse table sized for %" PRIu64 " k-mers: %" PRIu64 " MiB of the %" PRIu64 " MiB allowed\n", kmer_size, plan.expected_kmers, plan.bytes >> 20, max_memory >> 20);
+	}
+	else {
+		fprintf(stderr, "Counting %d-mers in %d partitions kept in temporary files, each in a sparse table sized for %" PRIu64 " k-mers: %" PRIu64 " MiB of the %" PRIu64 " MiB allowed\n", kmer_size, plan.num_partitions, plan.expected_kmers, plan.bytes >> 20, max_memory >> 20);
+	}
+
+	return;
+}
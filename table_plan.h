@@ -0,0 +1,27 @@
+#ifndef TABLE_PLAN_H
+#define TABLE_PLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* How the k-mers are counted when -M/--max-memory is given, chosen before anything is allocated so that a run which
+ * can't fit in its budget fails at the start rather than part-way through. The choices, from fastest to slowest, are
+ * the dense hash table, the compact (16-bit) hash table, a sparse table, and a sparse table for each of several
+ * partitions of the k-mers, which are kept on disk until they are counted.
+ */
+
+enum table_kind_enum {dense_kind, compact_kind, sparse_kind, partitioned_kind};
+
+typedef struct {
+	int kind;
+	uint64_t bytes; /* Memory the table will take */
+	uint64_t expected_kmers; /* Distinct k-mers the sparse table (or each partition's) is sized for */
+	int num_partitions;
+} table_plan;
+
+uint64_t dense_table_bytes(int kmer_size);
+bool plan_needs_estimate(uint64_t max_memory, int kmer_size, bool dense_only);
+table_plan plan_table(uint64_t max_memory, int kmer_size, bool dense_only, bool hist_only, uint64_t distinct_kmers);
+void print_table_plan(table_plan plan, uint64_t max_memory, int kmer_size);
+
+#endif
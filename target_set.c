@@ -0,0 +1,192 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "c_tools.h"
+#include "target_set.h"
+
+
+static int compare_mixed(const void *a, const void *b) {
+
+	uint64_t mixed_a = mix_hash(*(const uint64_t *) a);
+	uint64_t mixed_b = mix_hash(*(const uint64_t *) b);
+
+	return (mixed_a > mixed_b) - (mixed_a < mixed_b);
+}
+
+
+target_set *create_target_set(uint64_t *kmers, uint64_t num_kmers) {
+
+	/* Takes over kmers, which may hold repeats */
+
+	target_set *targets;
+	uint64_t mixed;
+	uint64_t num_unique = 0;
+	uint64_t bucket;
+	uint64_t i; /* For loop counter */
+
+	if ((targets = malloc(sizeof(target_set))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (num_kmers >= UINT32_MAX) {
+		fprintf(stderr, "ERROR: Too many target k-mers (the most is %u)\n", UINT32_MAX - 1);
+		exit(EXIT_FAILURE);
+	}
+
+	/* mix_hash is a bijection, so repeats of a k-mer end up next to each other */
+	qsort(kmers, num_kmers, sizeof(uint64_t), compare_mixed);
+	for (i = 0; i < num_kmers; i++) {
+		if (num_unique == 0 || kmers[i] != kmers[num_unique - 1]) {
+			kmers[num_unique++] = kmers[i];
+		}
+	}
+
+	targets->kmers = kmers;
+	targets->num_kmers = num_unique;
+
+	/* About one target in each bucket of the directory */
+	targets->directory_bits = 1;
+	while ((1UL << targets->directory_bits) < num_unique && targets->directory_bits < 32) {
+		targets->directory_bits++;
+	}
+
+	targets->filter_bits = 64;
+	while (targets->filter_bits < num_unique * TARGET_FILTER_BITS) {
+		targets->filter_bits *= 2;
+	}
+
+	if ((targets->counts = calloc(num_unique + 1, sizeof(uint32_t))) == NULL ||
+			(targets->directory = malloc(((1UL << targets->directory_bits) + 1) * sizeof(uint32_t))) == NULL ||
+			(targets->filter = calloc(targets->filter_bits / 64, sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bucket = 0;
+	for (i = 0; i < num_unique; i++) {
+		mixed = mix_hash(kmers[i]);
+		while (bucket <= mixed >> (64 - targets->directory_bits)) {
+			targets->directory[bucket++] = i;
+		}
+		targets->filter[(mixed & (targets->filter_bits - 1)) / 64] |= 1ULL << (mixed % 64);
+	}
+	while (bucket <= (1UL << targets->directory_bits)) {
+		targets->directory[bucket++] = num_unique;
+	}
+
+	return targets;
+}
+
+
+void free_target_set(target_set *targets) {
+
+	free(targets->kmers);
+	free(targets->counts);
+	free(targets->directory);
+	free(targets->filter);
+	free(targets);
+
+	return;
+}
+
+
+static inline uint64_t find_target(target_set *targets, uint64_t kmer) {
+
+	/* Returns the index of kmer, or num_kmers if it isn't a target */
+
+	uint64_t mixed = mix_hash(kmer);
+	uint64_t bucket;
+	uint64_t i; /* For loop counter */
+
+	if (!(targets->filter[(mixed & (targets->filter_bits - 1)) / 64] & (1ULL << (mixed % 64)))) {
+		return targets->num_kmers;
+	}
+
+	bucket = mixed >> (64 - targets->directory_bits);
+	for (i = targets->directory[bucket]; i < targets->directory[bucket + 1]; i++) {
+		if (targets->kmers[i] == kmer) {
+			return i;
+		}
+	}
+
+	return targets->num_kmers;
+}
+
+
+void target_add(target_set *targets, uint64_t kmer, bool concurrent) {
+
+	uint64_t i = find_target(targets, kmer);
+
+	if (i == targets->num_kmers) {
+		return;
+	}
+
+	if (concurrent) {
+		__atomic_fetch_add(&targets->counts[i], 1, __ATOMIC_RELAXED);
+	}
+	else {
+		targets->counts[i]++;
+	}
+
+	return;
+}
+
+
+uint32_t target_count(target_set *targets, uint64_t kmer) {
+
+	/* k-mers which aren't targets get the spare count past the end, which is always zero */
+
+	return targets->counts[find_target(targets, kmer)];
+}
+
+
+void target_histogram(target_set *targets, long *hist, unsigned int histogram_size) {
+
+	/* In the same bins as compute_histogram */
+
+	uint64_t i; /* For loop counter */
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] = 0;
+	}
+
+	for (i = 0; i < targets->num_kmers; i++) {
+		if (targets->counts[i] > 0) {
+			hist[(targets->counts[i] < histogram_size) ? targets->counts[i] - 1 : histogram_size - 1]++;
+		}
+	}
+
+	return;
+}
+
+
+uint64_t target_memory(target_set *targets) {
+
+	return targets->num_kmers * (sizeof(uint64_t) + sizeof(uint32_t)) + ((1UL << targets->directory_bits) + 1) * sizeof(uint32_t) + targets->filter_bits / 8;
+}
@@ -0,0 +1,32 @@
+#ifndef TARGET_SET_H
+#define TARGET_SET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Counts of a fixed set of target k-mers (e.g. those of a panel's probes) only, in memory proportional to the size of
+ * the set rather than 4^k. The targets are sorted by their mixed hash, and a directory gives where each value of the
+ * hash's top bits starts, so a k-mer is found in a bucket of about one target. Before that, a bitmap with a bit set
+ * for each target (at other bits of the same hash) turns away most k-mers which aren't targets with one cached read.
+ */
+
+#define TARGET_FILTER_BITS 16 /* Bits of filter for each target, rounded up to a power of two */
+
+typedef struct target_set {
+	uint64_t *kmers; /* Sorted by mix_hash */
+	uint32_t *counts;
+	uint64_t num_kmers;
+	uint32_t *directory; /* (1 << directory_bits) + 1 offsets into kmers */
+	int directory_bits;
+	uint64_t *filter;
+	uint64_t filter_bits; /* Power of two */
+} target_set;
+
+target_set *create_target_set(uint64_t *kmers, uint64_t num_kmers);
+void free_target_set(target_set *targets);
+void target_add(target_set *targets, uint64_t kmer, bool concurrent);
+uint32_t target_count(target_set *targets, uint64_t kmer);
+void target_histogram(target_set *targets, long *hist, unsigned int histogram_size);
+uint64_t target_memory(target_set *targets);
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Copyright (c) 2016 Genome Research Ltd.
+ *
+ * Author: George Hall <gh10@sanger.ac.uk>
+ *
+ * This file is part of K-mer Toolkit.
+ *
+ * K-mer Toolkit is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../libzkc.h"
+
+
+/* Counts the reads of a fasta file (one line per sequence) through libzkc, canonically at k = 13 on two threads, in
+ * batches; prints the histogram as hist does and saves the table. Reloading the saved table must give the same
+ * histogram, or the exit status is non-zero. Tables are then made and freed from several threads at once, as
+ * independent library callers would.
+ *
+ *	usage: libzkc-test <in.fa> <table to save>
+ */
+
+#define TEST_BATCH_SEQS 4 /* Small enough that the test input takes several batches */
+#define TEST_HISTOGRAM_SIZE 10001
+#define TEST_CONCURRENT_THREADS 8
+#define TEST_CONCURRENT_ROUNDS 16
+
+
+static void *create_and_free(void *arg) {
+
+	/* Each table is only mapped, not touched, so this costs address space rather than memory */
+
+	zkc_options options = zkc_default_options(13);
+	zkc_table *table;
+	int i; /* For loop counter */
+
+	(void) arg;
+	options.quiet = true;
+
+	for (i = 0; i < TEST_CONCURRENT_ROUNDS; i++) {
+		if ((table = zkc_create(options)) == NULL) {
+			return (void *) 1;
+		}
+		zkc_free(table);
+	}
+
+	return NULL;
+}
+
+
+int main(int argc, char **argv) {
+
+	FILE *input_file;
+	zkc_options options = zkc_default_options(13);
+	zkc_table *table;
+	zkc_table *loaded;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t line_len;
+	char *first_seq = NULL;
+	uint32_t first_count;
+	const char *seqs[TEST_BATCH_SEQS];
+	unsigned long lengths[TEST_BATCH_SEQS];
+	int num_seqs = 0;
+	long hist[TEST_HISTOGRAM_SIZE];
+	long loaded_hist[TEST_HISTOGRAM_SIZE];
+	pthread_t threads[TEST_CONCURRENT_THREADS];
+	void *thread_failed;
+	bool concurrent_failed = false;
+	int i; /* For loop counter */
+
+	if (argc != 3 || (input_file = fopen(argv[1], "r")) == NULL) {
+		fprintf(stderr, "usage: %s <in.fa> <table to save>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	options.use_canonical = true;
+	options.num_threads = 2;
+	if ((table = zkc_create(options)) == NULL) {
+		fprintf(stderr, "ERROR: zkc_create failed\n");
+		return EXIT_FAILURE;
+	}
+
+	while ((line_len = getline(&line, &line_size, input_file)) != -1) {
+		if (line[0] == '>') {
+			continue;
+		}
+		if (line_len > 0 && line[line_len - 1] == '\n') {
+			line[--line_len] = '\0';
+		}
+
+		if (first_seq == NULL) {
+			first_seq = strdup(line);
+		}
+		seqs[num_seqs] = strdup(line);
+		lengths[num_seqs++] = line_len;
+
+		if (num_seqs == TEST_BATCH_SEQS) {
+			zkc_add_sequences(table, seqs, lengths, num_seqs);
+			for (i = 0; i < num_seqs; i++) {
+				free((char *) seqs[i]);
+			}
+			num_seqs = 0;
+		}
+	}
+
+	zkc_add_sequences(table, seqs, lengths, num_seqs);
+	for (i = 0; i < num_seqs; i++) {
+		free((char *) seqs[i]);
+	}
+	free(line);
+	fclose(input_file);
+
+	zkc_histogram(table, hist, TEST_HISTOGRAM_SIZE);
+	for (i = 0; i < TEST_HISTOGRAM_SIZE; i++) {
+		if (hist[i] > 0) {
+			printf("%d %ld\n", i + 1, hist[i]);
+		}
+	}
+
+	/* A single word must count as it does in its sequence, and a string shorter than the window must not be read past */
+	zkc_query_sequence(table, first_seq, 13, &first_count);
+	if (zkc_query(table, first_seq, strlen(first_seq)) != first_count || zkc_query(table, first_seq, 12) != 0) {
+		fprintf(stderr, "ERROR: zkc_query disagrees with zkc_query_sequence\n");
+		return EXIT_FAILURE;
+	}
+	free(first_seq);
+
+	if (!zkc_save(table, argv[2])) {
+		fprintf(stderr, "ERROR: zkc_save failed\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((loaded = zkc_load(argv[2], options)) == NULL) {
+		fprintf(stderr, "ERROR: zkc_load failed\n");
+		return EXIT_FAILURE;
+	}
+
+	zkc_histogram(loaded, loaded_hist, TEST_HISTOGRAM_SIZE);
+	if (memcmp(hist, loaded_hist, sizeof(hist))) {
+		fprintf(stderr, "ERROR: Loaded table differs from saved one\n");
+		return EXIT_FAILURE;
+	}
+
+	zkc_free(table);
+	zkc_free(loaded);
+
+	for (i = 0; i < TEST_CONCURRENT_THREADS; i++) {
+		pthread_create(&threads[i], NULL, create_and_free, NULL);
+	}
+	for (i = 0; i < TEST_CONCURRENT_THREADS; i++) {
+		pthread_join(threads[i], &thread_failed);
+		concurrent_failed |= (thread_failed != NULL);
+	}
+	if (concurrent_failed) {
+		fprintf(stderr, "ERROR: zkc_create failed while tables were made from several threads\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -96,6 +96,169 @@ for file_prefix in "${prefixes[@]}"; do
 				fi
 
 				rm stdout.tmp stderr.tmp
+
+				if [ $extension == "fasta" ]; then
+					$program hist -k $K -c -C 50 -t 2 $desired_input > stdout.tmp 2> /dev/null
+
+					if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+					then 
+						((tests_passed++))
+					else
+						((tests_failed++))
+						echo "Chunked counting test fails for "$desired_input", k = "$K" canonical"
+					fi
+
+					rm stdout.tmp
+				fi
+
+				$program hist -k $K -c -t 2 -n 2 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then 
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Indexed counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm -f stdout.tmp $desired_input".zki"
+
+				for reader in thread uring; do
+					$program hist -k $K -c -R $reader $desired_input > stdout.tmp 2> /dev/null
+
+					if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+					then 
+						((tests_passed++))
+					else
+						((tests_failed++))
+						echo "Reader test fails for "$desired_input", k = "$K" canonical, reader = "$reader
+					fi
+
+					rm stdout.tmp
+				done
+
+				$program hist -k $K -c -N partition -L 2,2 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "NUMA partitioned counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				# Falls back to smaller pages if the machine has no 1 GiB pages reserved
+				$program hist -k $K -c -H 1G $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Huge page counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				# Few enough k-mers that a 16 MiB sketch counts them exactly
+				$program hist -k $K -c -A 16 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Approximate counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -B 16 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Bloom filter counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -F 1 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Sampled counting test (rate 1) fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -M 16 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Memory-budgeted (sparse table) counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -M 200 $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Memory-budgeted (compact table at k = 13) counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -m sample=$desired_input 2> /dev/null | awk 'NR > 1 {print $1, $2}' > stdout.tmp
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Multi-sample counting test fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				# Five samples at k = 15 would take 5 GiB as one table, so are counted in a sparse table each
+				$program hist -k $K -c -m a=$desired_input b=$desired_input c=$desired_input d=$desired_input e=$desired_input 2> /dev/null | awk 'NR > 1 && $2 == $3 && $2 == $6 {print $1, $2}' > stdout.tmp
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Multi-sample counting test (five samples) fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
+
+				$program hist -k $K -c -w $desired_input $desired_input > stdout.tmp 2> /dev/null
+
+				if cmp stdout.tmp $file_prefix"."$K"mer_hist.canonical"
+				then
+					((tests_passed++))
+				else
+					((tests_failed++))
+					echo "Target counting test (input as its own targets) fails for "$desired_input", k = "$K" canonical"
+				fi
+
+				rm stdout.tmp
 			done
 		done
 
@@ -109,6 +272,33 @@ for file_prefix in "${prefixes[@]}"; do
 			echo "extract.fasta.a2.b2.c.u0.fasta fails"
 		fi
 
+		$program extract -a 2 -b 2 -k 13 -u 0 -c -L 2,2 extract.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract.fasta.a2.b2.c.u0.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.fasta.a2.b2.c.u0.fasta fails with -L 2,2"
+		fi
+
+		$program extract -a 2 -b 2 -k 13 -u 0 -c -M 16 extract.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract.fasta.a2.b2.c.u0.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.fasta.a2.b2.c.u0.fasta fails with -M 16"
+		fi
+
+		$program extract -a 2 -b 2 -k 13 -u 0 -c -M 200 extract.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract.fasta.a2.b2.c.u0.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.fasta.a2.b2.c.u0.fasta fails with -M 200"
+		fi
+
 		$program extract -a 1 -b 2 -k 13 -u 0 -c extract.fasta > stdout.tmp 2> /dev/null
 		if cmp stdout.tmp extract.fasta.a1.b2.c.u0.fasta
 		then
@@ -127,6 +317,25 @@ for file_prefix in "${prefixes[@]}"; do
 			echo "extract.fasta.a1.b1.c.u0.fasta fails"
 		fi
 
+		# Reads starting with an N, with an N in their last window, with a window just after an N, and with one hit
+		$program extract -a 1 -b 1 -k 13 -u 0 -c extract_edges.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract_edges.fasta.a1.b1.c.u0.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract_edges.fasta.a1.b1.c.u0.fasta fails"
+		fi
+
+		$program extract -a 1 -b 1 -k 15 -r 5 -g 2 -s -u 0 -c extract_edges.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract_edges.fasta.k15.r5.g2.s.a1.b1.c.u0.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract_edges.fasta.k15.r5.g2.s.a1.b1.c.u0.fasta fails"
+		fi
+
 		$program extract -a 3 -b 3 -k 13 -u 0 -c extract.fasta > stdout.tmp 2> /dev/null
 		if cmp stdout.tmp extract.fasta.a3.b3.c.u0.fasta
 		then
@@ -172,8 +381,49 @@ for file_prefix in "${prefixes[@]}"; do
 			echo "extract.fasta.a1.b1.c.d.u0.fasta fails"
 		fi
 
+		$program extract -a 2 -b 2 -k 13 -u 0 -c -Q extract.fastq > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract.fastq.a2.b2.c.u0.fastq
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.fastq.a2.b2.c.u0.fastq fails"
+		fi
+
+		$program extract -a 2 -b 2 -k 13 -u 1 -c -S selection.tmp extract.fasta 2> /dev/null
+		$program select -q -S selection.tmp extract.fasta > stdout.tmp
+		if cmp stdout.tmp extract.fasta.a2.b2.c.u1.select.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.fasta.a2.b2.c.u1.select.fasta fails"
+		fi
+		rm selection.tmp selection.tmp.hits
+
+		$program extract -a 2 -b 2 -k 13 -u 5 -c -p -P either extract_R1.fasta extract_R2.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp extract.paired.a2.b2.c.u5.either.fasta
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "extract.paired.a2.b2.c.u5.either.fasta fails"
+		fi
+
 		rm stdout.tmp
 
+		$program hist -k 13 -c extract.fasta extract.fastq extract_R1.fasta extract_R2.fasta > serial.tmp 2> /dev/null
+		$program hist -k 13 -c -t 3 extract.fasta extract.fastq extract_R1.fasta extract_R2.fasta > stdout.tmp 2> /dev/null
+		if cmp stdout.tmp serial.tmp
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Parallel multi-file hist fails"
+		fi
+
+		rm stdout.tmp serial.tmp *.zki
+
 	elif [ $file_prefix == "hash_table_io" ]; then
 		zkc hist -k 13 -c -o tmp.hash in.fa > /dev/null 2> /dev/null
 		if cmp tmp.hash in.fa.c.k13.hash
@@ -193,6 +443,67 @@ for file_prefix in "${prefixes[@]}"; do
 			echo "Reading hash table from file test failed"
 		fi
 		rm tmp.hist
+
+		$program hist -k 13 -c -o tmp.hash in.fa > /dev/null 2> /dev/null
+		$program merge -k 13 -o tmp.merged.hash tmp.hash > /dev/null 2> /dev/null
+		if cmp tmp.merged.hash tmp.hash
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Merging one hash table test failed"
+		fi
+		cp tmp.hash tmp.merged.hash
+		if ! $program merge -k 13 -o tmp.merged.hash tmp.hash tmp.merged.hash > /dev/null 2> /dev/null && cmp tmp.merged.hash tmp.hash
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Merging into one of the input tables test failed"
+		fi
+		$program merge -k 13 -t 2 tmp.hash tmp.hash > tmp.hist 2> /dev/null
+		if awk '{print 2 * $1, $2}' using_file.hist | cmp tmp.hist
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Merging hash table with itself test failed"
+		fi
+		$program merge -k 13 -e subtract tmp.hash tmp.hash > tmp.hist 2> /dev/null
+		if [ ! -s tmp.hist ]
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Subtracting hash table from itself test failed"
+		fi
+		$program merge -k 13 -e intersect tmp.hash tmp.hash > tmp.hist 2> /dev/null
+		if cmp tmp.hist using_file.hist
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Intersecting hash table with itself test failed"
+		fi
+		awk '!/^>/ {print "hits " $0}' in.fa | $program serve -k 13 -c -q tmp.hash > tmp.hist 2> /dev/null
+		if [ -s tmp.hist ] && awk '$1 != $2 {exit 1}' tmp.hist
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "Serving hash table queries test failed"
+		fi
+
+		# Built by make lib
+		if ../../libzkc-test in.fa tmp.lib.hash > tmp.hist 2> /dev/null && cmp tmp.hist using_file.hist && cmp tmp.lib.hash tmp.hash
+		then
+			((tests_passed++))
+		else
+			((tests_failed++))
+			echo "libzkc API test failed (is libzkc-test built? - run make lib)"
+		fi
+		rm -f tmp.lib.hash
+		rm tmp.hash tmp.merged.hash tmp.hist
   
 	fi
 
@@ -29,8 +29,27 @@
 
 #include "c_tools.h"
 #include "fastlib.h"
-#include "zkc2.h"
 #include "parse_arguments.h"
+#include "output.h"
+#include "selection.h"
+#include "zkc2.h"
+#include "chunks.h"
+#include "index.h"
+#include "async_reader.h"
+#include "pipeline.h"
+#include "scheduler.h"
+#include "table_memory.h"
+#include "sketch.h"
+#include "sparse_table.h"
+#include "bloom.h"
+#include "hll.h"
+#include "table_plan.h"
+#include "compact_table.h"
+#include "spill.h"
+#include "merge.h"
+#include "serve.h"
+#include "multi_table.h"
+#include "target_set.h"
 
 
 void read_hash_table_from_file(uint32_t *hash_table, char *hash_table_location, bool quiet, uint64_t num_cells_hash_table) {
@@ -67,7 +86,7 @@ void read_hash_table_from_file(uint32_t *hash_table, char *hash_table_location,
 }
 
 
-void write_hash_table_to_file(uint32_t *hash_table, char *hash_file_name, bool quiet, uint64_t num_cells_hash_table) {
+bool write_hash_table_to_file(uint32_t *hash_table, char *hash_file_name, bool quiet, uint64_t num_cells_hash_table) {
 
 	FILE *out_file;
 
@@ -78,26 +97,27 @@ void write_hash_table_to_file(uint32_t *hash_table, char *hash_file_name, bool q
 
 	if (out_file == NULL) {
 		fprintf(stderr, "WARNING: Failed to create hash table file - it has not been written\n");
-		return;
+		return false;
 	}
 
 	if (fwrite(hash_table, sizeof(uint32_t), num_cells_hash_table, out_file) != num_cells_hash_table) {
 		fprintf(stderr, "WARNING: Did not manage to write hash table to file\n");
-		return;
+		fclose(out_file);
+		return false;
 	}
 
+	/* Buffered data is only written out on closing, so a failure here can leave the file incomplete */
 	if (fclose(out_file) != 0) {
-		if (!quiet) {
-			fprintf(stderr, "WARNING: Failed to close hash table file - continuing anyway\n");
-		}
+		fprintf(stderr, "WARNING: Failed to close hash table file - it may not have been completely written\n");
+		return false;
 	}
 
-	else if (!quiet) {
+	if (!quiet) {
 		fprintf(stderr, "Successfully wrote hash table to file\n");
 	}
 
 
-	return;
+	return true;
 }
 
 
@@ -200,14 +220,14 @@ void decode_hash(uint64_t hash, int region_size, int window_size, int interval_s
 }
 
 
-void decode_all_hashes(uint64_t hash_val, uint64_t rc_hash, uint64_t canonical_hash, int region_size, int window_size, int interval_size, int kmer_size, uint64_t hash_to_use, uint32_t *hash_table) {
+void decode_all_hashes(uint64_t hash_val, uint64_t rc_hash, uint64_t canonical_hash, int region_size, int window_size, int interval_size, int kmer_size, uint32_t count) {
 	fprintf(stderr, "Forward hash: ");
 	decode_hash(hash_val, region_size, window_size, interval_size, kmer_size);
 	fprintf(stderr, "\tReverse complement hash: ");
 	decode_hash(rc_hash, region_size, window_size, interval_size, kmer_size);
 	fprintf(stderr, "\tCanonical hash: ");
 	decode_hash(canonical_hash, region_size, window_size, interval_size, kmer_size);
-	fprintf(stderr, "\tValue of used hash in table: %" PRIu32, hash_table[hash_to_use]);
+	fprintf(stderr, "\tValue of used hash in table: %" PRIu32, count);
 
 
 	return;
@@ -337,573 +357,1284 @@ void print_histogram(long *hist, unsigned int histogram_size) {
 }
 
 
-void free_segment(segment *seg, int format) {
-	free(seg->name);
-	free(seg->seq);
-	if (format == 1) {
-		free(seg->qual);
+void set_bitmap_range(uint64_t *bitmap, unsigned long from, unsigned long to) {
+
+	/* Set bits [from, to) of bitmap */
+
+	unsigned long first_word = from / 64;
+	unsigned long last_word = (to - 1) / 64;
+	uint64_t first_mask = ~0ULL << (from % 64);
+	uint64_t last_mask = ~0ULL >> (63 - ((to - 1) % 64));
+	unsigned long w; /* For loop counter */
+
+	if (from >= to) {
+		return;
+	}
+
+	if (first_word == last_word) {
+		bitmap[first_word] |= (first_mask & last_mask);
+		return;
+	}
+
+	bitmap[first_word] |= first_mask;
+	for (w = first_word + 1; w < last_word; w++) {
+		bitmap[w] = ~0ULL;
 	}
+	bitmap[last_word] |= last_mask;
 
 	return;
 }
 
 
+unsigned long find_next_bit(uint64_t *bitmap, unsigned long from, unsigned long num_bits, bool value) {
 
-void pass_through_file(argument_struct args, int phase, uint32_t *hash_table, uint64_t num_cells_hash_table, int argc, char **argv) {
+	/* Returns the index of the first bit at or after 'from' which equals 'value', or num_bits if there is none */
 
-	FILE *input_file;
-	seg_return ret; /* Returned data from get_next_seg (i.e. read info and bEOF) */
-	int format;
-	uint64_t hash_val; 
-	uint64_t rc_hash;
-	uint64_t canonical_hash;
-	uint64_t hash_to_use;
-	int hash;
-	seq_hash_return hash_seq;
-	new_hashes new_hashes_triple;
-	int kmer_hits = 0;
-	int cutoff = -1 ;
-	unsigned int window_size;		/* Number of bases in window             3      10       3       10     3      10      3      10      3		*/
-	int num_regions;				/*										         ^-- interval           ^-- region							*/
-									/*										<--------------------------- window --------------------------->	*/
-	uint64_t base_index; 
-	unsigned long new_base_loc;
-	unsigned long end_newest_kmer = 0; /* Index of the end of the most recently found k-mer word in the desired range. Set to 0 to avoid the first base being unmasked. */
-	unsigned long *final_indices; /* Array holding the indices of the final base currently masked for each set of bases modulo (region_size + interval_size) */
-	unsigned long final_index;
-	int new_base_hash_array[5];
-	long read_count = 0;
-	long read_count_cutoff = 500000;
-	int min_hits_required;
-	int file_index;
-	enum mask_enum {no_mask, strict_mask, normal_mask} mask = args.mask;
-	uint64_t i; /* For loop counter */
-	int k, l; /* For loop counters */
-
-	int min_kmer_hits = args.min_kmer_hits;
-	int max_kmers_missed = args.max_kmers_missed;
-	unsigned int min_val = args.min_val;
-	unsigned int max_val = args.max_val;
-	bool quiet = args.quiet;
-	bool verbose = args.verbose;
-	bool use_canonical = args.use_canonical;
-	int kmer_size = args.kmer_size;
-	char *where_to_save_hash_table = args.where_to_save_hash_table;
-	int region_size = args.region_size;
-	int interval_size = args.interval_size;
-	int index_first_file = args.index_first_file;
-	int iCount;
+	unsigned long w = from / 64;
+	unsigned long num_words = BITMAP_WORDS(num_bits);
+	uint64_t word;
 
-	if (region_size == -1) {
-		region_size = kmer_size;
+	if (from >= num_bits) {
+		return num_bits;
 	}
 
-	if (interval_size == -1) {
-		interval_size = 0;
+	word = value ? bitmap[w] : ~bitmap[w];
+	word &= ~0ULL << (from % 64);
+
+	while (word == 0) {
+		if (++w >= num_words) {
+			return num_bits;
+		}
+		word = value ? bitmap[w] : ~bitmap[w];
 	}
 
-	/* If the user has not specified the maximum number of k-mer non-hits allowed then we can set the cutoff here */
-	if (max_kmers_missed == -1) {
+	from = (w * 64) + __builtin_ctzll(word);
 
-		/* If I leave 'cutoff' initially uninitialised, there is a warning generated by GCC about it possibly being 
-		 * uninitialised later on. Not sure why, but initialising it here solves the issue
-		 */
+	return (from < num_bits) ? from : num_bits;
+}
+
+
+kmer_params get_kmer_params(argument_struct args) {
+
+	kmer_params params;
+
+	params.kmer_size = args.kmer_size;
+	params.region_size = (args.region_size == -1) ? args.kmer_size : args.region_size;
+	params.interval_size = (args.interval_size == -1) ? 0 : args.interval_size;
+	params.num_regions = params.kmer_size / params.region_size;
+	params.window_size = ((params.num_regions - 1) * params.interval_size) + params.kmer_size;
+	params.use_canonical = args.use_canonical;
+	params.verbose = args.verbose;
+	params.concurrent = false;
+	params.min_val = args.min_val;
+	params.max_val = args.max_val;
+	params.sketch = NULL;
+	params.bloom = NULL;
+	params.sparse = NULL;
+	params.sample_threshold = 0;
+	params.hll = NULL;
+	params.compact = NULL;
+	params.spill = NULL;
+	params.multi = NULL;
+	params.sample = 0;
+	params.targets = NULL;
+
+	return params;
+}
+
+
+void ensure_read_bitmaps(read_bitmaps *bitmaps, unsigned long length) {
+
+	uint64_t *tmp;
 
-		cutoff = (min_kmer_hits == -1) ? 50 : min_kmer_hits;
+	if (BITMAP_WORDS(length) > bitmaps->num_words) {
+		bitmaps->num_words = BITMAP_WORDS(length);
+
+		if ((tmp = realloc(bitmaps->hits, bitmaps->num_words * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Ran out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		bitmaps->hits = tmp;
+		memset(bitmaps->hits, 0, bitmaps->num_words * sizeof(uint64_t));
+
+		if ((tmp = realloc(bitmaps->kept, bitmaps->num_words * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Ran out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		bitmaps->kept = tmp;
+		memset(bitmaps->kept, 0, bitmaps->num_words * sizeof(uint64_t));
 	}
 
-	num_regions = (kmer_size / region_size);
-	window_size = ((num_regions - 1) * interval_size) + kmer_size;
+	return;
+}
+
 
+void free_read_bitmaps(read_bitmaps *bitmaps) {
 
-	if (!quiet) {
-		if (phase == hash_phase) {
-			fprintf(stderr, "Counting k-mers into hash table\n");
+	free(bitmaps->hits);
+	free(bitmaps->kept);
+	bitmaps->hits = NULL;
+	bitmaps->kept = NULL;
+	bitmaps->num_words = 0;
+
+	return;
+}
+
+
+void mask_read(segment *seg, read_bitmaps *bitmaps, int mask, kmer_params *params, bool mask_quals) {
+
+	/* bitmaps->hits has a bit set for the start of every k-mer word in the desired range. These are first expanded into 
+	 * the bases they cover (the whole window for a normal mask, only the regions for a strict mask), and then each run 
+	 * of uncovered bases is overwritten with 'N's in one go. If mask_quals is set, the quality values of masked bases 
+	 * are set to the lowest possible score. Both bitmaps are left zeroed.
+	 */
+
+	unsigned long num_starts = (seg->length >= params->window_size) ? seg->length - params->window_size + 1 : 0;
+	unsigned long start, end;
+	unsigned long offset;
+	unsigned int region_width = (mask == strict_mask) ? (unsigned int) params->region_size : params->window_size;
+	int regions_per_hit = (mask == strict_mask) ? params->num_regions : 1;
+	int j; /* For loop counter */
+
+	for (start = find_next_bit(bitmaps->hits, 0, num_starts, true); start < num_starts; start = find_next_bit(bitmaps->hits, start + 1, num_starts, true)) {
+		for (j = 0, offset = start; j < regions_per_hit; j++, offset += params->region_size + params->interval_size) {
+			set_bitmap_range(bitmaps->kept, offset, offset + region_width);
 		}
-		else if (phase == extract_phase) {
-			fprintf(stderr, "Extracting reads with desired k-mer coverage\n");
+	}
+
+	for (start = find_next_bit(bitmaps->kept, 0, seg->length, false); start < seg->length; start = find_next_bit(bitmaps->kept, end, seg->length, false)) {
+		end = find_next_bit(bitmaps->kept, start, seg->length, true);
+		memset(seg->seq + start, 'N', end - start);
+		if (mask_quals) {
+			memset(seg->qual + start, '!', end - start);
 		}
+	}
 
-		fprintf(stderr, "One dot for each 500,000 reads processed\n");
+	if (seg->length > 0) {
+		memset(bitmaps->hits, 0, BITMAP_WORDS(seg->length) * sizeof(uint64_t));
+		memset(bitmaps->kept, 0, BITMAP_WORDS(seg->length) * sizeof(uint64_t));
 	}
 
-	for (file_index = index_first_file; file_index <= argc - 1; file_index++) {
+	return;
+}
 
-		if ((input_file = fopen(argv[file_index], "r")) == NULL) {
-			fprintf(stderr, "ERROR: Could not open data file %s\n", argv[file_index]);
-			exit(EXIT_FAILURE);
-		}
 
-		format = which_format(input_file);
-		rewind(input_file);
+void count_kmer(kmer_params *params, uint32_t *hash_table, uint64_t hash) {
 
-		if (phase == extract_phase) {
-			if (mask == strict_mask) {
-				if ((final_indices = calloc(region_size + interval_size, sizeof(unsigned long))) == NULL) {
-					fprintf(stderr, "ERROR: Ran out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-			}
+	/* Salted, so that the sampled k-mers are still spread over the sparse table's shards, which use mix_hash(hash) */
+	if (params->sample_threshold && mix_hash(hash ^ SAMPLE_SALT) > params->sample_threshold) {
+		return;
+	}
 
-			rewind(input_file);
-		}
+	if (params->targets) {
+		target_add(params->targets, hash, params->concurrent);
+	}
+	else if (params->hll) {
+		hll_add(params->hll, hash);
+	}
+	else if (params->sketch) {
+		sketch_count(params->sketch, hash, params->concurrent);
+	}
+	else if (params->bloom) {
+		bloom_count(params->bloom, hash, params->concurrent);
+	}
+	else if (params->sparse) {
+		sparse_add(params->sparse, hash, 1, params->concurrent);
+	}
+	else if (params->compact) {
+		compact_add(params->compact, hash, params->concurrent);
+	}
+	else if (params->spill) {
+		spill_kmer(params->spill, hash, params->concurrent);
+	}
+	else if (params->multi) {
+		multi_add(params->multi, hash, params->sample, params->concurrent);
+	}
+	else {
+		COUNT_KMER(hash_table, hash, params->concurrent);
+	}
 
-		read_count = 0;
+	return;
+}
 
-		do {
-			base_index = 0;
 
-			if (phase == extract_phase) {
-				kmer_hits = 0;
-				if (mask == normal_mask) {
-					end_newest_kmer = 0; 
-				}
-				else if (mask == strict_mask) {
-					for (k = 0; k < region_size + interval_size; k++) {
-						final_indices[k] = 0;
-					}
-				}
-			}
+static inline uint32_t kmer_count(kmer_params *params, uint32_t *hash_table, uint64_t hash) {
 
-			ret = get_next_seg(input_file, format);
+	if (params->targets) {
+		return target_count(params->targets, hash);
+	}
+	else if (params->sketch) {
+		return sketch_estimate(params->sketch, hash);
+	}
+	else if (params->bloom) {
+		return bloom_kmer_count(params->bloom, hash);
+	}
+	else if (params->sparse) {
+		return sparse_count(params->sparse, hash);
+	}
+	else if (params->compact) {
+		return compact_count(params->compact, hash);
+	}
 
-			read_count++;
+	return hash_table[hash];
+}
 
-			if (ret.segment.length < window_size) {
 
-				free_segment(&ret.segment, format);
-				if (!quiet) {
-					if (read_count == read_count_cutoff) {
-						read_count = 0;
-						fprintf(stderr, ".");
-					}
-				}
+uint32_t lookup_kmer(kmer_params *params, uint32_t *hash_table, uint64_t hash) {
 
-				continue;
-			} 
+	return kmer_count(params, hash_table, hash);
+}
 
-			if (verbose) {
-				fprintf(stderr, "Read name: %s\n", ret.segment.name);
-			}
 
-			if (phase == extract_phase) {
-				if (max_kmers_missed != -1) {
-					/* REPLACE WITH update_min_hits_required */
-					/* min_hits_required = minimum number of k-mer hits required to mean that we miss fewer than the maxiumum number of missed k-mers */
-					min_hits_required = ((ret.segment.length - kmer_size + 1) - max_kmers_missed);
-					min_hits_required = (min_hits_required > 0) ? min_hits_required : 0;
-					if (min_kmer_hits != -1) {
-						/* Set cutoff to be the smaller of the two requirements (i.e. make it as easy as possible for a read to be extracted) */
-						cutoff = (min_kmer_hits <= min_hits_required) ? min_kmer_hits : min_hits_required;
-					}
-					else {
-						cutoff = min_hits_required;
-					}
-					/* END min_hits_required() */
-				}
+static inline bool kmer_is_hit(kmer_params *params, uint32_t *hash_table, uint64_t hash) {
+
+	uint32_t count = kmer_count(params, hash_table, hash);
+
+	return count >= params->min_val && count <= params->max_val;
+}
+
+
+int process_read(segment *seg, int phase, kmer_params *params, uint32_t *hash_table, uint64_t *out) {
+
+	/* Hash every k-mer word in the read. In the hash phase each one is counted into the hash table; in the extract 
+	 * phase those whose counts are in the desired range are marked in the hit bitmap out (by their first base), and 
+	 * their number is returned. In the encode phase the hash of each word is stored in out[first base] and the table is
+	 * left alone; out must have been filled with NO_KMER beforehand. The read must be at least one window long.
+	 */
+
+	uint64_t hash_val; 
+	uint64_t rc_hash;
+	uint64_t canonical_hash;
+	uint64_t hash_to_use;
+	int hash;
+	seq_hash_return hash_seq;
+	new_hashes new_hashes_triple;
+	int kmer_hits = 0;
+	uint64_t base_index = 0; 
+	unsigned long new_base_loc;
+	int new_base_hash_array[5];
+	int iCount;
+
+	int kmer_size = params->kmer_size;
+	int region_size = params->region_size;
+	int interval_size = params->interval_size;
+	int num_regions = params->num_regions;
+	unsigned int window_size = params->window_size;
+	bool use_canonical = params->use_canonical;
+	bool verbose = params->verbose;
+
+	if (verbose) {
+		fprintf(stderr, "Read name: %s\n", seg->name);
+	}
+
+	hash_seq = hash_sequence(seg->seq, region_size, interval_size, window_size);
+
+	while (hash_seq.found_n == true && base_index <= (seg->length - window_size)) {
+		base_index += 1;
+		hash_seq = hash_sequence(seg->seq + base_index, region_size, interval_size, window_size);
+	}
+
+	if (hash_seq.found_n == false) {
+
+		/* REPLACE WITH update_hashes_new_window() */
+		new_hashes_triple = hash_new_window(hash_seq.hash, kmer_size);
+		hash_val = new_hashes_triple.new_hash;
+		rc_hash = new_hashes_triple.new_rc_hash;
+		canonical_hash = new_hashes_triple.canonical_hash;
+
+		hash_to_use = use_canonical ? canonical_hash : hash_val;
+		/* END update_hashes_new_window() */
+
+
+		base_index += window_size - 1; 
+
+		if (verbose) {
+			decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, kmer_count(params, hash_table, hash_to_use));
+			fprintf(stderr, " [1]\n");
+		}
+
+		if (phase == hash_phase) {
+			count_kmer(params, hash_table, hash_to_use);
+		}
+
+		else if (phase == extract_phase) {
+			if (kmer_is_hit(params, hash_table, hash_to_use)) {
+				SET_BIT(out, base_index - window_size + 1);
+				kmer_hits++;
 			}
+		}
 
-			hash_seq = hash_sequence(ret.segment.seq, region_size, interval_size, window_size);
+		else if (phase == encode_phase) {
+			out[base_index - window_size + 1] = hash_to_use;
+		}
 
-			while (hash_seq.found_n == true && base_index <= (ret.segment.length - window_size)) {
-				base_index += 1;
-				hash_seq = hash_sequence(ret.segment.seq + base_index, region_size, interval_size, window_size);
-				if (phase == extract_phase) {
-					if (mask == strict_mask || mask == normal_mask) {
-						if (verbose) {
-							fprintf(stderr, "(1) Masking at base_index = %lu\n", base_index);
-						}
-						ret.segment.seq[base_index] = 'N';
-					}
-				}
+		for (base_index += 1; base_index < seg->length; base_index++) {
+
+			for (iCount = 0; iCount < num_regions - 1; iCount++) {
+				/* Can guarantee that only the final new character hashed might be an 'N', as otherwise we would have already found it */
+				new_base_loc = base_index - window_size + region_size + (iCount * (region_size + interval_size));
+				hash = hash_base(seg->seq[new_base_loc]);
+				new_base_hash_array[iCount] = hash;
 			}
 
-			if (hash_seq.found_n == false) {
+			new_base_loc = base_index - window_size + region_size + (iCount * (region_size + interval_size));
+			hash = hash_base(seg->seq[new_base_loc]);
 
-				/* REPLACE WITH update_hashes_new_window() */
-				new_hashes_triple = hash_new_window(hash_seq.hash, kmer_size);
+			if (hash != -1) {
+				new_base_hash_array[iCount] = hash;
+				/* REPLACE WITH update_hashes_shift_window() */
+				new_hashes_triple = shift_hash(hash_val, rc_hash, num_regions, new_base_hash_array, kmer_size);
 				hash_val = new_hashes_triple.new_hash;
 				rc_hash = new_hashes_triple.new_rc_hash;
 				canonical_hash = new_hashes_triple.canonical_hash;
 
 				hash_to_use = use_canonical ? canonical_hash : hash_val;
-				/* END update_hashes_new_window() */
-
-
-				base_index += window_size - 1; 
+				/* END update_hashes_shift_window() */
 
 				if (verbose) {
-					decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, hash_to_use, hash_table);
-					fprintf(stderr, " [1]\n");
+					decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, kmer_count(params, hash_table, hash_to_use));
+					fprintf(stderr, " [2]\n");
 				}
 
 				if (phase == hash_phase) {
-					hash_table[hash_to_use] += 1;
+					count_kmer(params, hash_table, hash_to_use);
 				}
 
 				else if (phase == extract_phase) {
-					if (hash_table[hash_to_use] >= min_val && hash_table[hash_to_use] <= max_val) {
-
-						/* REPLACE WITH update_newest_kmer_indices() */
-						if (mask == strict_mask) {
-							for (k = base_index - region_size + 1, l = 0; l < (region_size); l++) {
-								if (verbose) {
-									fprintf(stderr, "1: (k + l) %% (region_size + interval_size) = %" PRIu32 " k+l = %d\n", (k + l) % (region_size + interval_size), k+l);
-								}
-								final_indices[(k + l) % (region_size + interval_size)] = k + l;	
-							}
-						}
-
-						else if (mask == normal_mask) {
-							end_newest_kmer = base_index;
-						}
-						/* END update_newest_kmer_indices() */
-
+					if (kmer_is_hit(params, hash_table, hash_to_use)) {
+						SET_BIT(out, base_index - window_size + 1);
 						kmer_hits++;
 					}
+				}
 
-					if (mask == strict_mask || mask == normal_mask) {
-						if (verbose) {
-							fprintf(stderr, "(2) - Masking at base_index = %lu\n", base_index);
-						}
-						if (mask == strict_mask) {
-							final_index = final_indices[base_index - window_size + 1 % (region_size + interval_size)];
-							if (verbose) {
-								fprintf(stderr, "2: Final index = %lu\n", final_index);
-							}
-							if ((final_index == 0) || ((base_index - window_size + 1) > final_index)) {
-								ret.segment.seq[base_index - window_size + 1] = 'N';
-							}
-						}
-						else if (mask == normal_mask) {
-							if ((end_newest_kmer == 0) || ((base_index - window_size + 1) > end_newest_kmer)) {
-								ret.segment.seq[base_index - window_size + 1] = 'N';
-							}
-						}
-					}
+				else if (phase == encode_phase) {
+					out[base_index - window_size + 1] = hash_to_use;
 				}
+			}
 
-				for (base_index += 1; base_index < ret.segment.length; base_index++) {
+			else {
 
-					for (iCount = 0; iCount < num_regions - 1; iCount++) {
-						/* Can guarantee that only the final new character hashed might be an 'N', as otherwise we would have already found it */
-						new_base_loc = base_index - window_size + region_size + (iCount * (region_size + interval_size));
-						hash = hash_base(ret.segment.seq[new_base_loc]);
-						new_base_hash_array[iCount] = hash;
-					}
+				base_index += 1;
+				hash_seq = hash_sequence(seg->seq + base_index, region_size, interval_size, window_size);
 
-					new_base_loc = base_index - window_size + region_size + (iCount * (region_size + interval_size));
-					hash = hash_base(ret.segment.seq[new_base_loc]);
+				/* Keep hashing the sequence starting at the next base and moving along the window until we don't find any more 'N's */
+				while (hash_seq.found_n == true && base_index < (seg->length - window_size)) {
+					base_index += 1;
+					hash_seq = hash_sequence(seg->seq + base_index, region_size, interval_size, window_size);
+				}
 
-					if (hash != -1) {
-						new_base_hash_array[iCount] = hash;
-						/* REPLACE WITH update_hashes_shift_window() */
-						new_hashes_triple = shift_hash(hash_val, rc_hash, num_regions, new_base_hash_array, kmer_size);
-						hash_val = new_hashes_triple.new_hash;
-						rc_hash = new_hashes_triple.new_rc_hash;
-						canonical_hash = new_hashes_triple.canonical_hash;
+				if (hash_seq.found_n == true) {
+					break;
+				}
 
-						hash_to_use = use_canonical ? canonical_hash : hash_val;
-						/* END update_hashes_shift_window() */
+				else {
+					/* REPLACE WITH update_hashes_new_window() */
+					new_hashes_triple = hash_new_window(hash_seq.hash, kmer_size);
+					hash_val = new_hashes_triple.new_hash;
+					rc_hash = new_hashes_triple.new_rc_hash;
+					canonical_hash = new_hashes_triple.canonical_hash;
 
-						if (verbose) {
-							decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, hash_to_use, hash_table);
-							fprintf(stderr, " [2]\n");
-						}
+					hash_to_use = use_canonical ? canonical_hash : hash_val;
+					/* END update_hashes_new_window() */
 
-						if (phase == hash_phase) {
-							hash_table[hash_to_use] += 1;
-						}
+					/* Move to end of k-mer word */
+					base_index += window_size - 1;
 
-						else if (phase == extract_phase) {
-							if (hash_table[hash_to_use] >= min_val && hash_table[hash_to_use] <= max_val) {
-								if (mask == strict_mask) {
-									for (k = base_index - region_size + 1, l = 0; l < (region_size); l++) {
-										if (verbose) {
-											fprintf(stderr, "2: (k + l) %% (region_size + interval_size) = %" PRIu32 " k+l = %d\n", (k + l) % (region_size + interval_size), k+l);
-										}
-										final_indices[(k + l) % (region_size + interval_size)] = k + l;	
-									}
-								}
-
-								else if (mask == normal_mask) {
-									end_newest_kmer = base_index;
-								}
-
-								kmer_hits++;
-							}
-
-							if (mask == strict_mask || mask == normal_mask) {
-								if (verbose) {
-									fprintf(stderr, "(3) Masking at base_index = %lu\n", base_index);
-								}
-								if (mask == strict_mask) {
-									final_index = final_indices[(base_index - window_size + 1) % (region_size + interval_size)];
-									if (verbose) {
-										fprintf(stderr, "3: base_index - window_size + 1 %% (region_size + interval_size) = %lu Final index = %lu\n", (base_index - window_size + 1) % (region_size + interval_size), final_index);
-									}
-									if ((final_index == 0) || ((base_index - window_size + 1) > final_index)) {
-										ret.segment.seq[base_index - window_size + 1] = 'N';
-									}
-								}
-								else if (mask == normal_mask) {
-									if ((end_newest_kmer == 0) || ((base_index - window_size + 1) > end_newest_kmer)) {
-										ret.segment.seq[base_index - window_size + 1] = 'N';
-									}
-								}
-							}
-						}
+					if (verbose) {
+						decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, kmer_count(params, hash_table, hash_to_use));
+						fprintf(stderr, " [3]\n");
 					}
 
-					else {
-
-						if (phase == extract_phase) {
-							if (mask == strict_mask || mask == normal_mask) {
-								/* Before moving onto the next k-mer word, mask, if necessary, the remainder of the k-mer word which is going to be skipped */
-								if (verbose) {
-									fprintf(stderr, "(4) Masking at base_index = %lu\n", base_index);
-								}
-								if (mask == strict_mask) {
-									for (i = base_index - window_size + 1; i < base_index; i++) {
-										final_index = final_indices[i % (region_size + interval_size)];
-										if (verbose) {
-											fprintf(stderr, "4: Final index = %lu\n", final_index);
-										}
-										if ((final_index == 0) || (i > final_index)) {
-											ret.segment.seq[i] = 'N';
-										}
-									}
-								}
-								else if (mask == normal_mask) {
-									for (i = base_index - window_size + 1; i < base_index; i++) {
-										if ((end_newest_kmer == 0) || (i > end_newest_kmer)) {
-											ret.segment.seq[i] = 'N';
-										}
-									}
-								}
-							}
-						}
-
-						base_index += 1;
-						hash_seq = hash_sequence(ret.segment.seq + base_index, region_size, interval_size, window_size);
-
-						/* Keep hashing the sequence starting at the next base and moving along the window until we don't find any more 'N's */
-						while (hash_seq.found_n == true && base_index < (ret.segment.length - window_size)) {
-							if (phase == extract_phase) {
-								/* REPLACE WITH skip_ns() */
-								if (mask == strict_mask || mask == normal_mask) {
-									if (verbose) {
-										fprintf(stderr, "(5) Masking at base_index = %lu\n", base_index);
-									}
-									if (mask == strict_mask) {
-										final_index = final_indices[base_index - window_size + 1 % (region_size + interval_size)];
-										if (verbose) {
-											fprintf(stderr, "5: Final index = %lu\n", final_index);
-										}
-										if ((final_index == 0) || (base_index > final_index)) {
-											ret.segment.seq[base_index] = 'N';
-										}
-									}
-									else if (mask == normal_mask) {
-										if ((end_newest_kmer == 0) || (base_index > end_newest_kmer)) {
-											ret.segment.seq[base_index] = 'N';
-										}
-									}
-								}
-								/* END skip_ns() */
-							}
-
-							base_index += 1;
-							hash_seq = hash_sequence(ret.segment.seq + base_index, region_size, interval_size, window_size);
-						}
-
-						if (hash_seq.found_n == true) {
-							break;
-						}
+					if (phase == hash_phase) {
+						count_kmer(params, hash_table, hash_to_use);
+					}
 
-						else {
-							/* REPLACE WITH update_hashes_new_window() */
-							new_hashes_triple = hash_new_window(hash_seq.hash, kmer_size);
-							hash_val = new_hashes_triple.new_hash;
-							rc_hash = new_hashes_triple.new_rc_hash;
-							canonical_hash = new_hashes_triple.canonical_hash;
-
-							hash_to_use = use_canonical ? canonical_hash : hash_val;
-							/* END update_hashes_new_window() */
-
-							/* Move to end of k-mer word */
-							base_index += window_size - 1;
-
-							if (verbose) {
-								decode_all_hashes(hash_val, rc_hash, canonical_hash, region_size, window_size, interval_size, kmer_size, hash_to_use, hash_table);
-								fprintf(stderr, " [3]\n");
-							}
-
-							if (phase == hash_phase) {
-								hash_table[hash_to_use] += 1;
-							}
-
-							else if (phase == extract_phase) {
-								if (hash_table[hash_to_use] >= min_val && hash_table[hash_to_use] <= max_val) {
-									if (mask == strict_mask) {
-										for (k = base_index - region_size + 1, l = 0; l < (region_size); l++) {
-											if (verbose) {
-												fprintf(stderr, "3: (k + l) %% (region_size + interval_size) = %" PRIu32 " k+l = %d\n", (k + l) % (region_size + interval_size), k+l);
-											}
-											final_indices[(k + l) % (region_size + interval_size)] = k + l;	
-										}
-									}
-
-									else if (mask == normal_mask) {
-										end_newest_kmer = base_index;
-									}
-
-									kmer_hits++;
-								}
-
-								if (mask == strict_mask || mask == normal_mask) {
-									if (verbose) {
-										fprintf(stderr, "(6) Masking at base_index = %lu\n", base_index);
-									}
-									if (mask == strict_mask) {
-										final_index = final_indices[base_index - window_size + 1 % (region_size + interval_size)];
-										if (verbose) {
-											fprintf(stderr, "6: Final index = %lu\n", final_index);
-										}
-										if ((final_index == 0) || ((base_index - window_size + 1) > final_index)) {
-											ret.segment.seq[base_index - window_size + 1] = 'N';
-										}
-									}
-									else if (mask == normal_mask) {
-										if ((end_newest_kmer == 0) || ((base_index - window_size + 1) > end_newest_kmer)) {
-											ret.segment.seq[base_index - window_size + 1] = 'N';
-										}
-									}
-								}
-							}
+					else if (phase == extract_phase) {
+						if (kmer_is_hit(params, hash_table, hash_to_use)) {
+							SET_BIT(out, base_index - window_size + 1);
+							kmer_hits++;
 						}
 					}
-				}
 
-				if (phase == extract_phase) {
-					if (mask == strict_mask || mask == normal_mask) {
-						/* Mask the bases in the final k-mer word */
-						if (verbose) {
-							fprintf(stderr, "(7) Masking at base_index = %lu\n", base_index);
-						}
-						for (i = base_index - window_size; i < base_index; i++) {
-							if (mask == strict_mask) {
-								final_index = final_indices[i % (region_size + interval_size)];
-								if (verbose) {
-									fprintf(stderr, "7: Final index = %lu\n", final_index);
-								}
-								if ((final_index == 0) || (i > final_index)) {
-									ret.segment.seq[i] = 'N';
-								}
-							}
-							else if (mask == normal_mask) {
-								if ((end_newest_kmer == 0) || (i > end_newest_kmer)) {
-									ret.segment.seq[i] = 'N';
-								}
-							}
-						}
+					else if (phase == encode_phase) {
+						out[base_index - window_size + 1] = hash_to_use;
 					}
 				}
 			}
+		}
+	}
 
-			if (phase == extract_phase) {
-				if (cutoff == -1) {
-					fprintf(stderr, "ERROR: THIS USE CASE FOUND WHEN CUTOFF WOULD HAVE BEEN UNINITIALISED!!\n");
-					exit(EXIT_FAILURE);
-				}
-				if (kmer_hits >= cutoff) {
-					printf(">%s %d\n%s\n", ret.segment.name, kmer_hits, ret.segment.seq);
-				}
-			}
 
-			free_segment(&ret.segment, format);
+	return kmer_hits;
+}
 
-			if (!quiet) {
-				if (read_count == read_count_cutoff) {
-					read_count = 0;
-					fprintf(stderr, ".");
-				}
-			}
 
-		} while (!ret.bEOF);
+int get_cutoff(argument_struct *args, long num_kmers) {
 
-		if (phase == extract_phase) {
-			if (mask == strict_mask) {
-				free(final_indices);
-			}
-		}
-		fclose(input_file);
-	}
+	/* Returns the minimum number of k-mer hits needed for a read (or pair of reads) containing num_kmers k-mers to be extracted */
 
-	/* Print newline after dots */
-	if (!quiet) {
-		fprintf(stderr, "\n");
+	int min_hits_required;
+
+	/* If the user has not specified the maximum number of k-mer non-hits allowed then the cutoff does not depend on the read */
+	if (args->max_kmers_missed == -1) {
+		return (args->min_kmer_hits == -1) ? 50 : args->min_kmer_hits;
 	}
 
-	if (phase == hash_phase) {
-		if (where_to_save_hash_table) {
-			write_hash_table_to_file(hash_table, where_to_save_hash_table, quiet, num_cells_hash_table);
-		}
+	/* min_hits_required = minimum number of k-mer hits required to mean that we miss fewer than the maxiumum number of missed k-mers */
+	min_hits_required = num_kmers - args->max_kmers_missed;
+	min_hits_required = (min_hits_required > 0) ? min_hits_required : 0;
+
+	if (args->min_kmer_hits != -1) {
+		/* Set cutoff to be the smaller of the two requirements (i.e. make it as easy as possible for a read to be extracted) */
+		return (args->min_kmer_hits <= min_hits_required) ? args->min_kmer_hits : min_hits_required;
 	}
+
+	return min_hits_required;
 }
 
 
-void do_hist_stuff(uint32_t *hash_table, uint64_t num_cells_hash_table, bool quiet) {
+long num_kmers_in_read(segment *seg, int kmer_size) {
+	return (seg->length >= (unsigned long) kmer_size) ? (long) (seg->length - kmer_size + 1) : 0;
+}
 
-	unsigned int histogram_size = 10001;
-	long hist[histogram_size];
 
-	compute_histogram(hist, quiet, histogram_size, hash_table, num_cells_hash_table);
-	print_histogram(hist, histogram_size);
+void emit_read(segment *seg, int kmer_hits, read_bitmaps *bitmaps, argument_struct *args, kmer_params *params, out_buffer *out_buf) {
 
-	return;
+	if (args->mask == strict_mask || args->mask == normal_mask) {
+		mask_read(seg, bitmaps, args->mask, params, args->fastq_output);
+	}
 
+	write_read(seg, kmer_hits, args, out_buf);
+
+	return;
 }
 
 
-uint32_t *create_hash_table(uint64_t num_cells_hash_table, char *stored_hash_table_location, bool quiet) {
+void write_read(segment *seg, int kmer_hits, argument_struct *args, out_buffer *out_buf) {
 
-	/* Hash table is 4**kmer_size cells which are guaranteed to be capable of holding the count of a k-mer 
-	 * providing that the count does not exceed 2^32 - the minimum size of a long). 
-	 */
+	if (args->fastq_output) {
+		out_buffer_write_fastq(out_buf, seg->name, kmer_hits, seg->seq, seg->qual, seg->length);
+	}
+	else {
+		out_buffer_write_fasta(out_buf, seg->name, kmer_hits, seg->seq, seg->length);
+	}
 
-	uint32_t *hash_table;
+	return;
+}
 
-	/* Magic malloc to make the following calloc muuuuch faster */
-	free(malloc(0));
 
-	if ((hash_table = calloc(num_cells_hash_table, sizeof(uint32_t))) == NULL) {
-		fprintf(stderr, "ERROR: Out of memory\n"); 
-		exit(EXIT_FAILURE);
+bool pair_passes(argument_struct *args, kmer_params *params, segment *segs, int *kmer_hits) {
+
+	long num_kmers[2];
+	bool passes[2];
+	int i; /* For loop counter */
+
+	for (i = 0; i < 2; i++) {
+		num_kmers[i] = num_kmers_in_read(&segs[i], args->kmer_size);
+		/* As when reads are extracted on their own, a read shorter than a window never passes */
+		passes[i] = (segs[i].length >= params->window_size) && (kmer_hits[i] >= get_cutoff(args, num_kmers[i]));
 	}
 
-	if (stored_hash_table_location != NULL) {
-		read_hash_table_from_file(hash_table, stored_hash_table_location, quiet, num_cells_hash_table);
+	if (args->pair_rule == pair_both) {
+		return passes[0] && passes[1];
+	}
+	else if (args->pair_rule == pair_either) {
+		return passes[0] || passes[1];
 	}
 
-	return hash_table;
+	/* pair_sum: the pair is treated as though it were one read */
+	return (kmer_hits[0] + kmer_hits[1]) >= get_cutoff(args, num_kmers[0] + num_kmers[1]);
 }
 
 
-void phase_automaton(argument_struct args, int argc, char **argv) {
-
-	uint32_t *hash_table;
-	char *stored_hash_table_location = args.stored_hash_table_location;
-	uint64_t num_cells_hash_table;
-	bool extract_reads = args.extract_reads;
-	bool print_hist = args.print_hist;
-	bool quiet = args.quiet;
-	int kmer_size = args.kmer_size; 
-	enum phase_enum phase = default_phase;
+void update_progress(long *read_count, bool quiet) {
 
-	num_cells_hash_table = 1UL << (2 * kmer_size); /* = 4^kmer_size */
+	long read_count_cutoff = 500000;
 
-	hash_table = create_hash_table(num_cells_hash_table, stored_hash_table_location, quiet);
+	if (!quiet) {
+		if (*read_count >= read_count_cutoff) {
+			*read_count = 0;
+			fprintf(stderr, ".");
+		}
+	}
+
+	return;
+}
+
+
+FILE *open_data_file(char *file_name, int *format, argument_struct *args, int phase) {
+
+	FILE *input_file;
+
+	if ((input_file = open_input_file(file_name, args->reader, args->quiet)) == NULL) {
+		fprintf(stderr, "ERROR: Could not open data file %s\n", file_name);
+		exit(EXIT_FAILURE);
+	}
+
+	*format = which_format(input_file);
+	rewind(input_file);
+
+	if (phase == extract_phase && args->fastq_output && *format != 1) {
+		fprintf(stderr, "ERROR: -Q/--fastq-output requires fastq input, but %s is not a fastq file\n", file_name);
+		exit(EXIT_FAILURE);
+	}
+
+	return input_file;
+}
+
+
+void extract_pairs(argument_struct args, uint32_t *hash_table, kmer_params *base_params, out_buffer *out_buf, selection_writer *sel, int argc, char **argv) {
+
+	/* Read both mates of each pair in lockstep, either from two files (-p) or from consecutive records of one file 
+	 * (--interleaved), and extract or drop them together
+	 */
+
+	kmer_params params = *base_params;
+	FILE *input_files[2];
+	int formats[2];
+	seg_return rets[2];
+	segment segs[2];
+	int kmer_hits[2];
+	read_bitmaps bitmaps[2] = {{NULL, NULL, 0}, {NULL, NULL, 0}};
+	bool passes;
+	bool bEOF = false;
+	long read_count = 0;
+	segment_arena *arena = create_segment_arena(); /* Holds both mates of the current pair */
+	int files_per_pair = args.interleaved ? 1 : 2;
+	int file_index;
+	int i; /* For loop counter */
+
+	if ((argc - args.index_first_file) % files_per_pair != 0) {
+		fprintf(stderr, "ERROR: -p/--paired requires an even number of input files\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (file_index = args.index_first_file; file_index < argc; file_index += files_per_pair) {
+
+		input_files[0] = open_data_file(argv[file_index], &formats[0], &args, extract_phase);
+		if (args.interleaved) {
+			input_files[1] = input_files[0];
+			formats[1] = formats[0];
+		}
+		else {
+			input_files[1] = open_data_file(argv[file_index + 1], &formats[1], &args, extract_phase);
+		}
+
+		do {
+			for (i = 0; i < 2; i++) {
+				if (i == 1 && bEOF && args.interleaved) {
+					fprintf(stderr, "ERROR: Interleaved file %s contains an odd number of reads\n", argv[file_index]);
+					exit(EXIT_FAILURE);
+				}
+
+				rets[i] = arena_next_seg(input_files[i], formats[i], arena);
+				segs[i] = rets[i].segment;
+				bEOF = rets[i].bEOF;
+
+				kmer_hits[i] = 0;
+				ensure_read_bitmaps(&bitmaps[i], segs[i].length);
+				if (segs[i].length >= params.window_size) {
+					kmer_hits[i] = process_read(&segs[i], extract_phase, &params, hash_table, bitmaps[i].hits);
+				}
+			}
+
+			if (!args.interleaved && rets[0].bEOF != rets[1].bEOF) {
+				fprintf(stderr, "ERROR: Paired files %s and %s contain different numbers of reads\n", argv[file_index], argv[file_index + 1]);
+				exit(EXIT_FAILURE);
+			}
+
+			passes = pair_passes(&args, &params, segs, kmer_hits);
+
+			for (i = 0; i < 2; i++) {
+				if (sel) {
+					selection_add_read(sel, passes, kmer_hits[i]);
+				}
+				else if (passes) {
+					emit_read(&segs[i], kmer_hits[i], &bitmaps[i], &args, &params, out_buf);
+				}
+
+				if (segs[i].length > 0) {
+					memset(bitmaps[i].hits, 0, BITMAP_WORDS(segs[i].length) * sizeof(uint64_t));
+				}
+			}
+
+			reset_segment_arena(arena);
+
+			if (!sel) {
+				/* Only flush after both mates have been written, so that they always stay together */
+				out_buffer_end_record(out_buf);
+			}
+
+			read_count++;
+			update_progress(&read_count, args.quiet);
+
+		} while (!bEOF);
+
+		if (sel) {
+			selection_end_file(sel);
+		}
+
+		fclose(input_files[0]);
+		if (!args.interleaved) {
+			fclose(input_files[1]);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		free_read_bitmaps(&bitmaps[i]);
+	}
+	free_segment_arena(arena);
+
+	return;
+}
+
+
+void pass_through_file(argument_struct args, int phase, uint32_t *hash_table, kmer_params *base_params, uint64_t num_cells_hash_table, int argc, char **argv) {
+
+	FILE *input_file;
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES); /* Reads are parsed a batch at a time */
+	segment *seg;
+	int format;
+	int kmer_hits = 0;
+	kmer_params params = *base_params; /* Says where the k-mers are counted, if not in hash_table */
+	count_min_sketch *sketch = params.sketch;
+	read_bitmaps bitmaps = {NULL, NULL, 0};
+	long read_count = 0;
+	int file_index;
+	int i; /* For loop counter */
+	out_writer *writer = NULL;
+	out_buffer *out_buf = NULL;
+	selection_writer *sel = NULL; /* Used instead of writer if only the selection of extracted reads is wanted */
+
+	bool quiet = args.quiet;
+	char *where_to_save_hash_table = args.where_to_save_hash_table;
+	int index_first_file = args.index_first_file;
+
+	if (!quiet) {
+		if (phase == hash_phase && sketch && sketch->estimating) {
+			fprintf(stderr, "Estimating histogram from count-min sketch\n");
+		}
+		else if (phase == hash_phase && sketch) {
+			fprintf(stderr, "Counting k-mers into count-min sketch\n");
+		}
+		else if (phase == hash_phase && params.bloom) {
+			fprintf(stderr, "Counting k-mers into Bloom filter and sparse table\n");
+		}
+		else if (phase == hash_phase && params.sparse && params.sample_threshold) {
+			fprintf(stderr, "Counting sampled k-mers into sparse table\n");
+		}
+		else if (phase == hash_phase && params.sparse) {
+			fprintf(stderr, "Counting k-mers into sparse table\n");
+		}
+		else if (phase == hash_phase && params.compact) {
+			fprintf(stderr, "Counting k-mers into compact hash table\n");
+		}
+		else if (phase == hash_phase && params.targets) {
+			fprintf(stderr, "Counting target k-mers\n");
+		}
+		else if (phase == hash_phase && params.multi) {
+			fprintf(stderr, "Counting k-mers into multi-sample table\n");
+		}
+		else if (phase == hash_phase && params.spill) {
+			fprintf(stderr, "Writing k-mers to %d partitions in temporary files\n", params.spill->num_partitions);
+		}
+		else if (phase == hash_phase) {
+			fprintf(stderr, "Counting k-mers into hash table\n");
+		}
+		else if (phase == extract_phase) {
+			fprintf(stderr, "Extracting reads with desired k-mer coverage\n");
+		}
+
+		fprintf(stderr, "One dot for each 500,000 reads processed\n");
+	}
+
+	if (phase == extract_phase) {
+		if (args.selection_file) {
+			sel = open_selection_writer(args.selection_file, argc - index_first_file);
+		}
+		else {
+			writer = open_out_writer(args.output_file, args.bgzf_output, args.num_threads);
+			out_buf = create_out_buffer(writer);
+		}
+	}
+
+	if (phase == extract_phase && (args.paired || args.interleaved)) {
+		extract_pairs(args, hash_table, &params, out_buf, sel, argc, argv);
+	}
+
+	/* Without chunking or a pipeline, all of the files are counted at once (unless they have to be counted under
+	 * different samples)
+	 */
+	else if (phase == hash_phase && args.num_threads > 1 && args.chunk_size == 0 && args.pipeline_encoders == 0 && !params.multi) {
+		count_files_in_parallel(argc - index_first_file, argv + index_first_file, &params, hash_table, args.num_threads, args.index_interval, args.reader, args.numa, quiet);
+	}
+
+	else for (file_index = index_first_file; file_index <= argc - 1; file_index++) {
+
+		input_file = open_data_file(argv[file_index], &format, &args, phase);
+
+		read_count = 0;
+
+		if (params.multi) {
+			params.sample = args.file_samples[file_index - index_first_file];
+		}
+
+		if (phase == hash_phase && args.chunk_size > 0 && format == 0) {
+			count_fasta_in_chunks(input_file, &params, hash_table, args.chunk_size, args.num_threads, &read_count, quiet);
+			fclose(input_file);
+			continue;
+		}
+
+		if (args.pipeline_encoders > 0) {
+			run_pipeline(input_file, format, phase, &args, &params, hash_table, out_buf, sel, &read_count);
+			if (sel) {
+				selection_end_file(sel);
+			}
+			fclose(input_file);
+			continue;
+		}
+
+		/* Split the file between threads at the record boundaries given by its index. Extraction stays serial, as the
+		 * reads have to be printed in order.
+		 */
+		if (phase == hash_phase && args.num_threads > 1) {
+			fclose(input_file);
+			count_files_in_parallel(1, argv + file_index, &params, hash_table, args.num_threads, args.index_interval, args.reader, args.numa, quiet);
+			continue;
+		}
+
+		do {
+			get_next_batch(input_file, format, batch);
+
+			for (i = 0; i < batch->num_segs; i++) {
+				seg = &batch->segs[i];
+
+				read_count++;
+				update_progress(&read_count, quiet);
+
+				if (seg->length < params.window_size) {
+					if (sel) {
+						selection_add_read(sel, false, 0);
+					}
+					continue;
+				} 
+
+				if (phase == extract_phase) {
+					ensure_read_bitmaps(&bitmaps, seg->length);
+				}
+
+				kmer_hits = process_read(seg, phase, &params, hash_table, bitmaps.hits);
+
+				if (phase == extract_phase) {
+					if (sel) {
+						selection_add_read(sel, kmer_hits >= get_cutoff(&args, num_kmers_in_read(seg, args.kmer_size)), kmer_hits);
+					}
+					else if (kmer_hits >= get_cutoff(&args, num_kmers_in_read(seg, args.kmer_size))) {
+						emit_read(seg, kmer_hits, &bitmaps, &args, &params, out_buf);
+						out_buffer_end_record(out_buf);
+					}
+					memset(bitmaps.hits, 0, BITMAP_WORDS(seg->length) * sizeof(uint64_t));
+				}
+			}
+
+		} while (!batch->bEOF);
+
+		if (sel) {
+			selection_end_file(sel);
+		}
+
+		fclose(input_file);
+	}
+
+	free_read_bitmaps(&bitmaps);
+	free_seg_batch(batch);
+
+	if (sel) {
+		close_selection_writer(sel);
+	}
+	else if (phase == extract_phase) {
+		free_out_buffer(out_buf);
+		close_out_writer(writer);
+	}
+
+	/* Print newline after dots */
+	if (!quiet) {
+		fprintf(stderr, "\n");
+	}
+
+	if (phase == hash_phase) {
+		if (where_to_save_hash_table) {
+			write_hash_table_to_file(hash_table, where_to_save_hash_table, quiet, num_cells_hash_table);
+		}
+	}
+}
+
+
+void do_hist_stuff(uint32_t *hash_table, kmer_params *params, uint64_t num_cells_hash_table, bool quiet) {
+
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
+	unsigned int i; /* For loop counter */
+
+	if (params->sparse) {
+		for (i = 0; i < histogram_size; i++) {
+			hist[i] = 0;
+		}
+		sparse_histogram(params->sparse, hist, histogram_size);
+	}
+	else if (params->compact) {
+		compact_histogram(params->compact, hist, histogram_size);
+	}
+	else if (params->targets) {
+		target_histogram(params->targets, hist, histogram_size);
+	}
+	else {
+		compute_histogram(hist, quiet, histogram_size, hash_table, num_cells_hash_table);
+	}
+	print_histogram(hist, histogram_size);
+
+	return;
+
+}
+
+
+uint32_t *create_hash_table(uint64_t num_cells_hash_table, char *stored_hash_table_location, int numa, int huge_pages, bool quiet) {
+
+	/* Hash table is 4**kmer_size cells which are guaranteed to be capable of holding the count of a k-mer 
+	 * providing that the count does not exceed 2^32 - the minimum size of a long). 
+	 */
+
+	uint32_t *hash_table;
+
+	hash_table = alloc_hash_table(num_cells_hash_table, numa, huge_pages, quiet);
+
+	if (stored_hash_table_location != NULL) {
+		read_hash_table_from_file(hash_table, stored_hash_table_location, quiet, num_cells_hash_table);
+	}
+
+	return hash_table;
+}
+
+
+void count_approximately(argument_struct args, int argc, char **argv) {
+
+	/* Count the k-mers into a count-min sketch, then go through the reads again to estimate the histogram from it */
+
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
+	kmer_params params = get_kmer_params(args);
+	count_min_sketch *sketch;
+
+	if (!args.quiet && args.approx_memory >= (1UL << (2 * args.kmer_size)) * sizeof(uint32_t)) {
+		fprintf(stderr, "WARNING: The exact hash table would fit in the memory given to -A/--approximate - continuing anyway\n");
+	}
+
+	sketch = create_sketch(args.approx_memory, histogram_size, args.numa, args.huge_pages, args.quiet);
+	params.sketch = sketch;
+
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	sketch->estimating = true;
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	sketch_histogram(sketch, hist);
+	print_histogram(hist, histogram_size);
+
+	if (!args.quiet) {
+		print_sketch_bounds(sketch);
+	}
+
+	free_sketch(sketch);
+
+	return;
+}
+
+
+void count_with_bloom_filter(argument_struct args, int argc, char **argv) {
+
+	/* Count the k-mers into a sparse table, leaving out those only seen once */
+
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
+	kmer_params params = get_kmer_params(args);
+
+	params.bloom = create_bloom_counter(args.bloom_memory, args.numa, args.huge_pages, args.quiet);
+
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	if (!args.quiet) {
+		fprintf(stderr, "Computing histogram\n");
+	}
+
+	bloom_histogram(params.bloom, hist, histogram_size);
+	print_histogram(hist, histogram_size);
+
+	if (!args.quiet) {
+		print_bloom_summary(params.bloom, args.kmer_size);
+	}
+
+	free_bloom_counter(params.bloom);
+
+	return;
+}
+
+
+uint64_t estimate_distinct_kmers(argument_struct args, int argc, char **argv) {
+
+	/* Add the k-mers of every estimate_every'th read to a HyperLogLog. Estimated this way, the number of distinct
+	 * k-mers is scaled up by estimate_every, which is only right for k-mers seen once: those seen in several reads are
+	 * overestimated, so a sampled estimate can only make the table bigger than it needs to be.
+	 */
+
+	FILE *input_file;
+	seg_batch *batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+	kmer_params params = get_kmer_params(args);
+	int format;
+	long read_count = 0;
+	unsigned long read_number = 0;
+	uint64_t distinct_kmers;
+	uint64_t total_kmers;
+	uint64_t max_kmers = 1UL << (2 * args.kmer_size);
+	int file_index;
+	int i; /* For loop counter */
+
+	params.hll = create_hll();
+
+	if (!args.quiet) {
+		fprintf(stderr, "Estimating number of distinct k-mers from 1 in %lu reads\n", args.estimate_every);
+		fprintf(stderr, "One dot for each 500,000 reads processed\n");
+	}
+
+	for (file_index = args.index_first_file; file_index <= argc - 1; file_index++) {
+
+		input_file = open_data_file(argv[file_index], &format, &args, hash_phase);
+
+		do {
+			get_next_batch(input_file, format, batch);
+
+			for (i = 0; i < batch->num_segs; i++) {
+				read_count++;
+				update_progress(&read_count, args.quiet);
+
+				if (read_number++ % args.estimate_every == 0 && batch->segs[i].length >= params.window_size) {
+					process_read(&batch->segs[i], hash_phase, &params, NULL, NULL);
+				}
+			}
+
+		} while (!batch->bEOF);
+
+		fclose(input_file);
+	}
+
+	/* There can't be more distinct k-mers than k-mers, or than there are k-mers of this size */
+	distinct_kmers = hll_estimate(params.hll) * args.estimate_every;
+	total_kmers = params.hll->occurrences * args.estimate_every;
+	if (distinct_kmers > total_kmers) {
+		distinct_kmers = total_kmers;
+	}
+	if (distinct_kmers > max_kmers) {
+		distinct_kmers = max_kmers;
+	}
+
+	if (!args.quiet) {
+		fprintf(stderr, "\nAbout %" PRIu64 " distinct k-mers in %" PRIu64 " k-mers\n", distinct_kmers, total_kmers);
+	}
+
+	free_hll(params.hll);
+	free_seg_batch(batch);
+
+	return distinct_kmers;
+}
+
+
+void count_sample(argument_struct args, int argc, char **argv) {
+
+	/* Count only the k-mers whose mixed hash falls in the lowest 1 / sample_rate of its range (as in FracMinHash). Every
+	 * occurrence of a sampled k-mer is counted, so each sampled k-mer has its true count, and the histogram of the
+	 * sample is scaled up by sample_rate.
+	 */
+
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
+	kmer_params params = get_kmer_params(args);
+	unsigned int i; /* For loop counter */
+
+	params.sample_threshold = UINT64_MAX / args.sample_rate;
+
+	/* Sized for the sampled part of the key space: the sampled share of the distinct k-mers in the input (of which there
+	 * can't be more than 4^k), estimated from every estimate_every'th read
+	 */
+	params.sparse = create_sparse_table(estimate_distinct_kmers(args, argc, argv) / args.sample_rate);
+
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	if (!args.quiet) {
+		fprintf(stderr, "Computing histogram from %" PRIu64 " sampled k-mers (scaled up by %lu)\n", sparse_num_kmers(params.sparse), args.sample_rate);
+	}
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] = 0;
+	}
+	sparse_histogram(params.sparse, hist, histogram_size);
+
+	for (i = 0; i < histogram_size; i++) {
+		hist[i] *= args.sample_rate;
+	}
+	print_histogram(hist, histogram_size);
+
+	free_sparse_table(params.sparse);
+
+	return;
+}
+
+
+table_plan choose_table(argument_struct args, int argc, char **argv) {
+
+	/* Reading a table from a file or writing one to it, and splitting one between NUMA nodes, need the dense table */
+	bool dense_only = args.stored_hash_table_location || args.where_to_save_hash_table || args.numa == partition_numa;
+	uint64_t distinct_kmers = 0;
+	table_plan plan;
+
+	if (plan_needs_estimate(args.max_memory, args.kmer_size, dense_only)) {
+		distinct_kmers = estimate_distinct_kmers(args, argc, argv);
+	}
+
+	plan = plan_table(args.max_memory, args.kmer_size, dense_only, !args.extract_reads, distinct_kmers);
+
+	if (!args.quiet) {
+		print_table_plan(plan, args.max_memory, args.kmer_size);
+	}
+
+	return plan;
+}
+
+
+static void add_targets_of_sequence(segment *seg, kmer_params *params, uint64_t **kmers, uint64_t *num_kmers, uint64_t *max_kmers, uint64_t **hashes, unsigned long *max_hashes) {
+
+	unsigned long i; /* For loop counter */
+
+	if (seg->length < params->window_size) {
+		return;
+	}
+
+	if (seg->length > *max_hashes) {
+		*max_hashes = seg->length;
+		if ((*hashes = realloc(*hashes, *max_hashes * sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < seg->length; i++) {
+		(*hashes)[i] = NO_KMER;
+	}
+	process_read(seg, encode_phase, params, NULL, *hashes);
+
+	for (i = 0; i < seg->length; i++) {
+		if ((*hashes)[i] == NO_KMER) {
+			continue;
+		}
+
+		if (*num_kmers == *max_kmers) {
+			*max_kmers *= 2;
+			if ((*kmers = realloc(*kmers, *max_kmers * sizeof(uint64_t))) == NULL) {
+				fprintf(stderr, "ERROR: Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		(*kmers)[(*num_kmers)++] = (*hashes)[i];
+	}
+
+	return;
+}
+
+
+target_set *load_targets(argument_struct args) {
+
+	/* The targets are the k-mer words (hashed as they are when counting) of each record of a fasta or fastq file of
+	 * probes, or of each line of a plain list of k-mers
+	 */
+
+	FILE *target_file;
+	kmer_params params = get_kmer_params(args);
+	seg_batch *batch;
+	segment seg;
+	target_set *targets;
+	uint64_t max_kmers = 1024;
+	uint64_t num_kmers = 0;
+	uint64_t *kmers;
+	uint64_t *hashes = NULL;
+	unsigned long max_hashes = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t line_length;
+	int format;
+	int first_char;
+	int i; /* For loop counter */
+
+	params.verbose = false;
+
+	if ((target_file = fopen(args.targets_file, "r")) == NULL) {
+		fprintf(stderr, "ERROR: Could not open target file %s\n", args.targets_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if ((kmers = malloc(max_kmers * sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	first_char = getc(target_file);
+	ungetc(first_char, target_file);
+
+	if (first_char == '>' || first_char == '@') {
+		format = which_format(target_file);
+		batch = create_seg_batch(SEG_BATCH_READS, SEG_BATCH_BYTES);
+		do {
+			get_next_batch(target_file, format, batch);
+			for (i = 0; i < batch->num_segs; i++) {
+				add_targets_of_sequence(&batch->segs[i], &params, &kmers, &num_kmers, &max_kmers, &hashes, &max_hashes);
+			}
+		} while (!batch->bEOF);
+		free_seg_batch(batch);
+	}
+	else {
+		seg.name = "";
+		seg.qual = "";
+		while ((line_length = getline(&line, &line_size, target_file)) != -1) {
+			while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')) {
+				line[--line_length] = '\0';
+			}
+			seg.seq = line;
+			seg.length = line_length;
+			add_targets_of_sequence(&seg, &params, &kmers, &num_kmers, &max_kmers, &hashes, &max_hashes);
+		}
+		free(line);
+	}
+
+	fclose(target_file);
+	free(hashes);
+
+	if (num_kmers == 0) {
+		fprintf(stderr, "ERROR: No target k-mers found in %s\n", args.targets_file);
+		exit(EXIT_FAILURE);
+	}
+
+	targets = create_target_set(kmers, num_kmers);
+
+	if (!args.quiet) {
+		fprintf(stderr, "Counting only %" PRIu64 " target k-mers, in %" PRIu64 " MiB\n", targets->num_kmers, target_memory(targets) >> 20);
+	}
+
+	return targets;
+}
+
+
+void count_in_partitions(argument_struct args, table_plan plan, int argc, char **argv) {
+
+	/* Write the k-mers to the partitions' temporary files, then count the partitions one at a time */
+
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
+	kmer_params params = get_kmer_params(args);
+
+	params.spill = create_spill(plan.num_partitions, args.temp_dir);
+
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	spill_histogram(params.spill, plan.expected_kmers, hist, histogram_size, args.quiet);
+	print_histogram(hist, histogram_size);
+
+	free_spill(params.spill);
+
+	return;
+}
+
+
+void count_samples(argument_struct args, int argc, char **argv) {
+
+	/* Count each file under its sample in a single table, then print a column of the histogram for each sample */
+
+	unsigned int histogram_size = 10001;
+	long *hists;
+	kmer_params params = get_kmer_params(args);
+	unsigned int i; /* For loop counter */
+	int s; /* For loop counter */
+
+	if ((hists = malloc(histogram_size * args.num_samples * sizeof(long))) == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	params.multi = create_multi_table(1UL << (2 * args.kmer_size), args.num_samples, args.numa, args.huge_pages, args.quiet);
+
+	pass_through_file(args, hash_phase, NULL, &params, 0, argc, argv);
+
+	if (!args.quiet) {
+		fprintf(stderr, "Computing histograms\n");
+	}
+
+	multi_histograms(params.multi, hists, histogram_size);
+
+	printf("# count");
+	for (s = 0; s < args.num_samples; s++) {
+		printf(" %s", args.sample_names[s]);
+	}
+	printf("\n");
+
+	for (i = 0; i < histogram_size; i++) {
+		for (s = 0; s < args.num_samples && hists[s * histogram_size + i] == 0; s++);
+		if (s < args.num_samples) {
+			printf("%u", i + 1);
+			for (s = 0; s < args.num_samples; s++) {
+				printf(" %ld", hists[s * histogram_size + i]);
+			}
+			printf("\n");
+		}
+	}
+
+	free_multi_table(params.multi);
+	free(hists);
+
+	return;
+}
+
+
+void phase_automaton(argument_struct args, int argc, char **argv) {
+
+	uint32_t *hash_table = NULL;
+	char *stored_hash_table_location = args.stored_hash_table_location;
+	uint64_t num_cells_hash_table;
+	bool extract_reads = args.extract_reads;
+	bool print_hist = args.print_hist;
+	bool quiet = args.quiet;
+	int kmer_size = args.kmer_size; 
+	enum phase_enum phase = default_phase;
+	kmer_params params = get_kmer_params(args);
+	table_plan plan = {dense_kind, 0, 0, 1};
+
+	num_cells_hash_table = 1UL << (2 * kmer_size); /* = 4^kmer_size */
+
+	if (args.max_memory > 0) {
+		plan = choose_table(args, argc, argv);
+	}
+
+	if (args.targets_file) {
+		params.targets = load_targets(args);
+	}
+	else if (plan.kind == partitioned_kind) {
+		count_in_partitions(args, plan, argc, argv);
+		return;
+	}
+	else if (plan.kind == sparse_kind) {
+		params.sparse = create_sparse_table(plan.expected_kmers);
+	}
+	else if (plan.kind == compact_kind) {
+		params.compact = create_compact_table(num_cells_hash_table, args.numa, args.huge_pages, quiet);
+	}
+	else {
+		hash_table = create_hash_table(num_cells_hash_table, stored_hash_table_location, args.numa, args.huge_pages, quiet);
+	}
 
 	if (stored_hash_table_location != NULL) {
 		if (print_hist) {
@@ -919,10 +1650,10 @@ void phase_automaton(argument_struct args, int argc, char **argv) {
 
 	while (true) {
 		if (phase == hash_phase || phase == extract_phase) {
-			pass_through_file(args, phase, hash_table, num_cells_hash_table, argc, argv);
+			pass_through_file(args, phase, hash_table, &params, num_cells_hash_table, argc, argv);
 		}
 		else if (phase == hist_phase) {
-			do_hist_stuff(hash_table, num_cells_hash_table, quiet);
+			do_hist_stuff(hash_table, &params, num_cells_hash_table, quiet);
 		}
 		else {
 			fprintf(stderr, "INTERNAL ERROR: Phase has not been set correctly\n");
@@ -956,19 +1687,38 @@ void phase_automaton(argument_struct args, int argc, char **argv) {
 			exit(EXIT_FAILURE);
 		}
 	}
-	free(hash_table);
+	if (params.sparse) {
+		free_sparse_table(params.sparse);
+		return;
+	}
+	else if (params.compact) {
+		free_compact_table(params.compact);
+		return;
+	}
+	else if (params.targets) {
+		free_target_set(params.targets);
+		return;
+	}
+
+	if (args.huge_pages != no_huge_pages && !quiet) {
+		/* Now that the table has been touched, say which pages it actually got */
+		report_table_pages(hash_table);
+	}
+
+	free_hash_table(hash_table);
 
 	return;
 }
 
 
-int main(int argc, char **argv) {
+void merge_stored_tables(argument_struct args, int argc, char **argv) {
 
-	argument_struct args;
-
-	args = parse_arguments(argc, argv);
+	unsigned int histogram_size = 10001;
+	long hist[histogram_size];
 
-	phase_automaton(args, argc, argv);
+	merge_tables(argv + args.index_first_file, argc - args.index_first_file, args.kmer_size, args.merge_operation, args.where_to_save_hash_table, args.num_threads, hist, histogram_size, args.quiet);
+	print_histogram(hist, histogram_size);
 
-	return 0;
+	return;
 }
+
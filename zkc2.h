@@ -9,7 +9,53 @@ typedef struct {
 	uint64_t canonical_hash;
 } new_hashes;
 
-enum phase_enum {hash_phase, hist_phase, extract_phase, default_phase};
+/* encode_phase is never run on its own: it asks process_read for the hashes of a read's k-mer words */
+enum phase_enum {hash_phase, hist_phase, extract_phase, default_phase, encode_phase};
+enum mask_enum {no_mask, strict_mask, normal_mask};
+enum pair_rule_enum {pair_both, pair_either, pair_sum};
+
+/* Everything needed to hash the k-mer words of a read */
+typedef struct {
+	int kmer_size;
+	int region_size;
+	int interval_size;
+	int num_regions;
+	unsigned int window_size;
+	bool use_canonical;
+	bool verbose;
+	bool concurrent; /* Set if several threads update the hash table at once */
+	unsigned int min_val; /* Range of counts for a k-mer word to be a hit when extracting */
+	unsigned int max_val;
+	struct count_min_sketch *sketch; /* If set, k-mers are counted approximately in this instead of the hash table */
+	struct bloom_counter *bloom; /* If set, k-mers are counted in its sparse table once its Bloom filter has seen them */
+	struct sparse_table *sparse; /* If set, k-mers are counted in this instead of the hash table */
+	uint64_t sample_threshold; /* If non-zero, only k-mers whose salted, mixed hash is at most this are counted */
+	struct hyperloglog *hll; /* If set, k-mers are only added to this, to estimate how many distinct ones there are */
+	struct compact_table *compact; /* If set, k-mers are counted in this instead of the hash table */
+	struct kmer_spill *spill; /* If set, k-mers are written to this, to be counted a partition at a time */
+	struct multi_table *multi; /* If set, k-mers are counted in this, under the sample of the file being counted */
+	int sample;
+	struct target_set *targets; /* If set, only these k-mers are counted, in this instead of the hash table */
+} kmer_params;
+
+/* Marks the start of a window which has no k-mer word (because it contains an 'N') in the output of encode_phase */
+#define NO_KMER UINT64_MAX
+
+/* XORed into a k-mer's hash before mixing it to decide whether the k-mer is sampled */
+#define SAMPLE_SALT 0x5bd1e9955bd1e995ULL
+
+/* Set unless k-mers are sampled or counted somewhere other than the dense hash table */
+#define COUNTS_ALL_IN_HASH_TABLE(params) (!(params)->sketch && !(params)->bloom && !(params)->sparse && !(params)->sample_threshold && !(params)->hll && !(params)->compact && !(params)->spill && !(params)->multi && !(params)->targets)
+
+/* Add one to the count of a k-mer, atomically if other threads may be counting into the same table */
+#define COUNT_KMER(hash_table, hash, concurrent) ((concurrent) ? (void) __atomic_fetch_add(&(hash_table)[hash], 1, __ATOMIC_RELAXED) : (void) ((hash_table)[hash] += 1))
+
+/* Per-read bitmaps used to mask extracted reads, with one bit per base */
+typedef struct {
+	uint64_t *hits; /* Set if the k-mer word starting at this base is a hit */
+	uint64_t *kept; /* Set if this base is covered by a hit (only used while masking) */
+	unsigned long num_words; /* Number of words allocated to each bitmap */
+} read_bitmaps;
 
 int hash_base(char base);
 seq_hash_return hash_sequence(char *seq, unsigned int region_size, unsigned int interval_size, unsigned int window_size);
@@ -18,7 +64,29 @@ new_hashes shift_hash(uint64_t current_seq_hash, uint64_t current_rc_hash, int n
 uint64_t hash_rc(uint64_t seq_hash, int kmer_size);
 void decode_hash(uint64_t hash, int region_size, int window_size, int interval_size, int kmer_size);
 void read_hash_table_from_file(uint32_t *hash_table, char *hash_table_location, bool quiet, uint64_t num_cells_hash_table);
-void write_hash_table_to_file(uint32_t *hash_table, char *hash_file_name, bool quiet, uint64_t num_cells_hash_table);
+bool write_hash_table_to_file(uint32_t *hash_table, char *hash_file_name, bool quiet, uint64_t num_cells_hash_table);
 void compute_histogram(long *hist, bool quiet, unsigned int histogram_size, uint32_t *hash_table, uint64_t num_cells_hash_table);
 void print_histogram(long *hist, unsigned int histogram_size);
-void free_segment(segment *seg, int format);
+void set_bitmap_range(uint64_t *bitmap, unsigned long from, unsigned long to);
+unsigned long find_next_bit(uint64_t *bitmap, unsigned long from, unsigned long num_bits, bool value);
+kmer_params get_kmer_params(argument_struct args);
+void ensure_read_bitmaps(read_bitmaps *bitmaps, unsigned long length);
+void free_read_bitmaps(read_bitmaps *bitmaps);
+void mask_read(segment *seg, read_bitmaps *bitmaps, int mask, kmer_params *params, bool mask_quals);
+void count_kmer(kmer_params *params, uint32_t *hash_table, uint64_t hash);
+uint32_t lookup_kmer(kmer_params *params, uint32_t *hash_table, uint64_t hash);
+int process_read(segment *seg, int phase, kmer_params *params, uint32_t *hash_table, uint64_t *out);
+int get_cutoff(argument_struct *args, long num_kmers);
+long num_kmers_in_read(segment *seg, int kmer_size);
+void emit_read(segment *seg, int kmer_hits, read_bitmaps *bitmaps, argument_struct *args, kmer_params *params, out_buffer *out_buf);
+void write_read(segment *seg, int kmer_hits, argument_struct *args, out_buffer *out_buf);
+void update_progress(long *read_count, bool quiet);
+bool pair_passes(argument_struct *args, kmer_params *params, segment *segs, int *kmer_hits);
+
+/* Modes, run by main once the arguments have been parsed */
+void count_approximately(argument_struct args, int argc, char **argv);
+void count_with_bloom_filter(argument_struct args, int argc, char **argv);
+void count_sample(argument_struct args, int argc, char **argv);
+void count_samples(argument_struct args, int argc, char **argv);
+void phase_automaton(argument_struct args, int argc, char **argv);
+void merge_stored_tables(argument_struct args, int argc, char **argv);